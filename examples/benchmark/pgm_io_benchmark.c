@@ -0,0 +1,125 @@
+/*
+ * PGM I/O Throughput Benchmark
+ * 
+ * Measures how fast lpgm_file_read() and lpgm_file_write() move pixel data,
+ * in megabytes of PGM file per second.
+ * 
+ * Usage:
+ *   ./pgm_io_benchmark.out input.pgm [repeat]
+ * 
+ * The input image is written and read back once as P5 (binary) and once as
+ * P2 (ASCII), selected through lpgm_t.magic_number.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <pigiem.h>
+
+static double
+now_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static double
+file_megabytes(const char* file_name)
+{
+	struct stat st;
+
+	if (stat(file_name, &st) != 0)
+	{
+		return 0.0;
+	}
+	return (double)st.st_size / (1024.0 * 1024.0);
+}
+
+static int
+benchmark_format(const lpgm_t* pgm, const char* magic_number, int repeat)
+{
+	const char* out_file = "bench_output.pgm";
+	lpgm_t out_pgm;
+	lpgm_t tmp;
+	int i;
+	double start, write_time, read_time, mb;
+	
+	out_pgm = *pgm;
+	out_pgm.magic_number[0] = magic_number[0];
+	out_pgm.magic_number[1] = magic_number[1];
+	
+	/* Write benchmark */
+	start = now_seconds();
+	for (i = 0; i < repeat; ++i)
+	{
+		if (lpgm_file_write(&out_pgm, out_file) != LPGM_OK)
+		{
+			fprintf(stderr, "Error: Could not write %s\n", out_file);
+			return -1;
+		}
+	}
+	write_time = now_seconds() - start;
+	mb = file_megabytes(out_file);
+	
+	/* Read benchmark */
+	start = now_seconds();
+	for (i = 0; i < repeat; ++i)
+	{
+		if (lpgm_file_read(out_file, &tmp) != LPGM_OK)
+		{
+			fprintf(stderr, "Error: Could not read %s\n", out_file);
+			return -1;
+		}
+		lpgm_file_destroy(&tmp);
+	}
+	read_time = now_seconds() - start;
+	
+	fprintf(stdout, "Format: %s, image: %d x %d, file: %.2f MB, repeat: %d\n",
+	        out_pgm.magic_number, out_pgm.im.w, out_pgm.im.h, mb, repeat);
+	fprintf(stdout, "  Write: %8.1f MB/s\n", mb * repeat / write_time);
+	fprintf(stdout, "  Read:  %8.1f MB/s\n", mb * repeat / read_time);
+	
+	remove(out_file);
+	
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	char* input_file;
+	lpgm_t pgm;
+	int repeat, status;
+	
+	if (argc != 2 && argc != 3)
+	{
+		fprintf(stderr, "Usage: %s input.pgm [repeat]\n", argv[0]);
+		return -1;
+	}
+	
+	input_file = argv[1];
+	repeat = (argc == 3) ? atoi(argv[2]) : 20;
+	if (repeat < 1)
+	{
+		repeat = 1;
+	}
+	
+	if (lpgm_file_read(input_file, &pgm) != LPGM_OK)
+	{
+		fprintf(stderr, "Error: Could not read file %s\n", input_file);
+		return -1;
+	}
+	
+	status = benchmark_format(&pgm, "P5", repeat);
+	if (status == 0)
+	{
+		status = benchmark_format(&pgm, "P2", repeat);
+	}
+	
+	lpgm_file_destroy(&pgm);
+	
+	return status;
+}
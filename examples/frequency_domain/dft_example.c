@@ -110,7 +110,7 @@ int main(int argc, char** argv)
 		                  shifted_signal[i].imaginary * shifted_signal[i].imaginary);
 		
 		/* Apply log scaling for better visualization: log(1 + magnitude) */
-		magnitude_im.data[i] = logf(1.0f + magnitude);
+		lpgm_set_pixel_value(&magnitude_im, i / cols, i % cols, logf(1.0f + magnitude));
 	}
 	
 	/* Normalize to 0-255 range */
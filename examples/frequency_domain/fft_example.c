@@ -21,17 +21,18 @@
  * This example automatically zero-pads the image if necessary.
  * 
  * This example:
- *   1. Reads an image
- *   2. Zero-pads to next power of 2 dimensions
- *   3. Applies 2D FFT
- *   4. Calculates magnitude spectrum
- *   5. Shifts zero-frequency to center
- *   6. Saves the magnitude spectrum
+ *   1. Reads an image straight into a zero-padded signal
+ *      (next power of 2 dimensions) with lpgm_file_read_fft_signal()
+ *   2. Applies 2D FFT
+ *   3. Calculates magnitude spectrum
+ *   4. Shifts zero-frequency to center
+ *   5. Saves the magnitude spectrum
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <time.h>
 
 #include <pigiem.h>
@@ -39,14 +40,13 @@
 int main(int argc, char** argv)
 {
 	char* input_file;
-	lpgm_t pgm;
-	lpgm_signal_t* signal;
+	lpgm_info_t info;
 	lpgm_signal_t* padded_signal;
 	lpgm_signal_t* fft_signal;
 	lpgm_signal_t* shifted_signal;
 	lpgm_image_t magnitude_im;
 	lpgm_t out_pgm;
-	int rows, cols, i, j, len;
+	int i;
 	int padded_rows, padded_cols, padded_len;
 	float magnitude;
 	clock_t start, end;
@@ -60,55 +60,31 @@ int main(int argc, char** argv)
 	
 	input_file = argv[1];
 	
-	/* Read input image */
+	/* Read input image, zero-padded to the next power of 2, in one pass */
 	fprintf(stdout, "Reading: %s\n", input_file);
-	if (lpgm_file_read(input_file, &pgm) != LPGM_OK)
+	if (lpgm_file_read_fft_signal(input_file, &padded_signal, &padded_rows, &padded_cols, &info) != LPGM_OK)
 	{
 		fprintf(stderr, "Error: Could not read file %s\n", input_file);
 		return -1;
 	}
-	
-	rows = pgm.im.h;
-	cols = pgm.im.w;
-	len = rows * cols;
-	
-	fprintf(stdout, "Original image size: %d x %d\n", cols, rows);
-	
-	/* Calculate padded dimensions (next power of 2) */
-	padded_rows = lpgm_next_power_of_two(rows);
-	padded_cols = lpgm_next_power_of_two(cols);
 	padded_len = padded_rows * padded_cols;
 	
+	fprintf(stdout, "Original image size: %d x %d\n", info.w, info.h);
 	fprintf(stdout, "Padded size (power of 2): %d x %d\n", padded_cols, padded_rows);
 	
 	/* Allocate signal arrays */
-	signal = lpgm_make_empty_signal(len);
-	padded_signal = lpgm_make_empty_signal(padded_len);
 	fft_signal = lpgm_make_empty_signal(padded_len);
 	shifted_signal = lpgm_make_empty_signal(padded_len);
 	
-	if (signal == NULL || padded_signal == NULL || fft_signal == NULL || shifted_signal == NULL)
+	if (fft_signal == NULL || shifted_signal == NULL)
 	{
 		fprintf(stderr, "Error: Memory allocation failed\n");
-		lpgm_file_destroy(&pgm);
+		lpgm_destroy_signal(padded_signal);
+		lpgm_destroy_signal(fft_signal);
+		lpgm_destroy_signal(shifted_signal);
 		return -1;
 	}
 	
-	/* Convert image to complex signal */
-	lpgm_image_to_signal(&pgm.im, signal);
-	
-	/* Zero-pad the signal */
-	/* Initialize padded signal to zeros (already done by lpgm_make_empty_signal) */
-	/* Copy original signal to top-left corner */
-	for (i = 0; i < rows; ++i)
-	{
-		for (j = 0; j < cols; ++j)
-		{
-			padded_signal[i * padded_cols + j].real = signal[i * cols + j].real;
-			padded_signal[i * padded_cols + j].imaginary = signal[i * cols + j].imaginary;
-		}
-	}
-	
 	/* Apply 2D FFT */
 	fprintf(stdout, "Applying 2D FFT...\n");
 	start = clock();
@@ -116,11 +92,9 @@ int main(int argc, char** argv)
 	if (lpgm_fft2(padded_signal, padded_rows, padded_cols, fft_signal, 0) != LPGM_OK)
 	{
 		fprintf(stderr, "Error: FFT failed\n");
-		lpgm_destroy_signal(signal);
 		lpgm_destroy_signal(padded_signal);
 		lpgm_destroy_signal(fft_signal);
 		lpgm_destroy_signal(shifted_signal);
-		lpgm_file_destroy(&pgm);
 		return -1;
 	}
 	
@@ -142,14 +116,16 @@ int main(int argc, char** argv)
 		                  shifted_signal[i].imaginary * shifted_signal[i].imaginary);
 		
 		/* Apply log scaling for better visualization: log(1 + magnitude) */
-		magnitude_im.data[i] = logf(1.0f + magnitude);
+		lpgm_set_pixel_value(&magnitude_im, i / padded_cols, i % padded_cols, logf(1.0f + magnitude));
 	}
 	
 	/* Normalize to 0-255 range */
 	lpgm_normalize_image_data(&magnitude_im, 255.0f);
 	
 	/* Save magnitude spectrum */
-	out_pgm = pgm;
+	memcpy(out_pgm.magic_number, info.magic_number, sizeof(out_pgm.magic_number));
+	out_pgm.comment = NULL;
+	out_pgm.max_val = 255;
 	out_pgm.im = magnitude_im;
 	if (lpgm_file_write(&out_pgm, "output_fft_magnitude.pgm") != LPGM_OK)
 	{
@@ -169,12 +145,10 @@ int main(int argc, char** argv)
 	        (float)(padded_rows * padded_cols) / (2.0f * log2f((float)(padded_rows * padded_cols))));
 	
 	/* Cleanup */
-	lpgm_destroy_signal(signal);
 	lpgm_destroy_signal(padded_signal);
 	lpgm_destroy_signal(fft_signal);
 	lpgm_destroy_signal(shifted_signal);
 	lpgm_image_destroy(&magnitude_im);
-	lpgm_file_destroy(&pgm);
 	
 	fprintf(stdout, "\nDone!\n");
 	
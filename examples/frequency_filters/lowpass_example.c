@@ -18,6 +18,7 @@
 int main(int argc, char* argv[])
 {
     lpgm_t pgm;
+    lpgm_info_t info;
     lpgm_signal_t *signal, *freq;
     int rows, cols, padded_rows, padded_cols;
     int i;
@@ -30,38 +31,21 @@ int main(int argc, char* argv[])
         return 1;
     }
     
-    if (lpgm_file_read(argv[1], &pgm) != LPGM_OK)
+    /* Read the image straight into a signal zero-padded to power of 2 for FFT */
+    if (lpgm_file_read_fft_signal(argv[1], &signal, &padded_rows, &padded_cols, &info) != LPGM_OK)
     {
         printf("Error: Cannot read %s\n", argv[1]);
         return 1;
     }
     
-    printf("Image: %dx%d\n", pgm.im.w, pgm.im.h);
-    
-    rows = pgm.im.h;
-    cols = pgm.im.w;
-    
-    /* Zero-pad to power of 2 for FFT */
-    padded_rows = lpgm_next_power_of_two(rows);
-    padded_cols = lpgm_next_power_of_two(cols);
+    rows = info.h;
+    cols = info.w;
     
+    printf("Image: %dx%d\n", cols, rows);
     printf("Padded: %dx%d\n", padded_cols, padded_rows);
     
-    /* Allocate signals */
-    signal = lpgm_make_empty_signal(padded_rows * padded_cols);
     freq = lpgm_make_empty_signal(padded_rows * padded_cols);
     
-    /* Convert image to signal with zero-padding */
-    for (i = 0; i < padded_rows * padded_cols; ++i)
-    {
-        signal[i].real = 0.0f;
-        signal[i].imaginary = 0.0f;
-    }
-    lpgm_image_to_signal(&pgm.im, signal);
-    
-    /* Zero-pad signal */
-    lpgm_zero_padding_signal(signal, rows, cols, signal, padded_rows, padded_cols);
-    
     /* Forward FFT */
     printf("Computing FFT...\n");
     lpgm_fft2(signal, padded_rows, padded_cols, freq, 0);
@@ -81,6 +65,12 @@ int main(int argc, char* argv[])
     lpgm_fft2(freq, padded_rows, padded_cols, signal, 1);
     
     /* Copy result back to image */
+    pgm.magic_number[0] = info.magic_number[0];
+    pgm.magic_number[1] = info.magic_number[1];
+    pgm.magic_number[2] = '\0';
+    pgm.comment = NULL;
+    pgm.max_val = info.max_val;
+    pgm.im = lpgm_make_empty_image(cols, rows);
     for (i = 0; i < rows * cols; ++i)
     {
         int x = i / cols;
@@ -88,7 +78,7 @@ int main(int argc, char* argv[])
         float val = signal[x * padded_cols + y].real;
         if (val < 0) val = 0;
         if (val > 255) val = 255;
-        pgm.im.data[i] = val;
+        lpgm_set_pixel_value(&pgm.im, x, y, val);
     }
     
     lpgm_file_write(&pgm, "output_lowpass.pgm");
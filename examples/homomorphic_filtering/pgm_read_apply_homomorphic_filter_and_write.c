@@ -53,13 +53,14 @@ get_butterworth_high_pass_filter(int rows, int cols, float D0, float yL, float y
 void
 lpgm_log_transformation_image(lpgm_image_t* im, int c)
 {
-	int i, data_len;
+	int x, y;
 
-	data_len = im->w * im->h;
-
-	for (i = 0; i < data_len; ++i)
+	for (x = 0; x < im->h; ++x)
 	{
-		im->data[i] = c * log(1.0 + im->data[i]);
+		for (y = 0; y < im->w; ++y)
+		{
+			lpgm_set_pixel_value(im, x, y, c * log(1.0 + lpgm_get_pixel_value(im, x, y)));
+		}
 	}
 }
 
@@ -70,13 +71,14 @@ lpgm_log_transformation_image(lpgm_image_t* im, int c)
 void
 lpgm_exponential_transformation_image(lpgm_image_t* im, int c)
 {
-	int i, data_len;
+	int x, y;
 
-	data_len = im->w * im->h;
-
-	for (i = 0; i < data_len; ++i)
+	for (x = 0; x < im->h; ++x)
 	{
-		im->data[i] = exp(im->data[i] / c) - 1.0;
+		for (y = 0; y < im->w; ++y)
+		{
+			lpgm_set_pixel_value(im, x, y, exp(lpgm_get_pixel_value(im, x, y) / c) - 1.0);
+		}
 	}
 }
 
@@ -164,7 +166,7 @@ homomorphic_filtering(lpgm_image_t* im, float D0, float yLow, float yHigh, float
 		fprintf(stdout, "%s(): Shifting by %.4f to make all values positive\n", __func__, -min_val);
 		for (i = 0; i < im_data_len; ++i)
 		{
-			im->data[i] = im_signal[i].real - min_val;
+			lpgm_set_pixel_value(im, i / im->w, i % im->w, im_signal[i].real - min_val);
 		}
 	}
 
@@ -174,10 +176,11 @@ homomorphic_filtering(lpgm_image_t* im, float D0, float yLow, float yHigh, float
 
 	// Debug: check values after exp
 	{
-		float min_v = im->data[0], max_v = im->data[0];
+		float v, min_v = lpgm_get_pixel_value(im, 0, 0), max_v = min_v;
 		for (i = 0; i < im_data_len; ++i) {
-			if (im->data[i] < min_v) min_v = im->data[i];
-			if (im->data[i] > max_v) max_v = im->data[i];
+			v = lpgm_get_pixel_value(im, i / im->w, i % im->w);
+			if (v < min_v) min_v = v;
+			if (v > max_v) max_v = v;
 		}
 		fprintf(stdout, "%s(): After exp - [%.4f, %.4f]\n", __func__, min_v, max_v);
 	}
@@ -190,12 +193,9 @@ homomorphic_filtering(lpgm_image_t* im, float D0, float yLow, float yHigh, float
 	fprintf(stdout, "%s(): Histogram equalization for contrast enhancement .. \n", __func__);
 	{
 		lpgm_image_t enhanced = lpgm_histogram_equalization(im);
-		// Copy enhanced data back to original image
-		for (i = 0; i < im_data_len; ++i)
-		{
-			im->data[i] = enhanced.data[i];
-		}
-		lpgm_image_destroy(&enhanced);
+		// Replace the original image with the enhanced one
+		lpgm_image_destroy(im);
+		*im = enhanced;
 	}
 
 	lpgm_destroy_signal(im_signal);
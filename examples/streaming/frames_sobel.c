@@ -0,0 +1,104 @@
+/*
+ * Multi-frame (Video) Stream Example
+ * 
+ * This example reads a stream of concatenated PGM frames, e.g. from a
+ * camera bridge writing to stdout, and runs Sobel plus a threshold on
+ * every frame.
+ * 
+ * Usage:
+ *   ./frames_sobel.out frames.pgm
+ *   camera_bridge | ./frames_sobel.out -
+ * 
+ * How it works:
+ *   - lpgm_frame_reader_open() with prefetch = 1 starts a thread that
+ *     decodes the next frame while the current one is processed
+ *   - lpgm_frame_reader_next() hands out frames in buffers that are reused,
+ *     so no pixel buffer is allocated per frame
+ *   - lpgm_sobel_into() / lpgm_threshold_into() write into one result image
+ *     made for the first frame; lpgm_get_alloc_count() shows that frames
+ *     of the same size allocate nothing after warm-up
+ *   - The last frame's edges are saved to output_frame_edges.pgm
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <pigiem.h>
+
+int main(int argc, char** argv)
+{
+	int n_frames;
+	unsigned long allocs_warm;
+	lpgm_frame_reader_t* reader;
+	lpgm_t* frame;
+	lpgm_t result;
+	lpgm_image_t edges, binary;
+	lpgm_status_t status;
+	
+	if (argc != 2)
+	{
+		fprintf(stderr, "Usage: %s frames.pgm|-\n", argv[0]);
+		return -1;
+	}
+	
+	if (strcmp(argv[1], "-") == 0)
+	{
+		reader = lpgm_frame_reader_open_fd(0, 1);
+	}
+	else
+	{
+		reader = lpgm_frame_reader_open(argv[1], 1);
+	}
+	if (reader == NULL)
+	{
+		return -1;
+	}
+	
+	n_frames = 0;
+	allocs_warm = 0;
+	edges = lpgm_make_empty_image(0, 0);
+	while ((status = lpgm_frame_reader_next(reader, &frame)) == LPGM_OK)
+	{
+		/* (Re)make the result only when the frame size changes */
+		if (edges.w != frame->im.w || edges.h != frame->im.h)
+		{
+			lpgm_image_destroy(&edges);
+			edges = lpgm_make_empty_image(frame->im.w, frame->im.h);
+		}
+		
+		/* Sobel into edges, then threshold edges in place */
+		lpgm_sobel_into(&frame->im, &edges);
+		lpgm_threshold_into(&edges, 100.0f, &edges);
+		
+		/* Both prefetch slots are sized once the second frame is out */
+		if (++n_frames == 2)
+		{
+			allocs_warm = lpgm_get_alloc_count();
+		}
+	}
+	fprintf(stdout, "Frames: %d, %s\n", n_frames, (status == LPGM_END) ? "end of stream" : "stream error");
+	if (n_frames > 2)
+	{
+		fprintf(stdout, "Allocations in frames 3..%d: %lu\n", n_frames, lpgm_get_alloc_count() - allocs_warm);
+	}
+	binary = edges;
+	
+	if (binary.data != NULL)
+	{
+		result.magic_number[0] = 'P';
+		result.magic_number[1] = '5';
+		result.magic_number[2] = '\0';
+		result.comment = NULL;
+		result.max_val = 255;
+		result.im = binary;
+		if (lpgm_file_write(&result, "output_frame_edges.pgm") == LPGM_OK)
+		{
+			fprintf(stdout, "Saved: output_frame_edges.pgm\n");
+		}
+		lpgm_image_destroy(&binary);
+	}
+	
+	lpgm_frame_reader_close(reader);
+	
+	return (status == LPGM_END) ? 0 : -1;
+}
@@ -0,0 +1,96 @@
+/*
+ * Streaming (Strip) Processing Example
+ * 
+ * This example runs Sobel edge detection and a threshold over an image
+ * without ever loading the whole image into memory.
+ * 
+ * Usage:
+ *   ./stream_sobel.out input.pgm [strip_rows]
+ * 
+ * How it works:
+ *   - lpgm_stream_open() reads only the header
+ *   - lpgm_stream_sobel() keeps a rolling window of strip_rows + 2 rows
+ *     (Sobel needs one row above and below) and writes each finished strip
+ *   - The second pass pulls rows manually and applies a point operation,
+ *     which needs no neighbors, to each strip
+ * 
+ * Peak memory is proportional to width * strip_rows, not to image size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pigiem.h>
+
+int main(int argc, char** argv)
+{
+	char* input_file;
+	int strip_rows, n;
+	lpgm_stream_t in, out;
+	lpgm_image_t strip, binary;
+	
+	if (argc != 2 && argc != 3)
+	{
+		fprintf(stderr, "Usage: %s input.pgm [strip_rows]\n", argv[0]);
+		return -1;
+	}
+	
+	input_file = argv[1];
+	strip_rows = (argc == 3) ? atoi(argv[2]) : 64;
+	
+	/* Pass 1: Sobel with a rolling window */
+	if (lpgm_stream_open(input_file, &in) != LPGM_OK)
+	{
+		fprintf(stderr, "Error: Could not open %s\n", input_file);
+		return -1;
+	}
+	fprintf(stdout, "Image: %d x %d, strip: %d rows\n", in.header.im.w, in.header.im.h, strip_rows);
+	
+	if (lpgm_stream_create("output_sobel.pgm", &in.header, &out) != LPGM_OK)
+	{
+		lpgm_stream_close(&in);
+		return -1;
+	}
+	
+	if (lpgm_stream_sobel(&in, &out, strip_rows) != LPGM_OK)
+	{
+		fprintf(stderr, "Error: Streaming Sobel failed\n");
+	}
+	lpgm_stream_close(&in);
+	if (lpgm_stream_close(&out) != LPGM_OK)
+	{
+		return -1;
+	}
+	fprintf(stdout, "Saved: output_sobel.pgm\n");
+	
+	/* Pass 2: threshold the edges strip by strip */
+	if (lpgm_stream_open("output_sobel.pgm", &in) != LPGM_OK)
+	{
+		return -1;
+	}
+	if (lpgm_stream_create("output_edges.pgm", &in.header, &out) != LPGM_OK)
+	{
+		lpgm_stream_close(&in);
+		return -1;
+	}
+	
+	strip = lpgm_make_empty_image(in.header.im.w, strip_rows);
+	while ((n = lpgm_stream_read_image(&in, &strip)) > 0)
+	{
+		/* A strip is an ordinary image of n rows */
+		strip.h = n;
+		binary = lpgm_threshold(&strip, 100.0f);
+		lpgm_stream_write_image(&out, &binary);
+		lpgm_image_destroy(&binary);
+	}
+	
+	lpgm_image_destroy(&strip);
+	lpgm_stream_close(&in);
+	if (lpgm_stream_close(&out) != LPGM_OK)
+	{
+		return -1;
+	}
+	fprintf(stdout, "Saved: output_edges.pgm\n");
+	
+	return 0;
+}
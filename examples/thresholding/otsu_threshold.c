@@ -33,6 +33,7 @@ int main(int argc, char** argv)
 	lpgm_t pgm;
 	lpgm_image_t otsu_im;
 	lpgm_t out_pgm;
+	int threshold;
 	
 	if (argc != 2)
 	{
@@ -52,7 +53,8 @@ int main(int argc, char** argv)
 	
 	/* Apply Otsu's thresholding (automatic threshold detection) */
 	fprintf(stdout, "Applying Otsu's automatic thresholding...\n");
-	otsu_im = lpgm_otsu_threshold(&pgm.im);
+	otsu_im = lpgm_otsu_threshold_ex(&pgm.im, &threshold);
+	fprintf(stdout, "Otsu threshold: %d\n", threshold);
 	
 	/* Save thresholded image */
 	out_pgm = pgm;
@@ -1,6 +1,9 @@
 #ifndef PGM_API_H
 #define PGM_API_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -28,9 +31,61 @@ extern "C"
 	typedef enum
 	{
 		LPGM_OK = 0,      /* Operation successful */
-		LPGM_FAIL = -1    /* Operation failed */
+		LPGM_FAIL = -1,   /* Operation failed */
+		LPGM_END = 1      /* No more data (end of a multi-frame stream) */
 	} lpgm_status_t;
 
+	/* Instruction sets of the dispatched kernels, see lpgm_get_simd_level() */
+	typedef enum
+	{
+		LPGM_SIMD_SCALAR = 0,    /* Reference loops, no vectorization */
+		LPGM_SIMD_BASELINE = 1,  /* Compiler default (SSE2 on x86-64) */
+		LPGM_SIMD_SSE41 = 2,
+		LPGM_SIMD_AVX2 = 3,
+		LPGM_SIMD_AVX512 = 4
+	} lpgm_simd_level_t;
+
+	/* Point operations for lpgm_point_ops(); a and b are the parameters */
+	typedef enum
+	{
+		LPGM_OP_BRIGHTNESS = 0,  /* a: delta, see lpgm_brightness() */
+		LPGM_OP_CONTRAST = 1,    /* a: factor, see lpgm_contrast() */
+		LPGM_OP_GAMMA = 2,       /* a: gamma > 0, see lpgm_gamma() */
+		LPGM_OP_CLAMP = 3,       /* Clamp to [a, b] */
+		LPGM_OP_INVERT = 4,      /* See lpgm_invert() */
+		LPGM_OP_THRESHOLD = 5,   /* a: threshold, see lpgm_threshold() */
+		LPGM_OP_NORMALIZE = 6    /* Map [min, max] of the values to [0, a], see lpgm_normalize_array() */
+	} lpgm_point_op_type_t;
+
+	/* Maximum length of a chain passed to lpgm_point_ops() */
+	#define LPGM_POINT_OPS_MAX 32
+
+	/* Limits of lpgm_histogram_multi_otsu(): thresholds and histogram bins */
+	#define LPGM_OTSU_MAX_THRESHOLDS 4
+	#define LPGM_OTSU_MAX_LEVELS 4096
+
+	typedef struct
+	{
+		lpgm_point_op_type_t type;
+		float a, b;
+	} lpgm_point_op_t;
+
+	/* Log levels, see lpgm_set_log_level() */
+	typedef enum
+	{
+		LPGM_LOG_NONE = 0,   /* Nothing is reported */
+		LPGM_LOG_ERROR = 1,  /* Failures only (default) */
+		LPGM_LOG_WARN = 2,   /* Recoverable problems */
+		LPGM_LOG_INFO = 3,   /* Progress: header fields, pixel counts, Otsu threshold */
+		LPGM_LOG_DEBUG = 4   /* Everything */
+	} lpgm_log_level_t;
+
+	/*
+	 * Log callback, see lpgm_set_log_callback().
+	 * message is one line without newline, e.g. "lpgm_file_read(): Error opening file: [x.pgm]."
+	 */
+	typedef void (*lpgm_log_fn)(lpgm_log_level_t level, const char* message, void* user_data);
+
 	/* Complex number for DFT/FFT operations */
 	typedef struct
 	{
@@ -38,35 +93,331 @@ extern "C"
 		float real;       /* Real part */
 	} lpgm_signal_t;
 
-	/* Grayscale image structure */
+	/*
+	 * Grayscale image structure
+	 * Images made by the library have 64-byte aligned rows padded to a multiple
+	 * of 16 floats, so stride can be larger than w. Operations accept any
+	 * stride >= w; 0 is read as w, so { w, h, data } describes a packed buffer.
+	 */
 	typedef struct
 	{
 		int w, h;         /* Width (columns) and height (rows) */
-		float* data;      /* Pixel data in row-major order: data[row * w + col] */
+		float* data;      /* Pixel data in row-major order: data[row * stride + col] */
+		int stride;       /* Floats from the start of one row to the next (>= w) */
+		int is_view;      /* 1 if data belongs to another image (see lpgm_image_roi()) */
 	} lpgm_image_t;
 
+	/* 16-bit grayscale image, samples kept as native uint16 (see lpgm_file_read_u16()) */
+	typedef struct
+	{
+		int w, h;              /* Width (columns) and height (rows) */
+		unsigned short* data;  /* Pixel data in row-major order: data[row * w + col] */
+	} lpgm_image_u16_t;
+
+	/*
+	 * 8-bit grayscale image, samples kept as native uint8 (see lpgm_file_read_u8()).
+	 * Same layout rules as lpgm_image_t: rows 64-byte aligned, stride in bytes.
+	 */
+	typedef struct
+	{
+		int w, h;              /* Width (columns) and height (rows) */
+		unsigned char* data;   /* Pixel data in row-major order: data[row * stride + col] */
+		int stride;            /* Bytes from the start of one row to the next (>= w) */
+		int is_view;           /* 1 if data belongs to another image or a file mapping */
+	} lpgm_image_u8_t;
+
+	/* Point operation on 8-bit samples: out = v[in] (see lpgm_apply_lut_u8()) */
+	typedef struct
+	{
+		unsigned char v[256];
+	} lpgm_lut_u8_t;
+
+	/*
+	 * Sample counts over levels 0 .. n_bins - 1 (see lpgm_histogram()).
+	 * Owns counts unless set up by the caller over its own array.
+	 */
+	typedef struct
+	{
+		int n_bins;    /* Number of levels */
+		int total;     /* Samples counted, the sum of counts */
+		int* counts;   /* counts[v]: samples at level v */
+	} lpgm_histogram_t;
+
+	/* Rectangle of pixels, as taken by lpgm_image_roi() */
+	typedef struct
+	{
+		int row, col;  /* Top-left pixel */
+		int w, h;      /* Width (columns) and height (rows) */
+	} lpgm_rect_t;
+
 	/* PGM file structure */
 	typedef struct
 	{
 		char magic_number[2 + 1];  /* "P2" (ASCII) or "P5" (binary) */
 		char* comment;            /* Optional comment string */
-		int max_val;              /* Maximum pixel value (usually 255) */
+		int max_val;              /* Maximum pixel value: 255 for 8-bit, up to 65535 for 16-bit */
 		lpgm_image_t im;          /* Image data */
 	} lpgm_t;
 
+	/* PGM header summary (see lpgm_file_probe()) */
+	typedef struct
+	{
+		char magic_number[2 + 1];  /* "P2" (ASCII) or "P5" (binary) */
+		int max_val;              /* Maximum pixel value */
+		int w, h;                 /* Width (columns) and height (rows) */
+	} lpgm_info_t;
+
+	/* Row-by-row PGM reader or writer (see lpgm_stream_open() / lpgm_stream_create()) */
+	typedef struct
+	{
+		lpgm_t header;               /* Format, comment, max_val and size; header.im.data is unused */
+		FILE* file_ptr;              /* Underlying file */
+		int rows_done;               /* Rows read or written so far */
+		unsigned char* row_samples;  /* Writer scratch (internal) */
+		char* row_text;              /* Writer scratch for P2 rows (internal) */
+	} lpgm_stream_t;
+
+	/* Reader over a stream of concatenated PGM frames (opaque, see lpgm_frame_reader_open()) */
+	typedef struct lpgm_frame_reader lpgm_frame_reader_t;
+
+	/*
+	 * Memory hooks (see lpgm_set_allocator()). aligned_alloc must return
+	 * memory aligned to alignment, a power of two. user_data is passed back
+	 * to every hook.
+	 */
+	typedef struct
+	{
+		void* (*alloc)(size_t size, void* user_data);
+		void* (*aligned_alloc)(size_t alignment, size_t size, void* user_data);
+		void (*free)(void* ptr, void* user_data);
+		void* user_data;
+	} lpgm_allocator_t;
+
+	/* Pool that serves the library's allocations on a thread (opaque, see lpgm_context_create()) */
+	typedef struct lpgm_context lpgm_context_t;
+
+	/* Memory use of a context (see lpgm_context_get_stats()) */
+	typedef struct
+	{
+		size_t bytes_in_use;        /* Held by live blocks */
+		size_t peak_bytes_in_use;   /* Highest bytes_in_use so far */
+		size_t bytes_reserved;      /* Obtained from the system, in use or cached */
+		unsigned long system_allocs; /* Blocks obtained from the system */
+	} lpgm_context_stats_t;
+
+	/*
+	 * Strip callback for lpgm_stream_filter(): process a window of rows and
+	 * return a new image of the same size (e.g. a wrapper around lpgm_sobel()).
+	 */
+	typedef lpgm_image_t (*lpgm_strip_fn)(const lpgm_image_t* window, void* user_data);
+
+	/* Memory-mapped view of a P5 file; the file itself is never written (see lpgm_file_map()) */
+	typedef struct
+	{
+		char magic_number[2 + 1];  /* Always "P5" */
+		char* comment;            /* Optional comment string */
+		int max_val;              /* Maximum pixel value */
+		int w, h;                 /* Width (columns) and height (rows) */
+		int stride;               /* Bytes between the starts of two rows */
+		const unsigned char* data; /* Raster in the mapping: data[row * stride + col] */
+		void* map_addr;           /* Start of the mapping (internal) */
+		size_t map_len;           /* Length of the mapping (internal) */
+	} lpgm_map_t;
+
 	/* ========================================================================
 	 * PGM File I/O Functions (pgm_io.c)
 	 * ======================================================================== */
 
-	/* Read a PGM image from file. Supports P2 (ASCII) and P5 (binary) formats. */
+	/*
+	 * Read a PGM image from file. Supports P2 (ASCII) and P5 (binary) formats,
+	 * 8-bit and 16-bit (max value up to 65535, big-endian P5 samples).
+	 */
 	lpgm_status_t lpgm_file_read(const char* file_name, lpgm_t* pgm);
 
-	/* Write a PGM image to file. Uses the same format as the last read file. */
+	/*
+	 * Write a PGM image to file. The format follows pgm->magic_number
+	 * ("P2" or "P5"), so set it to convert between formats. P5 samples are
+	 * clamped to pgm->max_val; above 255 the file is written as 16-bit. P2
+	 * samples are written as truncated ints, not clamped.
+	 * Safe to call from several threads on different images.
+	 */
 	lpgm_status_t lpgm_file_write(const lpgm_t* pgm, const char* file_name);
 
+	/*
+	 * Read a PGM image keeping the samples as uint16 instead of float.
+	 * Format, size and max value go to info (may be NULL); the comment is skipped.
+	 * Destroy with lpgm_image_u16_destroy().
+	 */
+	lpgm_status_t lpgm_file_read_u16(const char* file_name, lpgm_image_u16_t* im, lpgm_info_t* info);
+
+	/*
+	 * Write a uint16 image. Format and max value are taken from info
+	 * (info->w and info->h are ignored); samples are clamped to info->max_val.
+	 */
+	lpgm_status_t lpgm_file_write_u16(const lpgm_image_u16_t* im, const lpgm_info_t* info, const char* file_name);
+
+	/*
+	 * Read an 8-bit PGM (max value up to 255) keeping the samples as uint8.
+	 * Format, size and max value go to info (may be NULL); the comment is skipped.
+	 * Destroy with lpgm_image_u8_destroy().
+	 */
+	lpgm_status_t lpgm_file_read_u8(const char* file_name, lpgm_image_u8_t* im, lpgm_info_t* info);
+
+	/*
+	 * Write a uint8 image. Format and max value (1 .. 255) are taken from info
+	 * (info->w and info->h are ignored); samples are clamped to info->max_val.
+	 */
+	lpgm_status_t lpgm_file_write_u8(const lpgm_image_u8_t* im, const lpgm_info_t* info, const char* file_name);
+
+	/*
+	 * Decode a PGM held in memory (size bytes at data), e.g. a frame in shared
+	 * memory. Same formats and result as lpgm_file_read(); data is not modified.
+	 */
+	lpgm_status_t lpgm_mem_read(const void* data, size_t size, lpgm_t* pgm);
+
+	/*
+	 * Decode a PGM from an open file descriptor (pipe, socket, file).
+	 * fd is left open and is read up to the end of the image only (for P2,
+	 * the delimiter after the last sample), so several images can be read
+	 * back-to-back from one pipe.
+	 */
+	lpgm_status_t lpgm_fd_read(int fd, lpgm_t* pgm);
+
+	/* Largest number of bytes lpgm_mem_write() can produce for pgm (0 if pgm is invalid). */
+	size_t lpgm_mem_write_bound(const lpgm_t* pgm);
+
+	/*
+	 * Encode a PGM into a caller buffer of capacity bytes; the encoded size
+	 * goes to out_size (may be NULL). Fails if the image does not fit.
+	 */
+	lpgm_status_t lpgm_mem_write(const lpgm_t* pgm, void* buffer, size_t capacity, size_t* out_size);
+
+	/* Encode a PGM into a newly allocated buffer. Release *out_data with free(). */
+	lpgm_status_t lpgm_mem_write_alloc(const lpgm_t* pgm, void** out_data, size_t* out_size);
+
+	/* Encode a PGM to an open file descriptor. fd is flushed and left open. */
+	lpgm_status_t lpgm_fd_write(const lpgm_t* pgm, int fd);
+
 	/* Free memory allocated for a PGM structure. */
 	void lpgm_file_destroy(lpgm_t* pgm);
 
+	/*
+	 * Read only the header of a PGM file: format, size and max value.
+	 * No pixel data is read, nothing is allocated or printed.
+	 */
+	lpgm_status_t lpgm_file_probe(const char* file_name, lpgm_info_t* info);
+
+	/*
+	 * Memory-map an 8-bit P5 file and parse its header in place.
+	 * The raster is exposed as an 8-bit view; nothing is copied or converted
+	 * to float. The mapping is private: a page written through
+	 * lpgm_map_to_image_u8() is copied on the first write and the file is
+	 * left unchanged. Release with lpgm_file_unmap().
+	 */
+	lpgm_status_t lpgm_file_map(const char* file_name, lpgm_map_t* map);
+
+	/* Unmap a file mapped with lpgm_file_map(). */
+	void lpgm_file_unmap(lpgm_map_t* map);
+
+	/* Widen a mapped raster to a new float image. Destroy with lpgm_image_destroy(). */
+	lpgm_image_t lpgm_map_to_image(const lpgm_map_t* map);
+
+	/*
+	 * View a mapped raster as a uint8 image without copying. It may be the
+	 * destination of an in-place operation; the file does not change.
+	 * Valid until lpgm_file_unmap(); lpgm_image_u8_destroy() on it frees nothing.
+	 */
+	lpgm_image_u8_t lpgm_map_to_image_u8(const lpgm_map_t* map);
+
+	/* ========================================================================
+	 * Streaming PGM I/O (pgm_stream.c)
+	 * Process images larger than memory a strip of rows at a time
+	 * ======================================================================== */
+
+	/* Open a PGM file and read its header. Rows are then pulled with lpgm_stream_read_rows(). */
+	lpgm_status_t lpgm_stream_open(const char* file_name, lpgm_stream_t* stream);
+
+	/*
+	 * Create a PGM file and write its header. Format, comment, max_val and size
+	 * are taken from header (header->im.data is ignored). Rows are then pushed
+	 * with lpgm_stream_write_rows().
+	 */
+	lpgm_status_t lpgm_stream_create(const char* file_name, const lpgm_t* header, lpgm_stream_t* stream);
+
+	/*
+	 * Read up to n_rows rows into rows (n_rows * w floats), at most INT_MAX / w
+	 * rows per call. Returns the number of rows read (0 at the end of the
+	 * image), or -1 on error.
+	 */
+	int lpgm_stream_read_rows(lpgm_stream_t* stream, float* rows, int n_rows);
+
+	/* Write n_rows rows from rows (n_rows * w floats). */
+	lpgm_status_t lpgm_stream_write_rows(lpgm_stream_t* stream, const float* rows, int n_rows);
+
+	/*
+	 * Same as lpgm_stream_read_rows() into an image of the stream's width,
+	 * honoring its stride: reads up to im->h rows, returns the number read.
+	 */
+	int lpgm_stream_read_image(lpgm_stream_t* stream, lpgm_image_t* im);
+
+	/* Write all rows of an image (or view) of the stream's width, honoring its stride. */
+	lpgm_status_t lpgm_stream_write_image(lpgm_stream_t* stream, const lpgm_image_t* im);
+
+	/* Close a stream. Fails if a writer did not receive every row. */
+	lpgm_status_t lpgm_stream_close(lpgm_stream_t* stream);
+
+	/*
+	 * Run fn over the whole input a strip of strip_rows rows at a time and push
+	 * the result to out. Each call sees the strip plus halo rows above and below
+	 * (fewer at the image border), so operations with a (2 * halo + 1) row
+	 * neighborhood give the same result as on the whole image.
+	 * Peak memory is proportional to w * (strip_rows + 2 * halo), at most the
+	 * whole image.
+	 */
+	lpgm_status_t lpgm_stream_filter(lpgm_stream_t* in, lpgm_stream_t* out, int halo, int strip_rows, lpgm_strip_fn fn, void* user_data);
+
+	/* Strip-wise point operations, see lpgm_brightness() etc. */
+	lpgm_status_t lpgm_stream_brightness(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, float delta);
+	lpgm_status_t lpgm_stream_contrast(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, float factor);
+	lpgm_status_t lpgm_stream_invert(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows);
+	lpgm_status_t lpgm_stream_threshold(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, float threshold);
+	lpgm_status_t lpgm_stream_gamma(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, float gamma);
+
+	/* Strip-wise neighborhood operations with a rolling window, see lpgm_sobel() etc. */
+	lpgm_status_t lpgm_stream_sobel(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows);
+	lpgm_status_t lpgm_stream_convolve(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, const float* kernel, int ksize);
+	lpgm_status_t lpgm_stream_median_filter(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize);
+	lpgm_status_t lpgm_stream_erode(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize);
+	lpgm_status_t lpgm_stream_dilate(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize);
+	lpgm_status_t lpgm_stream_opening(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize);
+	lpgm_status_t lpgm_stream_closing(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize);
+
+	/* ========================================================================
+	 * Multi-frame PGM Streams (pgm_frames.c)
+	 * Several PGM images concatenated in one file or pipe, e.g. a video feed
+	 * ======================================================================== */
+
+	/*
+	 * Open a multi-frame PGM file. With prefetch != 0 a background thread
+	 * decodes the next frame while the caller processes the current one.
+	 * Returns NULL on failure. Close with lpgm_frame_reader_close().
+	 */
+	lpgm_frame_reader_t* lpgm_frame_reader_open(const char* file_name, int prefetch);
+
+	/* Same as lpgm_frame_reader_open() over an open file descriptor (e.g. 0 for stdin). fd is left open. */
+	lpgm_frame_reader_t* lpgm_frame_reader_open_fd(int fd, int prefetch);
+
+	/*
+	 * Decode the next frame. On LPGM_OK *frame points to it (comment is NULL)
+	 * until the next call: pixel buffers are owned by the reader and reused,
+	 * so frames of unchanged size cost no allocation. Returns LPGM_END after
+	 * the last frame, LPGM_FAIL on a malformed or truncated frame.
+	 */
+	lpgm_status_t lpgm_frame_reader_next(lpgm_frame_reader_t* reader, lpgm_t** frame);
+
+	/* Close the reader and free its buffers. Waits for a frame being prefetched. */
+	void lpgm_frame_reader_close(lpgm_frame_reader_t* reader);
+
 	/* ========================================================================
 	 * Utility Functions (utils.c)
 	 * ======================================================================== */
@@ -77,20 +428,166 @@ extern "C"
 	/* Normalize array values to range [0, new_max]. */
 	lpgm_status_t lpgm_normalize_array(float* data, int len, float new_max);
 
+	/*
+	 * Set the number of worker threads used by operations that can run in
+	 * parallel (e.g. P2 parsing, histograms of large images). Default is 1 (single-threaded).
+	 */
+	void lpgm_set_num_threads(int num_threads);
+
+	/* Get the number of worker threads set by lpgm_set_num_threads(). */
+	int lpgm_get_num_threads(void);
+
+	/*
+	 * Report only messages up to level. Default is LPGM_LOG_ERROR: nothing is
+	 * printed on success. LPGM_LOG_INFO brings back the header and Otsu output.
+	 */
+	void lpgm_set_log_level(lpgm_log_level_t level);
+
+	/* Get the level set by lpgm_set_log_level(). */
+	lpgm_log_level_t lpgm_get_log_level(void);
+
+	/*
+	 * Send messages to callback instead of stderr (errors, warnings) and
+	 * stdout (info). NULL restores the default. Set it before starting threads
+	 * that use the library; the callback may be called from several threads.
+	 */
+	void lpgm_set_log_callback(lpgm_log_fn callback, void* user_data);
+
+	/*
+	 * Number of heap allocations made by the library since start (or the last
+	 * lpgm_reset_alloc_count()), from all threads. A frame loop built on the
+	 * _into operations should leave it unchanged after the first frame.
+	 */
+	unsigned long lpgm_get_alloc_count(void);
+
+	/* Reset the allocation counter to 0. */
+	void lpgm_reset_alloc_count(void);
+
+	/*
+	 * Obtain all library memory from allocator's hooks instead of
+	 * malloc()/free(); NULL restores them. Blocks are released through the
+	 * hook they came from, so the allocator may change at any time, but not
+	 * while other threads use the library. Returns LPGM_FAIL if a hook is NULL.
+	 * Exception: lpgm_mem_write_alloc() buffers come from open_memstream().
+	 */
+	lpgm_status_t lpgm_set_allocator(const lpgm_allocator_t* allocator);
+
+	/*
+	 * Bytes the library currently holds from the allocator, from all threads,
+	 * including memory cached by contexts and a small header per block.
+	 */
+	size_t lpgm_get_live_bytes(void);
+
+	/* Highest lpgm_get_live_bytes() since start or lpgm_reset_peak_bytes(). */
+	size_t lpgm_get_peak_bytes(void);
+
+	/* Restart peak tracking from the current live bytes. */
+	void lpgm_reset_peak_bytes(void);
+
+	/*
+	 * Instruction set of the kernels behind the point operations, Sobel,
+	 * convolution, morphology, normalization and the FFT. Chosen through
+	 * CPUID when the library is loaded; all levels give identical results.
+	 * Set LPGM_SIMD=scalar|baseline|sse4.1|avx2|avx512 in the environment
+	 * to cap it, e.g. scalar to debug against the reference loops.
+	 */
+	lpgm_simd_level_t lpgm_get_simd_level(void);
+
+	/* Name of level as accepted by LPGM_SIMD, e.g. "avx2". */
+	const char* lpgm_simd_level_name(lpgm_simd_level_t level);
+
+	/* ========================================================================
+	 * Allocation Contexts (context.c)
+	 * ======================================================================== */
+
+	/*
+	 * A context pools the memory of everything the library allocates on a
+	 * thread it is bound to: result images and signals, PGM structures, FFT,
+	 * DFT and filter scratch. lpgm_image_destroy() and friends return blocks to the pool
+	 * and lpgm_context_reset() returns all of them at once, so a worker that
+	 * binds a context and resets it after each frame stops allocating from
+	 * the system after the first frame, with a peak footprint known up front.
+	 *
+	 *     lpgm_context_t* ctx = lpgm_context_create(64 << 20);
+	 *     lpgm_context_bind(ctx);
+	 *     for (each frame) { ... lpgm_sobel(), lpgm_fft2() ...; lpgm_context_reset(ctx); }
+	 *     lpgm_context_bind(NULL);
+	 *     lpgm_context_destroy(ctx);
+	 *
+	 * Frame readers and streams keep their buffers outside any context, they
+	 * live across frames.
+	 */
+
+	/*
+	 * Create a context. Allocations fail once limit_bytes are reserved from
+	 * the system (0 for no limit). Returns NULL on failure.
+	 */
+	lpgm_context_t* lpgm_context_create(size_t limit_bytes);
+
+	/*
+	 * Return all memory of ctx to the system. Everything allocated from it is
+	 * invalid afterwards. ctx must not be bound to another thread.
+	 */
+	void lpgm_context_destroy(lpgm_context_t* ctx);
+
+	/*
+	 * Give every block of ctx back to its pool, keeping the memory for the
+	 * next frame. Images, signals and PGM structures allocated from ctx are
+	 * invalid afterwards and must not be destroyed.
+	 */
+	void lpgm_context_reset(lpgm_context_t* ctx);
+
+	/*
+	 * Serve the calling thread's allocations from ctx (NULL to go back to
+	 * the system). Returns the context bound before. A context may be bound
+	 * to one thread at a time; blocks can be freed from any thread.
+	 */
+	lpgm_context_t* lpgm_context_bind(lpgm_context_t* ctx);
+
+	/* Copy the memory statistics of ctx to stats. */
+	lpgm_status_t lpgm_context_get_stats(lpgm_context_t* ctx, lpgm_context_stats_t* stats);
+
 	/* ========================================================================
 	 * Image Operations (image.c)
 	 * ======================================================================== */
 
-	/* Create an empty image with given dimensions. Pixels initialized to 0. */
+	/*
+	 * Every operation below that returns a new image has an _into version
+	 * that writes to dst instead: a caller-owned image of the same size,
+	 * reused across frames so the steady state allocates nothing.
+	 * They return LPGM_FAIL on invalid input, a size mismatch or a dst that
+	 * overlaps im. Point operations (brightness, contrast, invert, threshold,
+	 * gamma, Otsu, equalization, noise, copy) also run in place with dst == im.
+	 */
+
+	/*
+	 * Create an empty image with given dimensions. Pixels initialized to 0.
+	 * Rows start on 64-byte boundaries and are zero-padded up to stride.
+	 */
 	lpgm_image_t lpgm_make_empty_image(int w, int h);
 
+	/*
+	 * Region of interest: a w x h view of im starting at (row, col) that shares
+	 * im's memory, nothing is copied. Any operation accepts a view; writes go
+	 * to the parent. Valid while the parent lives; lpgm_image_destroy() on a
+	 * view frees nothing.
+	 */
+	lpgm_image_t lpgm_image_roi(const lpgm_image_t* im, int row, int col, int w, int h);
+
+	/* Pointer to the first pixel of row (honors stride). */
+	float* lpgm_image_row(const lpgm_image_t* im, int row);
+
 	/* Create a deep copy of an image. */
 	lpgm_image_t lpgm_copy_image(const lpgm_image_t* input_im);
+	lpgm_status_t lpgm_copy_image_into(const lpgm_image_t* im, lpgm_image_t* dst);
 
 	/* Add a border of given size around the image. */
 	lpgm_image_t lpgm_border_image(const lpgm_image_t* input_im, int border_size);
 
-	/* Free memory allocated for an image. */
+	/* Same into dst, which must be border_size pixels larger than im on every side and not overlap it. */
+	lpgm_status_t lpgm_border_image_into(const lpgm_image_t* im, int border_size, lpgm_image_t* dst);
+
+	/* Free memory allocated for an image. Views are only cleared. */
 	void lpgm_image_destroy(lpgm_image_t* im);
 
 	/* Get pixel value at (x, y). x = row, y = column. */
@@ -107,41 +604,89 @@ extern "C"
 
 	/* Apply a convolution filter. box_kernel_size must be odd (e.g., 3, 5, 7). */
 	lpgm_image_t lpgm_filter_image(const lpgm_image_t* im, const float* box_kernel_data, int box_kernel_size);
+	lpgm_status_t lpgm_filter_image_into(const lpgm_image_t* im, const float* box_kernel_data, int box_kernel_size,
+	                                     lpgm_image_t* dst);
 
 	/* 
 	 * Brightness adjustment. Formula: out = in + delta
 	 * delta > 0: brighter, delta < 0: darker
 	 */
 	lpgm_image_t lpgm_brightness(const lpgm_image_t* im, float delta);
+	lpgm_status_t lpgm_brightness_into(const lpgm_image_t* im, float delta, lpgm_image_t* dst);
 
 	/* 
 	 * Contrast adjustment. Formula: out = (in - 128) * factor + 128
 	 * factor > 1: more contrast, factor < 1: less contrast
 	 */
 	lpgm_image_t lpgm_contrast(const lpgm_image_t* im, float factor);
+	lpgm_status_t lpgm_contrast_into(const lpgm_image_t* im, float factor, lpgm_image_t* dst);
 
 	/* 
 	 * Image inversion (negative). Formula: out = 255 - in
 	 */
 	lpgm_image_t lpgm_invert(const lpgm_image_t* im);
+	lpgm_status_t lpgm_invert_into(const lpgm_image_t* im, lpgm_image_t* dst);
 
 	/* 
 	 * Binary thresholding. Formula: out = (in > threshold) ? 255 : 0
 	 */
 	lpgm_image_t lpgm_threshold(const lpgm_image_t* im, float threshold);
+	lpgm_status_t lpgm_threshold_into(const lpgm_image_t* im, float threshold, lpgm_image_t* dst);
 
 	/* 
 	 * Otsu's automatic thresholding.
 	 * Finds optimal threshold by maximizing between-class variance.
 	 * Formula: sigma_B^2 = w0 * w1 * (mu0 - mu1)^2
+	 * Images with samples above 255 use one bin per level (see
+	 * lpgm_histogram_equalization()) and are thresholded to [0, largest sample].
 	 */
 	lpgm_image_t lpgm_otsu_threshold(const lpgm_image_t* im);
 
+	/* Same as lpgm_otsu_threshold(), the chosen threshold goes to *out_threshold (may be NULL). */
+	lpgm_image_t lpgm_otsu_threshold_ex(const lpgm_image_t* im, int* out_threshold);
+	lpgm_status_t lpgm_otsu_threshold_into(const lpgm_image_t* im, int* out_threshold, lpgm_image_t* dst);
+
+	/*
+	 * Otsu threshold of im without thresholding anything, e.g. to apply it to
+	 * a later frame or another region. Returns -1 on invalid input.
+	 */
+	int lpgm_otsu_threshold_value(const lpgm_image_t* im);
+
+	/*
+	 * Multi-level Otsu: n_thresholds (1 .. LPGM_OTSU_MAX_THRESHOLDS) increasing
+	 * levels into thresholds, splitting the samples into n_thresholds + 1
+	 * classes [0, t1], (t1, t2], ... See lpgm_histogram_multi_otsu().
+	 */
+	lpgm_status_t lpgm_multi_otsu_thresholds(const lpgm_image_t* im, int n_thresholds, int* thresholds);
+
 	/* 
 	 * Histogram equalization for contrast enhancement.
 	 * Formula: out = (CDF[in] - CDF_min) / (1 - CDF_min) * 255
+	 * Images with samples above 255 use one bin per level up to the largest
+	 * sample (at most 65536) and are equalized to [0, largest sample].
 	 */
 	lpgm_image_t lpgm_histogram_equalization(const lpgm_image_t* im);
+	lpgm_status_t lpgm_histogram_equalization_into(const lpgm_image_t* im, lpgm_image_t* dst);
+
+	/*
+	 * Contrast-limited adaptive histogram equalization (CLAHE). Each of
+	 * tiles_x x tiles_y tiles is equalized with its own histogram, clipped at
+	 * clip_limit times the mean bin count (e.g. 2 to 4, 0 for no limit) with
+	 * the excess spread over all bins. Pixels blend the tables of the nearest
+	 * tile centers bilinearly, so tiles leave no seams. Runs on
+	 * lpgm_set_num_threads() threads; dst may be im.
+	 */
+	lpgm_image_t lpgm_clahe(const lpgm_image_t* im, int tiles_x, int tiles_y, float clip_limit);
+	lpgm_status_t lpgm_clahe_into(const lpgm_image_t* im, int tiles_x, int tiles_y, float clip_limit, lpgm_image_t* dst);
+
+	/*
+	 * Histogram equalization with a histogram computed beforehand (see
+	 * lpgm_histogram()), e.g. shared with lpgm_histogram_otsu() or merged over
+	 * several frames. Samples are clamped to the levels of hist.
+	 */
+	lpgm_image_t lpgm_histogram_equalization_from(const lpgm_image_t* im, const lpgm_histogram_t* hist);
+	lpgm_status_t lpgm_histogram_equalization_from_into(const lpgm_image_t* im, const lpgm_histogram_t* hist,
+	                                                    lpgm_image_t* dst);
 
 	/* 
 	 * Sobel edge detection.
@@ -149,6 +694,7 @@ extern "C"
 	 * Formula: G = sqrt(Gx^2 + Gy^2)
 	 */
 	lpgm_image_t lpgm_sobel(const lpgm_image_t* im);
+	lpgm_status_t lpgm_sobel_into(const lpgm_image_t* im, lpgm_image_t* dst);
 
 	/* 
 	 * Generic NxN convolution with zero-padding.
@@ -156,6 +702,7 @@ extern "C"
 	 * ksize must be odd (3, 5, 7, ...).
 	 */
 	lpgm_image_t lpgm_convolve(const lpgm_image_t* im, const float* kernel, int ksize);
+	lpgm_status_t lpgm_convolve_into(const lpgm_image_t* im, const float* kernel, int ksize, lpgm_image_t* dst);
 
 	/* 
 	 * Median filter for noise removal.
@@ -163,6 +710,7 @@ extern "C"
 	 * ksize must be odd (3, 5, 7, ...).
 	 */
 	lpgm_image_t lpgm_median_filter(const lpgm_image_t* im, int ksize);
+	lpgm_status_t lpgm_median_filter_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst);
 
 	/* 
 	 * Add salt & pepper noise.
@@ -170,6 +718,7 @@ extern "C"
 	 * Example: density = 0.05 corrupts 5% of pixels.
 	 */
 	lpgm_image_t lpgm_add_salt_pepper_noise(const lpgm_image_t* im, float density);
+	lpgm_status_t lpgm_add_salt_pepper_noise_into(const lpgm_image_t* im, float density, lpgm_image_t* dst);
 
 	/* 
 	 * Gamma correction.
@@ -177,6 +726,257 @@ extern "C"
 	 * gamma < 1: brighter, gamma > 1: darker
 	 */
 	lpgm_image_t lpgm_gamma(const lpgm_image_t* im, float gamma);
+	lpgm_status_t lpgm_gamma_into(const lpgm_image_t* im, float gamma, lpgm_image_t* dst);
+
+	/*
+	 * Run a chain of point operations in one pass over memory, with the same
+	 * result as calling them one after another:
+	 *
+	 *     lpgm_point_op_t ops[] = { { LPGM_OP_GAMMA, 0.5f, 0 },
+	 *                               { LPGM_OP_CONTRAST, 1.5f, 0 },
+	 *                               { LPGM_OP_THRESHOLD, 100.0f, 0 } };
+	 *     lpgm_point_ops_into(&im, ops, 3, &im);
+	 *
+	 * Each LPGM_OP_NORMALIZE adds a read-only pass to find its input range.
+	 */
+	lpgm_image_t lpgm_point_ops(const lpgm_image_t* im, const lpgm_point_op_t* ops, int n_ops);
+	lpgm_status_t lpgm_point_ops_into(const lpgm_image_t* im, const lpgm_point_op_t* ops, int n_ops, lpgm_image_t* dst);
+
+	/* ========================================================================
+	 * 16-bit Images (image_u16.c)
+	 * ======================================================================== */
+
+	/* Create an empty uint16 image with given dimensions. Pixels initialized to 0. */
+	lpgm_image_u16_t lpgm_make_empty_image_u16(int w, int h);
+
+	/* Free memory allocated for a uint16 image. */
+	void lpgm_image_u16_destroy(lpgm_image_u16_t* im);
+
+	/* Convert a float image to uint16, clamping to [0, 65535] and truncating. */
+	lpgm_image_u16_t lpgm_image_to_u16(const lpgm_image_t* im);
+
+	/* Convert a uint16 image to a new float image. */
+	lpgm_image_t lpgm_image_u16_to_image(const lpgm_image_u16_t* im);
+
+	/*
+	 * Otsu's thresholding over max_val + 1 bins (up to 65536).
+	 * Output is max_val above the threshold, 0 otherwise.
+	 * The threshold goes to *out_threshold (may be NULL).
+	 */
+	lpgm_image_u16_t lpgm_otsu_threshold_u16(const lpgm_image_u16_t* im, int max_val, int* out_threshold);
+
+	/* Otsu threshold over max_val + 1 bins only, or -1 on invalid input. */
+	int lpgm_otsu_threshold_value_u16(const lpgm_image_u16_t* im, int max_val);
+
+	/*
+	 * Histogram equalization over max_val + 1 bins (up to 65536).
+	 * Formula: out = round((CDF[in] - CDF_min) / (1 - CDF_min) * max_val)
+	 */
+	lpgm_image_u16_t lpgm_histogram_equalization_u16(const lpgm_image_u16_t* im, int max_val);
+
+	/* ========================================================================
+	 * 8-bit Images (image_u8.c)
+	 * Same operations as on float images at a quarter of the memory traffic.
+	 * Results are the bytes lpgm_file_write() writes for the float result;
+	 * lpgm_convolve_u8() uses fixed-point weights and may differ by one level.
+	 * ======================================================================== */
+
+	/* Create an empty uint8 image with given dimensions. Pixels initialized to 0. */
+	lpgm_image_u8_t lpgm_make_empty_image_u8(int w, int h);
+
+	/* Region of interest of a uint8 image, see lpgm_image_roi(). */
+	lpgm_image_u8_t lpgm_image_u8_roi(const lpgm_image_u8_t* im, int row, int col, int w, int h);
+
+	/* Free memory allocated for a uint8 image (nothing for a view). */
+	void lpgm_image_u8_destroy(lpgm_image_u8_t* im);
+
+	/* Convert a float image to uint8, clamping to [0, 255] and truncating. */
+	lpgm_image_u8_t lpgm_image_to_u8(const lpgm_image_t* im);
+
+	/* Convert a uint8 image to a new float image, e.g. before lpgm_fft2(). */
+	lpgm_image_t lpgm_image_u8_to_image(const lpgm_image_u8_t* im);
+
+	/* Point operations, see the float versions. */
+	lpgm_image_u8_t lpgm_brightness_u8(const lpgm_image_u8_t* im, float delta);
+	lpgm_image_u8_t lpgm_contrast_u8(const lpgm_image_u8_t* im, float factor);
+	lpgm_image_u8_t lpgm_invert_u8(const lpgm_image_u8_t* im);
+	lpgm_image_u8_t lpgm_threshold_u8(const lpgm_image_u8_t* im, float threshold);
+	lpgm_image_u8_t lpgm_gamma_u8(const lpgm_image_u8_t* im, float gamma);
+
+	/*
+	 * Tables of the point operations: applying one gives the same bytes as
+	 * the operation. Compose a chain, e.g. gamma then contrast then threshold,
+	 * and apply it once instead of making a pass per operation:
+	 *
+	 *     lpgm_lut_gamma(&lut, 0.5f);
+	 *     lpgm_lut_contrast(&step, 1.5f);
+	 *     lpgm_lut_compose(&lut, &step, &lut);
+	 *     lpgm_lut_threshold(&step, 100.0f);
+	 *     lpgm_lut_compose(&lut, &step, &lut);
+	 *     lpgm_apply_lut_u8_into(&im, &lut, &im);
+	 */
+	lpgm_status_t lpgm_lut_identity(lpgm_lut_u8_t* lut);
+	lpgm_status_t lpgm_lut_brightness(lpgm_lut_u8_t* lut, float delta);
+	lpgm_status_t lpgm_lut_contrast(lpgm_lut_u8_t* lut, float factor);
+	lpgm_status_t lpgm_lut_invert(lpgm_lut_u8_t* lut);
+	lpgm_status_t lpgm_lut_threshold(lpgm_lut_u8_t* lut, float threshold);
+	lpgm_status_t lpgm_lut_gamma(lpgm_lut_u8_t* lut, float gamma);
+
+	/* Equalization table of im's histogram. */
+	lpgm_status_t lpgm_lut_histogram_equalization(lpgm_lut_u8_t* lut, const lpgm_image_u8_t* im);
+
+	/* Equalization table of a 256-bin histogram (see lpgm_histogram_u8()). */
+	lpgm_status_t lpgm_lut_histogram_equalization_from(lpgm_lut_u8_t* lut, const lpgm_histogram_t* hist);
+
+	/* out = first followed by then; out may be either input. */
+	lpgm_status_t lpgm_lut_compose(const lpgm_lut_u8_t* first, const lpgm_lut_u8_t* then, lpgm_lut_u8_t* out);
+
+	/* Map every pixel of im through lut into a new image. */
+	lpgm_image_u8_t lpgm_apply_lut_u8(const lpgm_image_u8_t* im, const lpgm_lut_u8_t* lut);
+
+	/* Map im through lut into dst (same size, may be im itself). */
+	lpgm_status_t lpgm_apply_lut_u8_into(const lpgm_image_u8_t* im, const lpgm_lut_u8_t* lut, lpgm_image_u8_t* dst);
+
+	/* Otsu's thresholding; the threshold goes to *out_threshold (may be NULL). */
+	lpgm_image_u8_t lpgm_otsu_threshold_u8(const lpgm_image_u8_t* im, int* out_threshold);
+
+	/* Otsu threshold only, or -1 on invalid input. */
+	int lpgm_otsu_threshold_value_u8(const lpgm_image_u8_t* im);
+
+	/* Histogram equalization over 256 levels. */
+	lpgm_image_u8_t lpgm_histogram_equalization_u8(const lpgm_image_u8_t* im);
+
+	/* CLAHE, see lpgm_clahe(). */
+	lpgm_image_u8_t lpgm_clahe_u8(const lpgm_image_u8_t* im, int tiles_x, int tiles_y, float clip_limit);
+
+	/*
+	 * Neighborhood operations. The _into variants write into a caller image of
+	 * the same size, which must not overlap im, as their float versions do.
+	 */
+
+	/* Sobel edge magnitude, integer gradients. */
+	lpgm_image_u8_t lpgm_sobel_u8(const lpgm_image_u8_t* im);
+	lpgm_status_t lpgm_sobel_u8_into(const lpgm_image_u8_t* im, lpgm_image_u8_t* dst);
+
+	/* NxN convolution with weights rounded to 12 fractional bits. */
+	lpgm_image_u8_t lpgm_convolve_u8(const lpgm_image_u8_t* im, const float* kernel, int ksize);
+	lpgm_status_t lpgm_convolve_u8_into(const lpgm_image_u8_t* im, const float* kernel, int ksize,
+	                                    lpgm_image_u8_t* dst);
+
+	/* NxN median filter. */
+	lpgm_image_u8_t lpgm_median_filter_u8(const lpgm_image_u8_t* im, int ksize);
+	lpgm_status_t lpgm_median_filter_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst);
+
+	/* Morphology with a square NxN structuring element. */
+	lpgm_image_u8_t lpgm_erode_u8(const lpgm_image_u8_t* im, int ksize);
+	lpgm_image_u8_t lpgm_dilate_u8(const lpgm_image_u8_t* im, int ksize);
+	lpgm_image_u8_t lpgm_opening_u8(const lpgm_image_u8_t* im, int ksize);
+	lpgm_image_u8_t lpgm_closing_u8(const lpgm_image_u8_t* im, int ksize);
+	lpgm_status_t lpgm_erode_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst);
+	lpgm_status_t lpgm_dilate_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst);
+
+	/* tmp is a scratch image of the same size; NULL allocates one for the call. */
+	lpgm_status_t lpgm_opening_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst,
+	                                   lpgm_image_u8_t* tmp);
+	lpgm_status_t lpgm_closing_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst,
+	                                   lpgm_image_u8_t* tmp);
+
+	/* ========================================================================
+	 * Histograms (histogram.c)
+	 * One counting pass serves Otsu, equalization and statistics; histograms
+	 * of tiles or frames can be merged:
+	 *
+	 *     lpgm_histogram_t hist = lpgm_histogram(&im);
+	 *     int t = lpgm_histogram_otsu(&hist);
+	 *     int p99 = lpgm_histogram_percentile(&hist, 99.0f);
+	 *     lpgm_image_t eq = lpgm_histogram_equalization_from(&im, &hist);
+	 *     lpgm_histogram_destroy(&hist);
+	 * ======================================================================== */
+
+	/* Empty histogram over n_bins levels (1 .. 65536), e.g. to merge into. */
+	lpgm_histogram_t lpgm_histogram_create(int n_bins);
+
+	/* Free the counts of a histogram. */
+	void lpgm_histogram_destroy(lpgm_histogram_t* hist);
+
+	/* Zero every count, keeping the bins. */
+	void lpgm_histogram_clear(lpgm_histogram_t* hist);
+
+	/*
+	 * Histogram of a float image: 256 bins for 8-bit data, else one bin per
+	 * level up to the largest sample (at most 65536), as lpgm_otsu_threshold()
+	 * and lpgm_histogram_equalization() use.
+	 */
+	lpgm_histogram_t lpgm_histogram(const lpgm_image_t* im);
+
+	/* 256 bins of a uint8 image, or max_val + 1 bins of a uint16 image. */
+	lpgm_histogram_t lpgm_histogram_u8(const lpgm_image_u8_t* im);
+	lpgm_histogram_t lpgm_histogram_u16(const lpgm_image_u16_t* im, int max_val);
+
+	/*
+	 * Recount hist from an image, keeping its bins, e.g. once per frame
+	 * without allocating. Samples are clamped to [0, n_bins - 1]; the uint8
+	 * version needs at least 256 bins.
+	 */
+	lpgm_status_t lpgm_histogram_into(const lpgm_image_t* im, lpgm_histogram_t* hist);
+	lpgm_status_t lpgm_histogram_u8_into(const lpgm_image_u8_t* im, lpgm_histogram_t* hist);
+	lpgm_status_t lpgm_histogram_u16_into(const lpgm_image_u16_t* im, lpgm_histogram_t* hist);
+
+	/*
+	 * Add the counts of src to dst. dst grows to the bins of src if it has
+	 * fewer; a zeroed lpgm_histogram_t is a valid empty dst.
+	 */
+	lpgm_status_t lpgm_histogram_merge(lpgm_histogram_t* dst, const lpgm_histogram_t* src);
+
+	/* cdf[v] = fraction of samples at levels <= v, for n_bins entries. */
+	lpgm_status_t lpgm_histogram_cdf(const lpgm_histogram_t* hist, float* cdf);
+
+	/* Mean and (population) variance of the samples; either output may be NULL. */
+	lpgm_status_t lpgm_histogram_mean_variance(const lpgm_histogram_t* hist, float* mean, float* variance);
+
+	/*
+	 * Level of the given percentile (0 .. 100) by nearest rank: 0 gives the
+	 * smallest sample, 100 the largest. Returns -1 on invalid input.
+	 */
+	int lpgm_histogram_percentile(const lpgm_histogram_t* hist, float percent);
+
+	/* Otsu threshold of the histogram (see lpgm_otsu_threshold()), or -1 on invalid input. */
+	int lpgm_histogram_otsu(const lpgm_histogram_t* hist);
+
+	/*
+	 * Multi-level Otsu over a histogram of at most LPGM_OTSU_MAX_LEVELS bins:
+	 * the n_thresholds increasing levels that maximize the between-class
+	 * variance of the n_thresholds + 1 classes [0, t1], (t1, t2], ...
+	 * O(n_thresholds * n_bins^2) from prefix sums, a few milliseconds for
+	 * 4 thresholds over 256 bins.
+	 */
+	lpgm_status_t lpgm_histogram_multi_otsu(const lpgm_histogram_t* hist, int n_thresholds, int* thresholds);
+
+	/*
+	 * Incremental update for frame streams: hist holds the histogram of prev
+	 * and becomes that of cur, looking only at the pixels that may have
+	 * changed, given as non-overlapping rectangles (e.g. dirty tiles) or as
+	 * the non-zero pixels of mask (same size as the frames). The bins of hist
+	 * are kept; samples are clamped to them as in lpgm_histogram_into(). The
+	 * derived values (lpgm_histogram_otsu(), lpgm_histogram_cdf(),
+	 * lpgm_histogram_equalization_from()) cost O(n_bins) from the updated
+	 * counts, independent of the frame size. Overlapping rectangles would
+	 * count their common pixels twice and fail with LPGM_FAIL, leaving hist
+	 * unchanged:
+	 *
+	 *     lpgm_histogram_t hist = lpgm_histogram_u8(&frames[0]);
+	 *     for each next frame:
+	 *         lpgm_histogram_update_u8(&hist, &prev, &cur, dirty, n_dirty);
+	 *         exposure = lpgm_histogram_percentile(&hist, 50.0f);
+	 */
+	lpgm_status_t lpgm_histogram_update(lpgm_histogram_t* hist, const lpgm_image_t* prev, const lpgm_image_t* cur,
+	                                    const lpgm_rect_t* rects, int n_rects);
+	lpgm_status_t lpgm_histogram_update_mask(lpgm_histogram_t* hist, const lpgm_image_t* prev, const lpgm_image_t* cur,
+	                                         const lpgm_image_u8_t* mask);
+	lpgm_status_t lpgm_histogram_update_u8(lpgm_histogram_t* hist, const lpgm_image_u8_t* prev,
+	                                       const lpgm_image_u8_t* cur, const lpgm_rect_t* rects, int n_rects);
+	lpgm_status_t lpgm_histogram_update_mask_u8(lpgm_histogram_t* hist, const lpgm_image_u8_t* prev,
+	                                            const lpgm_image_u8_t* cur, const lpgm_image_u8_t* mask);
 
 	/* ========================================================================
 	 * DFT Functions (dft.c) - O(N^2) complexity
@@ -224,6 +1024,17 @@ extern "C"
 	 */
 	int lpgm_next_power_of_two(int n);
 
+	/*
+	 * Read a PGM straight into a zero-padded complex signal for lpgm_fft2().
+	 * Rows and columns are padded to the next power of 2 and returned in
+	 * out_rows / out_cols; the image is at the top-left, imaginary parts are 0.
+	 * Replaces lpgm_file_read() + lpgm_image_to_signal() + zero padding with
+	 * one allocation and one pass. info (may be NULL) gets the original size.
+	 * Free *out_signal with lpgm_destroy_signal().
+	 */
+	lpgm_status_t lpgm_file_read_fft_signal(const char* file_name, lpgm_signal_t** out_signal, int* out_rows, int* out_cols,
+	                                        lpgm_info_t* info);
+
 	/* 
 	 * 1D Fast Fourier Transform (Cooley-Tukey radix-2).
 	 * signal_len MUST be a power of 2.
@@ -292,12 +1103,14 @@ extern "C"
 	 * Minimum value in neighborhood
 	 */
 	lpgm_image_t lpgm_erode(const lpgm_image_t* im, int ksize);
+	lpgm_status_t lpgm_erode_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst);
 
 	/* 
 	 * Dilation - expands white regions
 	 * Maximum value in neighborhood
 	 */
 	lpgm_image_t lpgm_dilate(const lpgm_image_t* im, int ksize);
+	lpgm_status_t lpgm_dilate_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst);
 
 	/* 
 	 * Opening - erosion followed by dilation
@@ -305,11 +1118,15 @@ extern "C"
 	 */
 	lpgm_image_t lpgm_opening(const lpgm_image_t* im, int ksize);
 
+	/* tmp is a scratch image of the same size; NULL allocates one for the call. */
+	lpgm_status_t lpgm_opening_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst, lpgm_image_t* tmp);
+
 	/* 
 	 * Closing - dilation followed by erosion
 	 * Fills small black holes
 	 */
 	lpgm_image_t lpgm_closing(const lpgm_image_t* im, int ksize);
+	lpgm_status_t lpgm_closing_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst, lpgm_image_t* tmp);
 
 #ifdef __cplusplus
 }
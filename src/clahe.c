@@ -0,0 +1,354 @@
+/*
+ * Contrast-limited adaptive histogram equalization (CLAHE)
+ *
+ * The image is split into tiles_x x tiles_y tiles. Each tile gets its own
+ * equalization table, made from its histogram after clipping every bin at
+ * clip_limit times the mean bin count and spreading the clipped samples
+ * evenly over all bins, which limits how much noise a flat region can
+ * amplify. Each output pixel then blends the tables of the (up to) four
+ * tile centers around it bilinearly, so neighboring tiles meet without
+ * seams.
+ *
+ * Two passes, each split over lpgm_get_num_threads() threads:
+ *   1. bands of tile rows: count the histograms of their tiles in one pass
+ *      over the rows, then clip and build the tables
+ *   2. bands of image rows: interpolate between the tables
+ */
+
+#include "internal.h"
+
+#include <string.h>
+
+typedef struct
+{
+	const lpgm_image_t* im;        /* Float input, or */
+	const lpgm_image_u8_t* im_u8;  /* uint8 input */
+	lpgm_image_t* dst;             /* Float output, or */
+	lpgm_image_u8_t* dst_u8;       /* uint8 output */
+	int w, h;
+	int tiles_x, tiles_y;
+	int n_bins;
+	float clip_limit;
+	const int* tile_x0;            /* Column bounds of the tiles, tiles_x + 1 */
+	const int* tile_y0;            /* Row bounds of the tiles, tiles_y + 1 */
+	const int* col_tile;           /* Per column: tile of the center at or left of it */
+	const float* col_weight;       /* Per column: weight of the tile to the right */
+	int* counts;                   /* Histograms of a tile row per band, n_bands * tiles_x * n_bins */
+	float* luts;                   /* Tables, tiles_y * tiles_x * n_bins */
+	int n_bands;                   /* Tasks of the current pass */
+} clahe_job_t;
+
+/* Clip histogram at clip counts per bin and spread the excess evenly, keeping the total */
+static void
+clip_histogram(int* histogram, int n_bins, int clip)
+{
+	long long excess;
+	int i, add, residual, step;
+
+	excess = 0;
+	for (i = 0; i < n_bins; ++i)
+	{
+		if (histogram[i] > clip)
+		{
+			excess += histogram[i] - clip;
+			histogram[i] = clip;
+		}
+	}
+	if (excess == 0)
+	{
+		return;
+	}
+
+	add = (int)(excess / n_bins);
+	residual = (int)(excess - (long long)add * n_bins);
+	for (i = 0; i < n_bins; ++i)
+	{
+		histogram[i] += add;
+	}
+
+	/* What does not divide evenly goes to bins spread over the range */
+	step = (residual > 0) ? n_bins / residual : 0;
+	step = (step < 1) ? 1 : step;
+	for (i = 0; i < n_bins && residual > 0; i += step, --residual)
+	{
+		histogram[i]++;
+	}
+}
+
+/* Histogram, clip and table of every tile of tile row ty */
+static void
+build_tile_row(clahe_job_t* job, int ty, int* counts)
+{
+	const float* src;
+	const unsigned char* src_u8;
+	int* histogram;
+	float* lut;
+	int y, tx, x0, x1, v, len, clip;
+	float top;
+
+	memset(counts, 0, (size_t)job->tiles_x * job->n_bins * sizeof(int));
+
+	/* One pass over the rows of the tile row, each row split at the tile bounds */
+	for (y = job->tile_y0[ty]; y < job->tile_y0[ty + 1]; ++y)
+	{
+		for (tx = 0; tx < job->tiles_x; ++tx)
+		{
+			x0 = job->tile_x0[tx];
+			x1 = job->tile_x0[tx + 1];
+			histogram = counts + (size_t)tx * job->n_bins;
+			if (job->im != NULL)
+			{
+				src = lpgm_image_row(job->im, y);
+				lpgm_count_row_f32(src + x0, x1 - x0, job->n_bins, histogram);
+			}
+			else
+			{
+				src_u8 = LPGM_U8_ROW(job->im_u8, y);
+				lpgm_count_row_u8(src_u8 + x0, x1 - x0, histogram);
+			}
+		}
+	}
+
+	top = (float)(job->n_bins - 1);
+	for (tx = 0; tx < job->tiles_x; ++tx)
+	{
+		histogram = counts + (size_t)tx * job->n_bins;
+		lut = job->luts + ((size_t)ty * job->tiles_x + tx) * job->n_bins;
+		len = (job->tile_x0[tx + 1] - job->tile_x0[tx]) * (job->tile_y0[ty + 1] - job->tile_y0[ty]);
+
+		if (job->clip_limit > 0.0f)
+		{
+			clip = (int)(job->clip_limit * (float)len / (float)job->n_bins);
+			clip_histogram(histogram, job->n_bins, (clip < 1) ? 1 : clip);
+		}
+
+		/* Same mapping as lpgm_histogram_equalization(), a flat tile is left as is */
+		if (lpgm_equalization_lut(histogram, job->n_bins, len, top, lut))
+		{
+			for (v = 0; v < job->n_bins; ++v)
+			{
+				lut[v] = (float)v;
+			}
+		}
+	}
+}
+
+static void
+build_tiles_task(void* ctx, int index)
+{
+	clahe_job_t* job = (clahe_job_t*)ctx;
+	int* counts;
+	int ty, ty_begin, ty_end;
+
+	counts = job->counts + (size_t)index * job->tiles_x * job->n_bins;
+	ty_begin = job->tiles_y * index / job->n_bands;
+	ty_end = job->tiles_y * (index + 1) / job->n_bands;
+	for (ty = ty_begin; ty < ty_end; ++ty)
+	{
+		build_tile_row(job, ty, counts);
+	}
+}
+
+/*
+ * Tile of the center at or before position p and the weight of the next one,
+ * for tiles with bounds t0[0 .. n]. Before the first and after the last
+ * center only one tile applies (weight 0).
+ */
+static void
+locate(const int* t0, int n, int p, int* tile, float* weight)
+{
+	float center, next;
+	int t;
+
+	t = 0;
+	while (t + 1 < n && (float)p >= 0.5f * (float)(t0[t + 1] + t0[t + 2] - 1))
+	{
+		++t;
+	}
+
+	center = 0.5f * (float)(t0[t] + t0[t + 1] - 1);
+	*tile = t;
+	*weight = 0.0f;
+	if (t + 1 < n && (float)p > center)
+	{
+		next = 0.5f * (float)(t0[t + 1] + t0[t + 2] - 1);
+		*weight = ((float)p - center) / (next - center);
+	}
+}
+
+static inline unsigned char
+u8_level(float v)
+{
+	v = (v < 0.0f) ? 0.0f : v;
+	v = (v > 255.0f) ? 255.0f : v;
+
+	return (unsigned char)(int)v;
+}
+
+static void
+interpolate_task(void* ctx, int index)
+{
+	clahe_job_t* job = (clahe_job_t*)ctx;
+	const float* lut_top;
+	const float* lut_bottom;
+	const float* src;
+	const unsigned char* src_u8;
+	float* out;
+	unsigned char* out_u8;
+	size_t next;
+	int y, x, ty, tx, v, y_begin, y_end, top;
+	float wy, wx, top_f, upper, lower, value;
+
+	y_begin = (int)((long long)job->h * index / job->n_bands);
+	y_end = (int)((long long)job->h * (index + 1) / job->n_bands);
+	top = job->n_bins - 1;
+	top_f = (float)top;
+
+	src = NULL;
+	src_u8 = NULL;
+	out = NULL;
+	out_u8 = NULL;
+	for (y = y_begin; y < y_end; ++y)
+	{
+		locate(job->tile_y0, job->tiles_y, y, &ty, &wy);
+		lut_top = job->luts + (size_t)ty * job->tiles_x * job->n_bins;
+		lut_bottom = (ty + 1 < job->tiles_y) ? lut_top + (size_t)job->tiles_x * job->n_bins : lut_top;
+
+		if (job->im != NULL)
+		{
+			src = lpgm_image_row(job->im, y);
+		}
+		else
+		{
+			src_u8 = LPGM_U8_ROW(job->im_u8, y);
+		}
+		if (job->dst != NULL)
+		{
+			out = lpgm_image_row(job->dst, y);
+		}
+		else
+		{
+			out_u8 = LPGM_U8_ROW(job->dst_u8, y);
+		}
+
+		for (x = 0; x < job->w; ++x)
+		{
+			v = (src != NULL) ? lpgm_sample_bin(src[x], top_f, top) : src_u8[x];
+			tx = job->col_tile[x];
+			wx = job->col_weight[x];
+
+			/* The right-hand tables are only read with a non-zero weight */
+			next = (wx > 0.0f) ? (size_t)job->n_bins : 0;
+			upper = lut_top[(size_t)tx * job->n_bins + v];
+			upper += wx * (lut_top[(size_t)tx * job->n_bins + next + v] - upper);
+			lower = lut_bottom[(size_t)tx * job->n_bins + v];
+			lower += wx * (lut_bottom[(size_t)tx * job->n_bins + next + v] - lower);
+			value = upper + wy * (lower - upper);
+
+			if (out != NULL)
+			{
+				out[x] = value;
+			}
+			else
+			{
+				out_u8[x] = u8_level(value);
+			}
+		}
+	}
+}
+
+static int
+clamp_tasks(int n)
+{
+	int n_tasks = lpgm_get_num_threads();
+
+	n_tasks = (n_tasks > n) ? n : n_tasks;
+
+	return (n_tasks < 1) ? 1 : n_tasks;
+}
+
+int
+lpgm_clahe_run(const lpgm_image_t* im, const lpgm_image_u8_t* im_u8, int tiles_x, int tiles_y, float clip_limit,
+               lpgm_image_t* dst, lpgm_image_u8_t* dst_u8, const char* caller)
+{
+	clahe_job_t job;
+	int* bounds;
+	int* col_tile;
+	float* col_weight;
+	int x, n_bands;
+
+	job.im = im;
+	job.im_u8 = im_u8;
+	job.dst = dst;
+	job.dst_u8 = dst_u8;
+	job.w = (im != NULL) ? im->w : im_u8->w;
+	job.h = (im != NULL) ? im->h : im_u8->h;
+
+	if (tiles_x < 1 || tiles_y < 1 || tiles_x > job.w || tiles_y > job.h)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid tile grid [%d x %d] for a [%d x %d] image.", tiles_x, tiles_y,
+		         job.w, job.h);
+		return -1;
+	}
+	if (!(clip_limit >= 0.0f))
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid clip limit: [%f].", clip_limit);
+		return -1;
+	}
+
+	job.tiles_x = tiles_x;
+	job.tiles_y = tiles_y;
+	job.n_bins = (im != NULL) ? lpgm_histogram_bins(im) : 256;
+	job.clip_limit = clip_limit;
+
+	n_bands = clamp_tasks(tiles_y);
+	bounds = (int*)lpgm_malloc((size_t)(tiles_x + tiles_y + 2) * sizeof(int));
+	col_tile = (int*)lpgm_malloc((size_t)job.w * sizeof(int));
+	col_weight = (float*)lpgm_malloc((size_t)job.w * sizeof(float));
+	job.counts = (int*)lpgm_malloc((size_t)n_bands * tiles_x * job.n_bins * sizeof(int));
+	job.luts = (float*)lpgm_malloc((size_t)tiles_y * tiles_x * job.n_bins * sizeof(float));
+	if (bounds == NULL || col_tile == NULL || col_weight == NULL || job.counts == NULL || job.luts == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Memory allocation failed.");
+		lpgm_free(bounds);
+		lpgm_free(col_tile);
+		lpgm_free(col_weight);
+		lpgm_free(job.counts);
+		lpgm_free(job.luts);
+		return -1;
+	}
+
+	/* Tiles differ in size by at most one pixel */
+	for (x = 0; x <= tiles_x; ++x)
+	{
+		bounds[x] = (int)((long long)job.w * x / tiles_x);
+	}
+	for (x = 0; x <= tiles_y; ++x)
+	{
+		bounds[tiles_x + 1 + x] = (int)((long long)job.h * x / tiles_y);
+	}
+	job.tile_x0 = bounds;
+	job.tile_y0 = bounds + tiles_x + 1;
+
+	for (x = 0; x < job.w; ++x)
+	{
+		locate(job.tile_x0, tiles_x, x, &col_tile[x], &col_weight[x]);
+	}
+	job.col_tile = col_tile;
+	job.col_weight = col_weight;
+
+	/* Pass 1 reads every input row before pass 2 writes, so dst may be the input */
+	job.n_bands = n_bands;
+	lpgm_parallel_run(job.n_bands, build_tiles_task, &job);
+
+	job.n_bands = clamp_tasks(job.h);
+	lpgm_parallel_run(job.n_bands, interpolate_task, &job);
+
+	lpgm_free(bounds);
+	lpgm_free(col_tile);
+	lpgm_free(col_weight);
+	lpgm_free(job.counts);
+	lpgm_free(job.luts);
+
+	return 0;
+}
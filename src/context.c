@@ -0,0 +1,457 @@
+/*
+ * Allocation contexts
+ *
+ * A context is a pool of LPGM_ROW_ALIGN-aligned blocks sorted into size
+ * classes, four per power of two (64, 80, 96, 112, 128, 160, ...), so a
+ * block is at most 25% larger than the request. While a context is bound to
+ * a thread, every lpgm_malloc()/lpgm_aligned_alloc() on that thread takes a
+ * block from it: from the free list of its class if there is one, otherwise
+ * from the lpgm_set_allocator() hooks. lpgm_free() puts the block back on
+ * its free list and lpgm_context_reset() puts back every block at once.
+ *
+ * Blocks are only returned to the system by lpgm_context_destroy(), so a
+ * worker that processes frames of the same size reaches a fixed footprint
+ * after the first frame and makes no system allocation after that.
+ *
+ * Each context records the blocks it owns in an open-addressing table keyed
+ * by address. lpgm_free() on a thread without the owning context bound finds
+ * the owner through the list of live contexts.
+ */
+
+#include "internal.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Smallest block; also holds the free list link */
+#define POOL_MIN_BLOCK 64
+
+/* Classes up to POOL_MIN_BLOCK << 40 bytes, larger requests bypass the pool */
+#define POOL_NUM_CLASSES (4 * 40 + 1)
+
+#define POOL_TABLE_MIN 64
+
+typedef struct
+{
+	void* ptr;     /* NULL for an empty slot */
+	int size_class;
+	int in_use;
+} pool_block_t;
+
+struct lpgm_context
+{
+	pthread_mutex_t lock;
+	size_t limit;                     /* Max bytes reserved, 0 for no limit */
+	void* free_lists[POOL_NUM_CLASSES];
+	pool_block_t* table;              /* Every block the context owns */
+	size_t table_size;                /* Power of two */
+	size_t n_blocks;
+	lpgm_context_stats_t stats;
+	lpgm_context_t* next;             /* In g_contexts */
+};
+
+/* Live contexts, searched by lpgm_free() for blocks freed off their thread */
+static lpgm_context_t* g_contexts = NULL;
+static pthread_mutex_t g_contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_num_contexts = 0;
+
+static __thread lpgm_context_t* g_bound_context = NULL;
+
+/* Class of a request of size bytes; 0 .. POOL_NUM_CLASSES - 1 or -1 if too large */
+static int
+size_class_of(size_t size)
+{
+	size_t base, step;
+	int size_class;
+
+	if (size <= POOL_MIN_BLOCK)
+	{
+		return 0;
+	}
+
+	/* size is in (base, 2 * base], split into four steps */
+	base = POOL_MIN_BLOCK;
+	size_class = 0;
+	while (base * 2 < size)
+	{
+		base *= 2;
+		size_class += 4;
+		if (size_class + 4 >= POOL_NUM_CLASSES)
+		{
+			return -1;
+		}
+	}
+	step = base / 4;
+
+	return size_class + (int)((size - base + step - 1) / step);
+}
+
+static size_t
+class_size(int size_class)
+{
+	size_t base;
+
+	if (size_class == 0)
+	{
+		return POOL_MIN_BLOCK;
+	}
+	base = (size_t)POOL_MIN_BLOCK << ((size_class - 1) / 4);
+
+	return base + (base / 4) * (size_t)((size_class - 1) % 4 + 1);
+}
+
+static size_t
+hash_ptr(const void* ptr, size_t table_size)
+{
+	uint64_t h = (uint64_t)(uintptr_t)ptr >> 6;
+
+	h *= 0x9E3779B97F4A7C15ULL;
+
+	return (size_t)(h >> 32) & (table_size - 1);
+}
+
+/* Slot of ptr in the table, or NULL if the context does not own it */
+static pool_block_t*
+find_block(lpgm_context_t* ctx, const void* ptr)
+{
+	size_t i;
+
+	if (ctx->table == NULL)
+	{
+		return NULL;
+	}
+
+	i = hash_ptr(ptr, ctx->table_size);
+	while (ctx->table[i].ptr != NULL)
+	{
+		if (ctx->table[i].ptr == ptr)
+		{
+			return &ctx->table[i];
+		}
+		i = (i + 1) & (ctx->table_size - 1);
+	}
+
+	return NULL;
+}
+
+static void
+insert_block(pool_block_t* table, size_t table_size, const pool_block_t* block)
+{
+	size_t i;
+
+	i = hash_ptr(block->ptr, table_size);
+	while (table[i].ptr != NULL)
+	{
+		i = (i + 1) & (table_size - 1);
+	}
+	table[i] = *block;
+}
+
+/* Make room for one more block, keeping the table at most half full. Returns 0 or -1. */
+static int
+reserve_table(lpgm_context_t* ctx)
+{
+	pool_block_t* table;
+	size_t table_size, i;
+
+	if ((ctx->n_blocks + 1) * 2 <= ctx->table_size)
+	{
+		return 0;
+	}
+
+	table_size = (ctx->table_size == 0) ? POOL_TABLE_MIN : ctx->table_size * 2;
+	table = (pool_block_t*)lpgm_sys_alloc(table_size * sizeof(pool_block_t), 0);
+	if (table == NULL)
+	{
+		return -1;
+	}
+	memset(table, 0, table_size * sizeof(pool_block_t));
+
+	for (i = 0; i < ctx->table_size; i++)
+	{
+		if (ctx->table[i].ptr != NULL)
+		{
+			insert_block(table, table_size, &ctx->table[i]);
+		}
+	}
+	lpgm_sys_free(ctx->table);
+	ctx->table = table;
+	ctx->table_size = table_size;
+
+	return 0;
+}
+
+/* Take a block of the given class, from its free list or the system. Called with ctx->lock held. */
+static void*
+take_block(lpgm_context_t* ctx, int size_class)
+{
+	pool_block_t block;
+	pool_block_t* slot;
+	size_t size;
+	void* ptr;
+
+	size = class_size(size_class);
+
+	ptr = ctx->free_lists[size_class];
+	if (ptr != NULL)
+	{
+		ctx->free_lists[size_class] = *(void**)ptr;
+		slot = find_block(ctx, ptr);
+		slot->in_use = 1;
+	}
+	else
+	{
+		if (ctx->limit != 0 && ctx->stats.bytes_reserved + size > ctx->limit)
+		{
+			lpgm_log(LPGM_LOG_WARN, __func__, "Context limit of [%zu] bytes reached.", ctx->limit);
+			return NULL;
+		}
+		if (reserve_table(ctx) != 0)
+		{
+			return NULL;
+		}
+		ptr = lpgm_sys_alloc(size, 1);
+		if (ptr == NULL)
+		{
+			return NULL;
+		}
+
+		block.ptr = ptr;
+		block.size_class = size_class;
+		block.in_use = 1;
+		insert_block(ctx->table, ctx->table_size, &block);
+		ctx->n_blocks++;
+		ctx->stats.bytes_reserved += size;
+		ctx->stats.system_allocs++;
+	}
+
+	ctx->stats.bytes_in_use += size;
+	if (ctx->stats.bytes_in_use > ctx->stats.peak_bytes_in_use)
+	{
+		ctx->stats.peak_bytes_in_use = ctx->stats.bytes_in_use;
+	}
+
+	return ptr;
+}
+
+/* Put a block back on its free list. Called with ctx->lock held. */
+static void
+release_block(lpgm_context_t* ctx, pool_block_t* slot)
+{
+	if (!slot->in_use)
+	{
+		return;
+	}
+	slot->in_use = 0;
+	*(void**)slot->ptr = ctx->free_lists[slot->size_class];
+	ctx->free_lists[slot->size_class] = slot->ptr;
+	ctx->stats.bytes_in_use -= class_size(slot->size_class);
+}
+
+/* Owner of ptr among the live contexts, returned with its lock held, or NULL */
+static lpgm_context_t*
+lock_owner(const void* ptr, pool_block_t** slot)
+{
+	lpgm_context_t* ctx;
+
+	if (__atomic_load_n(&g_num_contexts, __ATOMIC_ACQUIRE) == 0)
+	{
+		return NULL;
+	}
+
+	ctx = g_bound_context;
+	if (ctx != NULL)
+	{
+		pthread_mutex_lock(&ctx->lock);
+		*slot = find_block(ctx, ptr);
+		if (*slot != NULL)
+		{
+			return ctx;
+		}
+		pthread_mutex_unlock(&ctx->lock);
+	}
+
+	pthread_mutex_lock(&g_contexts_lock);
+	for (ctx = g_contexts; ctx != NULL; ctx = ctx->next)
+	{
+		if (ctx == g_bound_context)
+		{
+			continue;
+		}
+		pthread_mutex_lock(&ctx->lock);
+		*slot = find_block(ctx, ptr);
+		if (*slot != NULL)
+		{
+			break;
+		}
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	pthread_mutex_unlock(&g_contexts_lock);
+
+	return ctx;
+}
+
+int
+lpgm_context_alloc(size_t size, void** ptr)
+{
+	lpgm_context_t* ctx = g_bound_context;
+	int size_class;
+
+	if (ctx == NULL)
+	{
+		return 0;
+	}
+	size_class = size_class_of(size);
+	if (size_class < 0)
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	*ptr = take_block(ctx, size_class);
+	pthread_mutex_unlock(&ctx->lock);
+
+	return 1;
+}
+
+size_t
+lpgm_context_block_size(const void* ptr)
+{
+	lpgm_context_t* ctx;
+	pool_block_t* slot;
+	size_t size;
+
+	ctx = lock_owner(ptr, &slot);
+	if (ctx == NULL)
+	{
+		return 0;
+	}
+	size = class_size(slot->size_class);
+	pthread_mutex_unlock(&ctx->lock);
+
+	return size;
+}
+
+int
+lpgm_context_free(void* ptr)
+{
+	lpgm_context_t* ctx;
+	pool_block_t* slot;
+
+	ctx = lock_owner(ptr, &slot);
+	if (ctx == NULL)
+	{
+		return 0;
+	}
+	release_block(ctx, slot);
+	pthread_mutex_unlock(&ctx->lock);
+
+	return 1;
+}
+
+lpgm_context_t*
+lpgm_context_create(size_t limit_bytes)
+{
+	lpgm_context_t* ctx;
+
+	ctx = (lpgm_context_t*)lpgm_sys_alloc(sizeof(*ctx), 0);
+	if (ctx == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		return NULL;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	pthread_mutex_init(&ctx->lock, NULL);
+	ctx->limit = limit_bytes;
+
+	pthread_mutex_lock(&g_contexts_lock);
+	ctx->next = g_contexts;
+	g_contexts = ctx;
+	__atomic_add_fetch(&g_num_contexts, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&g_contexts_lock);
+
+	return ctx;
+}
+
+void
+lpgm_context_destroy(lpgm_context_t* ctx)
+{
+	lpgm_context_t** link;
+	size_t i;
+
+	if (ctx == NULL)
+	{
+		return;
+	}
+	if (g_bound_context == ctx)
+	{
+		g_bound_context = NULL;
+	}
+
+	pthread_mutex_lock(&g_contexts_lock);
+	for (link = &g_contexts; *link != NULL; link = &(*link)->next)
+	{
+		if (*link == ctx)
+		{
+			*link = ctx->next;
+			break;
+		}
+	}
+	__atomic_sub_fetch(&g_num_contexts, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&g_contexts_lock);
+
+	for (i = 0; i < ctx->table_size; i++)
+	{
+		lpgm_sys_free(ctx->table[i].ptr);
+	}
+	lpgm_sys_free(ctx->table);
+	pthread_mutex_destroy(&ctx->lock);
+	lpgm_sys_free(ctx);
+}
+
+void
+lpgm_context_reset(lpgm_context_t* ctx)
+{
+	size_t i;
+
+	if (ctx == NULL)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	for (i = 0; i < ctx->table_size; i++)
+	{
+		if (ctx->table[i].ptr != NULL)
+		{
+			release_block(ctx, &ctx->table[i]);
+		}
+	}
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+lpgm_context_t*
+lpgm_context_bind(lpgm_context_t* ctx)
+{
+	lpgm_context_t* previous = g_bound_context;
+
+	g_bound_context = ctx;
+
+	return previous;
+}
+
+lpgm_status_t
+lpgm_context_get_stats(lpgm_context_t* ctx, lpgm_context_stats_t* stats)
+{
+	if (ctx == NULL || stats == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	*stats = ctx->stats;
+	pthread_mutex_unlock(&ctx->lock);
+
+	return LPGM_OK;
+}
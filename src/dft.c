@@ -1,4 +1,4 @@
-#include "../include/pigiem.h"
+#include "internal.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -22,7 +22,7 @@ lpgm_make_empty_signal(int signal_len)
 {
 	lpgm_signal_t* signal;
 
-	signal = (lpgm_signal_t*)calloc(signal_len, sizeof(lpgm_signal_t));
+	signal = (lpgm_signal_t*)lpgm_calloc(signal_len, sizeof(lpgm_signal_t));
 	if (signal == NULL)
 	{
 		return NULL;
@@ -36,7 +36,7 @@ lpgm_destroy_signal(lpgm_signal_t* signal)
 {
 	if (signal != NULL)
 	{
-		free(signal);
+		lpgm_free(signal);
 		signal = NULL;
 	}
 }
@@ -44,17 +44,22 @@ lpgm_destroy_signal(lpgm_signal_t* signal)
 lpgm_status_t
 lpgm_image_to_signal(const lpgm_image_t* im, lpgm_signal_t* out_signal)
 {
-	int i;
+	int i, x;
+	const float* row;
 
 	if (im->data == NULL || out_signal == NULL)
 	{
 		return LPGM_FAIL;
 	}
 
-	for (i = 0; i < (im->w * im->h); ++i)
+	for (i = 0; i < im->h; ++i)
 	{
-		out_signal[i].imaginary = 0;
-		out_signal[i].real = im->data[i];
+		row = lpgm_image_row(im, i);
+		for (x = 0; x < im->w; ++x)
+		{
+			out_signal[(size_t)i * im->w + x].imaginary = 0;
+			out_signal[(size_t)i * im->w + x].real = row[x];
+		}
 	}
 
 	return LPGM_OK;
@@ -17,11 +17,15 @@
  * Requirement: N must be a power of 2. Use zero-padding if necessary.
  */
 
-#include "../include/pigiem.h"
+#include "internal.h"
 
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Twiddle tables up to this many entries (transforms of twice that size) live on the stack */
+#define FFT_STACK_TWIDDLES 1024
 
 /*
  * Calculate the next power of two >= n
@@ -40,6 +44,103 @@ lpgm_next_power_of_two(int n)
 	return power;
 }
 
+/* Rows decoded per read while loading a signal; only this strip is kept as float */
+#define LPGM_FFT_LOAD_STRIP_ROWS 64
+
+/*
+ * Load a PGM straight into a zero-padded signal ready for lpgm_fft2()
+ * 
+ * Replaces lpgm_file_read() + lpgm_image_to_signal() + lpgm_zero_padding_signal():
+ * rows are streamed through a small float strip and written once into the
+ * padded signal (pixels, then the zero tail of the row), so there is one
+ * full-size allocation and one pass over it.
+ * 
+ *   signal[row * padded_cols + col] = { 0, pixel }   row < h, col < w
+ *                                   = { 0, 0 }       padding
+ */
+lpgm_status_t
+lpgm_file_read_fft_signal(const char* file_name, lpgm_signal_t** out_signal, int* out_rows, int* out_cols, lpgm_info_t* info)
+{
+	lpgm_stream_t stream;
+	lpgm_signal_t* signal;
+	lpgm_signal_t* dst;
+	float* strip;
+	int w, h, padded_rows, padded_cols;
+	int r, i, j, n;
+
+	if (out_signal == NULL || out_rows == NULL || out_cols == NULL)
+	{
+		return LPGM_FAIL;
+	}
+	*out_signal = NULL;
+
+	if (lpgm_stream_open(file_name, &stream) != LPGM_OK)
+	{
+		return LPGM_FAIL;
+	}
+
+	w = stream.header.im.w;
+	h = stream.header.im.h;
+	padded_rows = lpgm_next_power_of_two(h);
+	padded_cols = lpgm_next_power_of_two(w);
+
+	/* Every element is written below, no need to clear it first */
+	signal = (lpgm_signal_t*)lpgm_malloc((size_t)padded_rows * padded_cols * sizeof(lpgm_signal_t));
+	strip = (float*)lpgm_malloc((size_t)w * LPGM_FFT_LOAD_STRIP_ROWS * sizeof(float));
+	if (signal == NULL || strip == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		lpgm_free(signal);
+		lpgm_free(strip);
+		lpgm_stream_close(&stream);
+		return LPGM_FAIL;
+	}
+
+	for (r = 0; r < h; r += n)
+	{
+		n = lpgm_stream_read_rows(&stream, strip, LPGM_FFT_LOAD_STRIP_ROWS);
+		if (n <= 0)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading pixel data from file: [%s].", file_name);
+			lpgm_free(signal);
+			lpgm_free(strip);
+			lpgm_stream_close(&stream);
+			return LPGM_FAIL;
+		}
+
+		for (i = 0; i < n; ++i)
+		{
+			dst = signal + (size_t)(r + i) * padded_cols;
+			for (j = 0; j < w; ++j)
+			{
+				dst[j].imaginary = 0.0f;
+				dst[j].real = strip[(size_t)i * w + j];
+			}
+			memset(dst + w, 0, (size_t)(padded_cols - w) * sizeof(lpgm_signal_t));
+		}
+	}
+
+	/* Padding rows below the image */
+	memset(signal + (size_t)h * padded_cols, 0, (size_t)(padded_rows - h) * padded_cols * sizeof(lpgm_signal_t));
+
+	if (info != NULL)
+	{
+		memcpy(info->magic_number, stream.header.magic_number, sizeof(info->magic_number));
+		info->max_val = stream.header.max_val;
+		info->w = w;
+		info->h = h;
+	}
+
+	lpgm_free(strip);
+	lpgm_stream_close(&stream);
+
+	*out_signal = signal;
+	*out_rows = padded_rows;
+	*out_cols = padded_cols;
+
+	return LPGM_OK;
+}
+
 /*
  * Bit-reversal permutation
  * 
@@ -113,6 +214,7 @@ bit_reverse_copy(const lpgm_signal_t* input, lpgm_signal_t* output, int n)
  *   signal_len   - length of the signal (MUST be power of 2)
  *   out_signal   - output complex signal array (must be pre-allocated)
  *   inverse      - 0 for forward FFT, 1 for inverse FFT
+ *   twiddles     - scratch for signal_len / 2 twiddle factors
  * 
  * Complexity: O(N log N)
  * 
@@ -123,28 +225,17 @@ bit_reverse_copy(const lpgm_signal_t* input, lpgm_signal_t* output, int n)
  * 
  * where W = e^(-j * 2 * pi * k / N) for forward, e^(+j * ...) for inverse
  */
-lpgm_status_t
-lpgm_fft(const lpgm_signal_t* input_signal, int signal_len, lpgm_signal_t* out_signal, int inverse)
+static lpgm_status_t
+fft_1d(const lpgm_signal_t* input_signal, int signal_len, lpgm_signal_t* out_signal, int inverse, lpgm_signal_t* twiddles)
 {
-	int i, j, k;
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	int i, j;
 	int m, m2;
 	float angle;
 	float t_real, t_imag;
 	float u_real, u_imag;
 	float w_real, w_imag;
 	
-	if (input_signal == NULL || out_signal == NULL)
-	{
-		return LPGM_FAIL;
-	}
-	
-	/* Check if signal_len is power of 2 */
-	if ((signal_len & (signal_len - 1)) != 0)
-	{
-		fprintf(stderr, "%s(): signal_len must be power of 2, got %d\n", __func__, signal_len);
-		return LPGM_FAIL;
-	}
-	
 	/* Bit-reversal permutation (supports in-place) */
 	if (bit_reverse_copy(input_signal, out_signal, signal_len) != 0)
 	{
@@ -168,37 +259,25 @@ lpgm_fft(const lpgm_signal_t* input_signal, int signal_len, lpgm_signal_t* out_s
 		w_real = cos(angle);
 		w_imag = sin(angle);
 		
-		/* Process each group of m elements */
-		for (k = 0; k < signal_len; k += m)
+		/*
+		 * Twiddles W = W_m^j of this stage, by the recurrence W = W * W_m
+		 * starting from W = 1. Every group of m elements uses the same ones.
+		 */
+		u_real = 1.0f;
+		u_imag = 0.0f;
+		for (j = 0; j < m2; ++j)
 		{
-			/* Initialize twiddle factor W = 1 */
-			u_real = 1.0f;
-			u_imag = 0.0f;
+			twiddles[j].real = u_real;
+			twiddles[j].imaginary = u_imag;
 			
-			/* Butterfly operations within this group */
-			for (j = 0; j < m2; ++j)
-			{
-				/* t = W * out[k + j + m2] */
-				t_real = u_real * out_signal[k + j + m2].real - u_imag * out_signal[k + j + m2].imaginary;
-				t_imag = u_real * out_signal[k + j + m2].imaginary + u_imag * out_signal[k + j + m2].real;
-				
-				/* Butterfly: 
-				 * out[k + j]      = out[k + j] + t
-				 * out[k + j + m2] = out[k + j] - t
-				 */
-				out_signal[k + j + m2].real = out_signal[k + j].real - t_real;
-				out_signal[k + j + m2].imaginary = out_signal[k + j].imaginary - t_imag;
-				
-				out_signal[k + j].real = out_signal[k + j].real + t_real;
-				out_signal[k + j].imaginary = out_signal[k + j].imaginary + t_imag;
-				
-				/* Update twiddle factor: W = W * W_m */
-				t_real = u_real * w_real - u_imag * w_imag;
-				t_imag = u_real * w_imag + u_imag * w_real;
-				u_real = t_real;
-				u_imag = t_imag;
-			}
+			t_real = u_real * w_real - u_imag * w_imag;
+			t_imag = u_real * w_imag + u_imag * w_real;
+			u_real = t_real;
+			u_imag = t_imag;
 		}
+		
+		/* Butterflies of every group (fft_stage kernel, see kernels.h) */
+		kernels->fft_stage(out_signal, signal_len, m, twiddles);
 	}
 	
 	/* Normalize for inverse FFT */
@@ -214,6 +293,46 @@ lpgm_fft(const lpgm_signal_t* input_signal, int signal_len, lpgm_signal_t* out_s
 	return LPGM_OK;
 }
 
+/* Twiddle scratch on the stack up to 2 * FFT_STACK_TWIDDLES points */
+lpgm_status_t
+lpgm_fft(const lpgm_signal_t* input_signal, int signal_len, lpgm_signal_t* out_signal, int inverse)
+{
+	lpgm_signal_t stack_twiddles[FFT_STACK_TWIDDLES];
+	lpgm_signal_t* twiddles;
+	lpgm_status_t status;
+	
+	if (input_signal == NULL || out_signal == NULL)
+	{
+		return LPGM_FAIL;
+	}
+	
+	/* Check if signal_len is power of 2 */
+	if ((signal_len & (signal_len - 1)) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "signal_len must be power of 2, got %d", signal_len);
+		return LPGM_FAIL;
+	}
+	
+	twiddles = stack_twiddles;
+	if (signal_len / 2 > FFT_STACK_TWIDDLES)
+	{
+		twiddles = lpgm_make_empty_signal(signal_len / 2);
+		if (twiddles == NULL)
+		{
+			return LPGM_FAIL;
+		}
+	}
+	
+	status = fft_1d(input_signal, signal_len, out_signal, inverse, twiddles);
+	
+	if (twiddles != stack_twiddles)
+	{
+		lpgm_destroy_signal(twiddles);
+	}
+	
+	return status;
+}
+
 /*
  * 2D Fast Fourier Transform (separable, row-column decomposition)
  * 
@@ -238,6 +357,7 @@ lpgm_fft2(const lpgm_signal_t* input_signal, int rows, int cols, lpgm_signal_t*
 	lpgm_signal_t* out_row_signal;
 	lpgm_signal_t* col_signal;
 	lpgm_signal_t* out_col_signal;
+	lpgm_signal_t* twiddles;
 	
 	if (input_signal == NULL || out_signal == NULL)
 	{
@@ -247,7 +367,7 @@ lpgm_fft2(const lpgm_signal_t* input_signal, int rows, int cols, lpgm_signal_t*
 	/* Check if dimensions are power of 2 */
 	if ((rows & (rows - 1)) != 0 || (cols & (cols - 1)) != 0)
 	{
-		fprintf(stderr, "%s(): rows and cols must be powers of 2, got %dx%d\n", __func__, rows, cols);
+		lpgm_log(LPGM_LOG_ERROR, __func__, "rows and cols must be powers of 2, got %dx%d", rows, cols);
 		return LPGM_FAIL;
 	}
 	
@@ -257,15 +377,17 @@ lpgm_fft2(const lpgm_signal_t* input_signal, int rows, int cols, lpgm_signal_t*
 	out_row_signal = lpgm_make_empty_signal(cols);
 	col_signal = lpgm_make_empty_signal(rows);
 	out_col_signal = lpgm_make_empty_signal(rows);
+	twiddles = lpgm_make_empty_signal(((rows > cols) ? rows : cols) / 2 + 1);
 	
 	if (temp_signal == NULL || row_signal == NULL || out_row_signal == NULL ||
-	    col_signal == NULL || out_col_signal == NULL)
+	    col_signal == NULL || out_col_signal == NULL || twiddles == NULL)
 	{
 		lpgm_destroy_signal(temp_signal);
 		lpgm_destroy_signal(row_signal);
 		lpgm_destroy_signal(out_row_signal);
 		lpgm_destroy_signal(col_signal);
 		lpgm_destroy_signal(out_col_signal);
+		lpgm_destroy_signal(twiddles);
 		return LPGM_FAIL;
 	}
 	
@@ -287,7 +409,7 @@ lpgm_fft2(const lpgm_signal_t* input_signal, int rows, int cols, lpgm_signal_t*
 		}
 		
 		/* FFT of the row */
-		lpgm_fft(row_signal, cols, out_row_signal, inverse);
+		fft_1d(row_signal, cols, out_row_signal, inverse, twiddles);
 		
 		/* Store result in temp_signal */
 		for (j = 0; j < cols; ++j)
@@ -308,7 +430,7 @@ lpgm_fft2(const lpgm_signal_t* input_signal, int rows, int cols, lpgm_signal_t*
 		}
 		
 		/* FFT of the column */
-		lpgm_fft(col_signal, rows, out_col_signal, inverse);
+		fft_1d(col_signal, rows, out_col_signal, inverse, twiddles);
 		
 		/* Store result in out_signal */
 		for (j = 0; j < rows; ++j)
@@ -324,6 +446,7 @@ lpgm_fft2(const lpgm_signal_t* input_signal, int rows, int cols, lpgm_signal_t*
 	lpgm_destroy_signal(out_row_signal);
 	lpgm_destroy_signal(col_signal);
 	lpgm_destroy_signal(out_col_signal);
+	lpgm_destroy_signal(twiddles);
 	
 	return LPGM_OK;
 }
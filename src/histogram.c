@@ -0,0 +1,984 @@
+/*
+ * Histogram engine
+ *
+ * Shared by Otsu and histogram equalization on float, uint8 and uint16
+ * images. Two things keep it fast on large images:
+ *
+ *   lanes:   consecutive pixels are counted into HIST_LANES interleaved
+ *            sub-histograms, so a run of equal pixels does not make every
+ *            increment wait for the store of the previous one
+ *   threads: images of HIST_PARALLEL_MIN pixels or more are split into bands
+ *            of rows over lpgm_get_num_threads() threads, each with its own
+ *            sub-histograms, merged at the end
+ *
+ * lpgm_histogram_t wraps a count so one pass serves Otsu, equalization and
+ * statistics, and counts of tiles or frames can be merged.
+ */
+
+#include "internal.h"
+
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+/* Sub-histograms per thread, for up to HIST_LANES_MAX_BINS bins */
+#define HIST_LANES 4
+#define HIST_LANES_MAX_BINS 4096
+
+/* Smaller images are not worth starting threads for */
+#define HIST_PARALLEL_MIN (1 << 20)
+
+/* Bands whose 256-bin sub-histograms fit on the stack (32 KB), so a frame loop does not allocate */
+#define HIST_STACK_TASKS 8
+
+typedef enum
+{
+	SAMPLES_F32,
+	SAMPLES_U8,
+	SAMPLES_U16
+} sample_type_t;
+
+typedef struct
+{
+	sample_type_t type;
+	const unsigned char* data;
+	size_t row_bytes;          /* From one row to the next */
+	int w, h;
+	int n_bins;
+	int n_lanes;
+	int n_tasks;
+	int* counts;               /* n_tasks * n_lanes * n_bins */
+} histogram_job_t;
+
+static void
+count_f32(const float* src, int w, int n_bins, int n_lanes, int* lanes)
+{
+	float top_f = (float)(n_bins - 1);
+	int top = n_bins - 1;
+	int i = 0;
+
+	if (n_lanes == HIST_LANES)
+	{
+		for (; i + 4 <= w; i += 4)
+		{
+			lanes[lpgm_sample_bin(src[i], top_f, top)]++;
+			lanes[n_bins + lpgm_sample_bin(src[i + 1], top_f, top)]++;
+			lanes[2 * n_bins + lpgm_sample_bin(src[i + 2], top_f, top)]++;
+			lanes[3 * n_bins + lpgm_sample_bin(src[i + 3], top_f, top)]++;
+		}
+	}
+	for (; i < w; ++i)
+	{
+		lanes[lpgm_sample_bin(src[i], top_f, top)]++;
+	}
+}
+
+static void
+count_u8(const unsigned char* src, int w, int* lanes)
+{
+	int i;
+
+	/* 256 bins always fit the lanes */
+	for (i = 0; i + 4 <= w; i += 4)
+	{
+		lanes[src[i]]++;
+		lanes[256 + src[i + 1]]++;
+		lanes[512 + src[i + 2]]++;
+		lanes[768 + src[i + 3]]++;
+	}
+	for (; i < w; ++i)
+	{
+		lanes[src[i]]++;
+	}
+}
+
+static void
+count_u16(const unsigned short* src, int w, int n_bins, int n_lanes, int* lanes)
+{
+	int top = n_bins - 1;
+	int i = 0;
+
+	if (n_lanes == HIST_LANES)
+	{
+		for (; i + 4 <= w; i += 4)
+		{
+			lanes[(src[i] > top) ? top : src[i]]++;
+			lanes[n_bins + ((src[i + 1] > top) ? top : src[i + 1])]++;
+			lanes[2 * n_bins + ((src[i + 2] > top) ? top : src[i + 2])]++;
+			lanes[3 * n_bins + ((src[i + 3] > top) ? top : src[i + 3])]++;
+		}
+	}
+	for (; i < w; ++i)
+	{
+		lanes[(src[i] > top) ? top : src[i]]++;
+	}
+}
+
+void
+lpgm_count_row_f32(const float* src, int n, int n_bins, int* histogram)
+{
+	count_f32(src, n, n_bins, 1, histogram);
+}
+
+void
+lpgm_count_row_u8(const unsigned char* src, int n, int* histogram)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		histogram[src[i]]++;
+	}
+}
+
+/* Count band index of the image into its own sub-histograms */
+static void
+histogram_task(void* ctx, int index)
+{
+	histogram_job_t* job = (histogram_job_t*)ctx;
+	int* lanes;
+	const unsigned char* row;
+	int x, row_begin, row_end;
+
+	lanes = job->counts + (size_t)index * job->n_lanes * job->n_bins;
+	row_begin = (int)((long long)job->h * index / job->n_tasks);
+	row_end = (int)((long long)job->h * (index + 1) / job->n_tasks);
+
+	for (x = row_begin; x < row_end; ++x)
+	{
+		row = job->data + (size_t)x * job->row_bytes;
+		switch (job->type)
+		{
+		case SAMPLES_F32:
+			count_f32((const float*)row, job->w, job->n_bins, job->n_lanes, lanes);
+			break;
+		case SAMPLES_U8:
+			count_u8(row, job->w, lanes);
+			break;
+		case SAMPLES_U16:
+			count_u16((const unsigned short*)row, job->w, job->n_bins, job->n_lanes, lanes);
+			break;
+		}
+	}
+}
+
+static int
+run_histogram(histogram_job_t* job, int* histogram)
+{
+	int stack_counts[HIST_LANES * 256 * HIST_STACK_TASKS];
+	size_t per_task, n_counts, i;
+	int t;
+
+	job->n_lanes = (job->n_bins <= HIST_LANES_MAX_BINS || job->type == SAMPLES_U8) ? HIST_LANES : 1;
+
+	job->n_tasks = 1;
+	if ((long long)job->w * job->h >= HIST_PARALLEL_MIN)
+	{
+		job->n_tasks = lpgm_get_num_threads();
+		job->n_tasks = (job->n_tasks > job->h) ? job->h : job->n_tasks;
+		job->n_tasks = (job->n_tasks < 1) ? 1 : job->n_tasks;
+	}
+
+	per_task = (size_t)job->n_lanes * job->n_bins;
+	n_counts = per_task * job->n_tasks;
+	if (n_counts <= sizeof(stack_counts) / sizeof(stack_counts[0]))
+	{
+		job->counts = stack_counts;
+		memset(job->counts, 0, n_counts * sizeof(int));
+	}
+	else
+	{
+		job->counts = (int*)lpgm_calloc(n_counts, sizeof(int));
+		if (job->counts == NULL)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+			return -1;
+		}
+	}
+
+	lpgm_parallel_run(job->n_tasks, histogram_task, job);
+
+	/* Merge every lane of every band */
+	memcpy(histogram, job->counts, (size_t)job->n_bins * sizeof(int));
+	for (t = 1; t < job->n_tasks * job->n_lanes; ++t)
+	{
+		const int* lanes = job->counts + (size_t)t * job->n_bins;
+		for (i = 0; i < (size_t)job->n_bins; ++i)
+		{
+			histogram[i] += lanes[i];
+		}
+	}
+
+	if (job->counts != stack_counts)
+	{
+		lpgm_free(job->counts);
+	}
+
+	return 0;
+}
+
+int
+lpgm_count_histogram_f32(const lpgm_image_t* im, int n_bins, int* histogram)
+{
+	histogram_job_t job;
+
+	job.type = SAMPLES_F32;
+	job.data = (const unsigned char*)im->data;
+	job.row_bytes = (size_t)LPGM_STRIDE(im) * sizeof(float);
+	job.w = im->w;
+	job.h = im->h;
+	job.n_bins = n_bins;
+
+	return run_histogram(&job, histogram);
+}
+
+int
+lpgm_count_histogram_u8(const lpgm_image_u8_t* im, int* histogram)
+{
+	histogram_job_t job;
+
+	job.type = SAMPLES_U8;
+	job.data = im->data;
+	job.row_bytes = (size_t)im->stride;
+	job.w = im->w;
+	job.h = im->h;
+	job.n_bins = 256;
+
+	return run_histogram(&job, histogram);
+}
+
+int
+lpgm_count_histogram_u16(const unsigned short* data, int w, int h, int n_bins, int* histogram)
+{
+	histogram_job_t job;
+
+	job.type = SAMPLES_U16;
+	job.data = (const unsigned char*)data;
+	job.row_bytes = (size_t)w * sizeof(unsigned short);
+	job.w = w;
+	job.h = h;
+	job.n_bins = n_bins;
+
+	return run_histogram(&job, histogram);
+}
+
+int
+lpgm_histogram_bins(const lpgm_image_t* im)
+{
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	float min_val, max_val;
+	int x;
+
+	min_val = 0.0f;
+	max_val = 0.0f;
+	for (x = 0; x < im->h; ++x)
+	{
+		kernels->min_max(lpgm_image_row(im, x), im->w, &min_val, &max_val);
+	}
+
+	if (max_val <= 255.0f)
+	{
+		return 256;
+	}
+
+	return (max_val >= 65535.0f) ? 65536 : (int)max_val + 1;
+}
+
+/* ========================================================================
+ * Histogram objects
+ * ======================================================================== */
+
+static lpgm_histogram_t
+null_histogram(void)
+{
+	lpgm_histogram_t hist;
+
+	hist.n_bins = 0;
+	hist.total = 0;
+	hist.counts = NULL;
+
+	return hist;
+}
+
+static int
+histogram_valid(const lpgm_histogram_t* hist, const char* caller)
+{
+	if (hist == NULL || hist->counts == NULL || hist->n_bins <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid histogram.");
+		return 0;
+	}
+
+	return 1;
+}
+
+lpgm_histogram_t
+lpgm_histogram_create(int n_bins)
+{
+	lpgm_histogram_t hist;
+
+	if (n_bins <= 0 || n_bins > 65536)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid number of bins: [%d].", n_bins);
+		return null_histogram();
+	}
+
+	hist.counts = (int*)lpgm_calloc((size_t)n_bins, sizeof(int));
+	if (hist.counts == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		return null_histogram();
+	}
+	hist.n_bins = n_bins;
+	hist.total = 0;
+
+	return hist;
+}
+
+void
+lpgm_histogram_destroy(lpgm_histogram_t* hist)
+{
+	if (hist == NULL)
+	{
+		return;
+	}
+
+	lpgm_free(hist->counts);
+	*hist = null_histogram();
+}
+
+void
+lpgm_histogram_clear(lpgm_histogram_t* hist)
+{
+	if (hist == NULL || hist->counts == NULL)
+	{
+		return;
+	}
+
+	memset(hist->counts, 0, (size_t)hist->n_bins * sizeof(int));
+	hist->total = 0;
+}
+
+lpgm_status_t
+lpgm_histogram_into(const lpgm_image_t* im, lpgm_histogram_t* hist)
+{
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return LPGM_FAIL;
+	}
+	if (!histogram_valid(hist, __func__))
+	{
+		return LPGM_FAIL;
+	}
+
+	if (lpgm_count_histogram_f32(im, hist->n_bins, hist->counts) != 0)
+	{
+		return LPGM_FAIL;
+	}
+	hist->total = im->w * im->h;
+
+	return LPGM_OK;
+}
+
+lpgm_histogram_t
+lpgm_histogram(const lpgm_image_t* im)
+{
+	lpgm_histogram_t hist;
+
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return null_histogram();
+	}
+
+	hist = lpgm_histogram_create(lpgm_histogram_bins(im));
+	if (hist.counts != NULL && lpgm_histogram_into(im, &hist) != LPGM_OK)
+	{
+		lpgm_histogram_destroy(&hist);
+	}
+
+	return hist;
+}
+
+lpgm_status_t
+lpgm_histogram_u8_into(const lpgm_image_u8_t* im, lpgm_histogram_t* hist)
+{
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return LPGM_FAIL;
+	}
+	if (!histogram_valid(hist, __func__))
+	{
+		return LPGM_FAIL;
+	}
+	if (hist->n_bins < 256)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "8-bit data needs 256 bins, histogram has [%d].", hist->n_bins);
+		return LPGM_FAIL;
+	}
+
+	if (lpgm_count_histogram_u8(im, hist->counts) != 0)
+	{
+		return LPGM_FAIL;
+	}
+	memset(hist->counts + 256, 0, (size_t)(hist->n_bins - 256) * sizeof(int));
+	hist->total = im->w * im->h;
+
+	return LPGM_OK;
+}
+
+lpgm_histogram_t
+lpgm_histogram_u8(const lpgm_image_u8_t* im)
+{
+	lpgm_histogram_t hist;
+
+	hist = lpgm_histogram_create(256);
+	if (hist.counts != NULL && lpgm_histogram_u8_into(im, &hist) != LPGM_OK)
+	{
+		lpgm_histogram_destroy(&hist);
+	}
+
+	return hist;
+}
+
+lpgm_status_t
+lpgm_histogram_u16_into(const lpgm_image_u16_t* im, lpgm_histogram_t* hist)
+{
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return LPGM_FAIL;
+	}
+	if (!histogram_valid(hist, __func__))
+	{
+		return LPGM_FAIL;
+	}
+
+	if (lpgm_count_histogram_u16(im->data, im->w, im->h, hist->n_bins, hist->counts) != 0)
+	{
+		return LPGM_FAIL;
+	}
+	hist->total = im->w * im->h;
+
+	return LPGM_OK;
+}
+
+lpgm_histogram_t
+lpgm_histogram_u16(const lpgm_image_u16_t* im, int max_val)
+{
+	lpgm_histogram_t hist;
+
+	if (max_val <= 0 || max_val > 65535)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid max value: [%d].", max_val);
+		return null_histogram();
+	}
+
+	hist = lpgm_histogram_create(max_val + 1);
+	if (hist.counts != NULL && lpgm_histogram_u16_into(im, &hist) != LPGM_OK)
+	{
+		lpgm_histogram_destroy(&hist);
+	}
+
+	return hist;
+}
+
+lpgm_status_t
+lpgm_histogram_merge(lpgm_histogram_t* dst, const lpgm_histogram_t* src)
+{
+	int* counts;
+	int i;
+
+	if (!histogram_valid(src, __func__) || dst == NULL)
+	{
+		return LPGM_FAIL;
+	}
+	if ((dst->counts == NULL) != (dst->n_bins <= 0))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid histogram.");
+		return LPGM_FAIL;
+	}
+	if (src->total > INT_MAX - dst->total)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Sample count overflow.");
+		return LPGM_FAIL;
+	}
+
+	/* Grow dst to the levels of src, e.g. 16-bit tiles into an 8-bit histogram */
+	if (src->n_bins > dst->n_bins)
+	{
+		counts = (int*)lpgm_realloc(dst->counts, (size_t)src->n_bins * sizeof(int));
+		if (counts == NULL)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+			return LPGM_FAIL;
+		}
+		memset(counts + dst->n_bins, 0, (size_t)(src->n_bins - dst->n_bins) * sizeof(int));
+		dst->counts = counts;
+		dst->n_bins = src->n_bins;
+	}
+
+	for (i = 0; i < src->n_bins; ++i)
+	{
+		dst->counts[i] += src->counts[i];
+	}
+	dst->total += src->total;
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_histogram_cdf(const lpgm_histogram_t* hist, float* cdf)
+{
+	long long sum;
+	int i;
+
+	if (!histogram_valid(hist, __func__) || cdf == NULL || hist->total <= 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	sum = 0;
+	for (i = 0; i < hist->n_bins; ++i)
+	{
+		sum += hist->counts[i];
+		cdf[i] = (float)((double)sum / (double)hist->total);
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_histogram_mean_variance(const lpgm_histogram_t* hist, float* mean, float* variance)
+{
+	double sum, sum_sq, m, d;
+	int i;
+
+	if (!histogram_valid(hist, __func__) || hist->total <= 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	sum = 0.0;
+	for (i = 0; i < hist->n_bins; ++i)
+	{
+		sum += (double)i * hist->counts[i];
+	}
+	m = sum / hist->total;
+
+	/* Second pass around the mean, no cancellation for narrow histograms */
+	sum_sq = 0.0;
+	for (i = 0; i < hist->n_bins; ++i)
+	{
+		d = (double)i - m;
+		sum_sq += d * d * hist->counts[i];
+	}
+
+	if (mean != NULL)
+	{
+		*mean = (float)m;
+	}
+	if (variance != NULL)
+	{
+		*variance = (float)(sum_sq / hist->total);
+	}
+
+	return LPGM_OK;
+}
+
+int
+lpgm_histogram_percentile(const lpgm_histogram_t* hist, float percent)
+{
+	long long rank, sum;
+	int i;
+
+	if (!histogram_valid(hist, __func__) || hist->total <= 0)
+	{
+		return -1;
+	}
+	if (!(percent >= 0.0f && percent <= 100.0f))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Percentile out of [0, 100]: [%f].", percent);
+		return -1;
+	}
+
+	/* Nearest rank: the sample of rank ceil(percent / 100 * total), at least the first */
+	rank = (long long)ceil((double)percent / 100.0 * hist->total);
+	rank = (rank < 1) ? 1 : rank;
+
+	sum = 0;
+	for (i = 0; i < hist->n_bins; ++i)
+	{
+		sum += hist->counts[i];
+		if (sum >= rank)
+		{
+			return i;
+		}
+	}
+
+	return hist->n_bins - 1;
+}
+
+int
+lpgm_histogram_otsu(const lpgm_histogram_t* hist)
+{
+	if (!histogram_valid(hist, __func__) || hist->total <= 0)
+	{
+		return -1;
+	}
+
+	return lpgm_otsu_from_histogram(hist->counts, hist->n_bins, hist->total);
+}
+
+/* Between-class term S^2 / P of the levels a .. b from the prefix sums, 0 for an empty class */
+static inline double
+class_term(const double* p_sum, const double* s_sum, int a, int b)
+{
+	double p, s;
+
+	p = p_sum[b + 1] - p_sum[a];
+	s = s_sum[b + 1] - s_sum[a];
+
+	return (p > 0.0) ? s * s / p : 0.0;
+}
+
+/*
+ * Multi-level Otsu
+ *
+ * n thresholds t1 < ... < tn split the levels into n + 1 classes
+ * [0, t1], (t1, t2], ..., (tn, top]. The between-class variance is
+ * sum_k P_k * mu_k^2 - mu^2 = sum_k S_k^2 / P_k - mu^2, where P_k and S_k
+ * (probability and first moment of class k) are differences of two prefix
+ * sums, so every class costs O(1).
+ *
+ * Rather than trying every combination of thresholds (O(L^n)), the best
+ * split is found by dynamic programming over the classes:
+ *   best[k][v] = max over u < v of best[k - 1][u] + term(u + 1, v)
+ * which is O(n * L^2) and exact.
+ */
+lpgm_status_t
+lpgm_histogram_multi_otsu(const lpgm_histogram_t* hist, int n_thresholds, int* thresholds)
+{
+	double* p_sum;       /* p_sum[v]: probability of the levels below v */
+	double* s_sum;       /* s_sum[v]: first moment of the levels below v */
+	double* best;        /* best[k * L + v]: best score of levels 0 .. v split into k + 1 classes */
+	int* split;          /* split[k * L + v]: last level of class k - 1 in that best split */
+	double score, best_score;
+	int n_levels, k, u, v, best_u;
+
+	if (!histogram_valid(hist, __func__) || thresholds == NULL || hist->total <= 0)
+	{
+		return LPGM_FAIL;
+	}
+	if (n_thresholds < 1 || n_thresholds > LPGM_OTSU_MAX_THRESHOLDS)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Number of thresholds must be in [1, %d], got [%d].",
+		         LPGM_OTSU_MAX_THRESHOLDS, n_thresholds);
+		return LPGM_FAIL;
+	}
+	n_levels = hist->n_bins;
+	if (n_levels <= n_thresholds || n_levels > LPGM_OTSU_MAX_LEVELS)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "[%d] bins cannot be split into [%d] classes (at most %d bins).",
+		         n_levels, n_thresholds + 1, LPGM_OTSU_MAX_LEVELS);
+		return LPGM_FAIL;
+	}
+
+	p_sum = (double*)lpgm_malloc(2 * ((size_t)n_levels + 1) * sizeof(double));
+	best = (double*)lpgm_malloc((size_t)(n_thresholds + 1) * n_levels * sizeof(double));
+	split = (int*)lpgm_malloc((size_t)(n_thresholds + 1) * n_levels * sizeof(int));
+	if (p_sum == NULL || best == NULL || split == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		lpgm_free(p_sum);
+		lpgm_free(best);
+		lpgm_free(split);
+		return LPGM_FAIL;
+	}
+	s_sum = p_sum + n_levels + 1;
+
+	p_sum[0] = 0.0;
+	s_sum[0] = 0.0;
+	for (v = 0; v < n_levels; ++v)
+	{
+		p_sum[v + 1] = p_sum[v] + (double)hist->counts[v] / hist->total;
+		s_sum[v + 1] = s_sum[v] + (double)v * hist->counts[v] / hist->total;
+	}
+
+	/* One class */
+	for (v = 0; v < n_levels; ++v)
+	{
+		best[v] = class_term(p_sum, s_sum, 0, v);
+		split[v] = -1;
+	}
+
+	/* k + 1 classes over levels 0 .. v need v >= k; the last class is (u, v] */
+	for (k = 1; k <= n_thresholds; ++k)
+	{
+		for (v = k; v < n_levels; ++v)
+		{
+			best_score = -1.0;
+			best_u = k - 1;
+			for (u = k - 1; u < v; ++u)
+			{
+				score = best[(k - 1) * n_levels + u] + class_term(p_sum, s_sum, u + 1, v);
+				if (score > best_score)
+				{
+					best_score = score;
+					best_u = u;
+				}
+			}
+			best[k * n_levels + v] = best_score;
+			split[k * n_levels + v] = best_u;
+		}
+	}
+
+	/* Walk the splits back from the full range */
+	v = n_levels - 1;
+	for (k = n_thresholds; k >= 1; --k)
+	{
+		v = split[k * n_levels + v];
+		thresholds[k - 1] = v;
+	}
+
+	lpgm_free(p_sum);
+	lpgm_free(best);
+	lpgm_free(split);
+
+	return LPGM_OK;
+}
+
+/* ========================================================================
+ * Incremental updates
+ *
+ * Between two frames only the pixels of the given regions are looked at:
+ * each one whose bin changed moves one count from its old bin to its new
+ * one, so the total stays the same and the cost follows the changed area
+ * rather than the frame size.
+ * ======================================================================== */
+
+/* Same size for the frames and hist usable for them; returns 0, or -1 after logging for caller */
+static int
+check_update(const lpgm_histogram_t* hist, int prev_w, int prev_h, int cur_w, int cur_h, int min_bins,
+             const char* caller)
+{
+	if (!histogram_valid(hist, caller))
+	{
+		return -1;
+	}
+	if (prev_w <= 0 || prev_h <= 0 || prev_w != cur_w || prev_h != cur_h)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Previous frame is [%d x %d], current is [%d x %d].", prev_w, prev_h, cur_w,
+		         cur_h);
+		return -1;
+	}
+	if (hist->n_bins < min_bins)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "8-bit data needs 256 bins, histogram has [%d].", hist->n_bins);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+check_rects(const lpgm_rect_t* rects, int n_rects, int w, int h, const char* caller)
+{
+	int r, s;
+
+	if (n_rects < 0 || (rects == NULL && n_rects > 0))
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid region list.");
+		return -1;
+	}
+	for (r = 0; r < n_rects; ++r)
+	{
+		if (rects[r].row < 0 || rects[r].col < 0 || rects[r].w < 0 || rects[r].h < 0 ||
+		    rects[r].row > h - rects[r].h || rects[r].col > w - rects[r].w)
+		{
+			lpgm_log(LPGM_LOG_ERROR, caller, "Region [%d] (%d, %d, %d x %d) is outside the [%d x %d] frame.", r,
+			         rects[r].row, rects[r].col, rects[r].w, rects[r].h, w, h);
+			return -1;
+		}
+	}
+
+	/* A pixel in two regions would be moved between bins twice; pairwise is cheap for dirty tile lists */
+	for (r = 0; r < n_rects; ++r)
+	{
+		if (rects[r].w == 0 || rects[r].h == 0)
+		{
+			continue;
+		}
+		for (s = r + 1; s < n_rects; ++s)
+		{
+			if (rects[s].w > 0 && rects[s].h > 0 && rects[r].row < rects[s].row + rects[s].h &&
+			    rects[s].row < rects[r].row + rects[r].h && rects[r].col < rects[s].col + rects[s].w &&
+			    rects[s].col < rects[r].col + rects[r].w)
+			{
+				lpgm_log(LPGM_LOG_ERROR, caller, "Regions [%d] and [%d] overlap.", r, s);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void
+update_row_f32(int* counts, const float* prev, const float* cur, const unsigned char* mask, int n, int n_bins)
+{
+	float top_f = (float)(n_bins - 1);
+	int top = n_bins - 1;
+	int i, a, b;
+
+	for (i = 0; i < n; ++i)
+	{
+		if (mask != NULL && mask[i] == 0)
+		{
+			continue;
+		}
+		a = lpgm_sample_bin(prev[i], top_f, top);
+		b = lpgm_sample_bin(cur[i], top_f, top);
+		if (a != b)
+		{
+			counts[a]--;
+			counts[b]++;
+		}
+	}
+}
+
+static void
+update_row_u8(int* counts, const unsigned char* prev, const unsigned char* cur, const unsigned char* mask, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		if ((mask == NULL || mask[i] != 0) && prev[i] != cur[i])
+		{
+			counts[prev[i]]--;
+			counts[cur[i]]++;
+		}
+	}
+}
+
+lpgm_status_t
+lpgm_histogram_update(lpgm_histogram_t* hist, const lpgm_image_t* prev, const lpgm_image_t* cur,
+                      const lpgm_rect_t* rects, int n_rects)
+{
+	int r, y;
+
+	if (prev == NULL || prev->data == NULL || cur == NULL || cur->data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return LPGM_FAIL;
+	}
+	if (check_update(hist, prev->w, prev->h, cur->w, cur->h, 1, __func__) != 0 ||
+	    check_rects(rects, n_rects, cur->w, cur->h, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (r = 0; r < n_rects; ++r)
+	{
+		for (y = rects[r].row; y < rects[r].row + rects[r].h; ++y)
+		{
+			update_row_f32(hist->counts, lpgm_image_row(prev, y) + rects[r].col, lpgm_image_row(cur, y) + rects[r].col,
+			               NULL, rects[r].w, hist->n_bins);
+		}
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_histogram_update_mask(lpgm_histogram_t* hist, const lpgm_image_t* prev, const lpgm_image_t* cur,
+                           const lpgm_image_u8_t* mask)
+{
+	int y;
+
+	if (prev == NULL || prev->data == NULL || cur == NULL || cur->data == NULL || mask == NULL ||
+	    mask->data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image or mask.");
+		return LPGM_FAIL;
+	}
+	if (check_update(hist, prev->w, prev->h, cur->w, cur->h, 1, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+	if (mask->w != cur->w || mask->h != cur->h)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Mask is [%d x %d], frames are [%d x %d].", mask->w, mask->h, cur->w, cur->h);
+		return LPGM_FAIL;
+	}
+
+	for (y = 0; y < cur->h; ++y)
+	{
+		update_row_f32(hist->counts, lpgm_image_row(prev, y), lpgm_image_row(cur, y), LPGM_U8_ROW(mask, y), cur->w,
+		               hist->n_bins);
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_histogram_update_u8(lpgm_histogram_t* hist, const lpgm_image_u8_t* prev, const lpgm_image_u8_t* cur,
+                         const lpgm_rect_t* rects, int n_rects)
+{
+	int r, y;
+
+	if (prev == NULL || prev->data == NULL || cur == NULL || cur->data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return LPGM_FAIL;
+	}
+	if (check_update(hist, prev->w, prev->h, cur->w, cur->h, 256, __func__) != 0 ||
+	    check_rects(rects, n_rects, cur->w, cur->h, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (r = 0; r < n_rects; ++r)
+	{
+		for (y = rects[r].row; y < rects[r].row + rects[r].h; ++y)
+		{
+			update_row_u8(hist->counts, LPGM_U8_ROW(prev, y) + rects[r].col, LPGM_U8_ROW(cur, y) + rects[r].col, NULL,
+			              rects[r].w);
+		}
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_histogram_update_mask_u8(lpgm_histogram_t* hist, const lpgm_image_u8_t* prev, const lpgm_image_u8_t* cur,
+                              const lpgm_image_u8_t* mask)
+{
+	int y;
+
+	if (prev == NULL || prev->data == NULL || cur == NULL || cur->data == NULL || mask == NULL ||
+	    mask->data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image or mask.");
+		return LPGM_FAIL;
+	}
+	if (check_update(hist, prev->w, prev->h, cur->w, cur->h, 256, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+	if (mask->w != cur->w || mask->h != cur->h)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Mask is [%d x %d], frames are [%d x %d].", mask->w, mask->h, cur->w, cur->h);
+		return LPGM_FAIL;
+	}
+
+	for (y = 0; y < cur->h; ++y)
+	{
+		update_row_u8(hist->counts, LPGM_U8_ROW(prev, y), LPGM_U8_ROW(cur, y), LPGM_U8_ROW(mask, y), cur->w);
+	}
+
+	return LPGM_OK;
+}
@@ -1,10 +1,14 @@
-#include "../include/pigiem.h"
+#include "internal.h"
 
+#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* Median windows up to 15x15 live on the stack */
+#define MEDIAN_STACK_WINDOW (15 * 15)
+
 /*
 		y, cols, w, N
 0,0 --------------------->
@@ -19,24 +23,197 @@
 
 */
 
+/*
+ * Rows are padded to a multiple of LPGM_ROW_ALIGN bytes and the buffer is
+ * LPGM_ROW_ALIGN-aligned, so every row starts on a 64-byte boundary and a
+ * SIMD loop can run over the whole stride without a scalar tail.
+ */
 lpgm_image_t
 lpgm_make_empty_image(int w, int h)
 {
 	lpgm_image_t im;
+	size_t size;
+	void* data;
+
+	im = lpgm_null_image();
+	if (w <= 0 || h <= 0)
+	{
+		return im;
+	}
+
+	im.stride = (w + LPGM_ROW_ALIGN_FLOATS - 1) / LPGM_ROW_ALIGN_FLOATS * LPGM_ROW_ALIGN_FLOATS;
+	size = (size_t)im.stride * h * sizeof(float);
+	data = lpgm_aligned_alloc(size);
+	if (data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		im.stride = 0;
+		return im;
+	}
+	memset(data, 0, size);
+
+	im.w = w;
+	im.h = h;
+	im.data = (float*)data;
+
+	return im;
+}
+
+lpgm_image_t
+lpgm_image_roi(const lpgm_image_t* im, int row, int col, int w, int h)
+{
+	lpgm_image_t view;
+
+	view = lpgm_null_image();
+	if (im == NULL || im->data == NULL || row < 0 || col < 0 || w <= 0 || h <= 0 || row + h > im->h || col + w > im->w)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Region [%d, %d] %d x %d is outside the image.", row, col, w, h);
+		return view;
+	}
+
+	view.w = w;
+	view.h = h;
+	view.stride = LPGM_STRIDE(im);
+	view.data = im->data + (size_t)row * view.stride + col;
+	view.is_view = 1;
+
+	return view;
+}
+
+float*
+lpgm_image_row(const lpgm_image_t* im, int row)
+{
+	return im->data + (size_t)row * LPGM_STRIDE(im);
+}
+
+lpgm_image_t
+lpgm_make_image_uninit(int w, int h)
+{
+	lpgm_image_t im;
+	int x;
+	void* data;
+
+	im = lpgm_null_image();
+	if (w <= 0 || h <= 0)
+	{
+		return im;
+	}
+
+	im.stride = (w + LPGM_ROW_ALIGN_FLOATS - 1) / LPGM_ROW_ALIGN_FLOATS * LPGM_ROW_ALIGN_FLOATS;
+	data = lpgm_aligned_alloc((size_t)im.stride * h * sizeof(float));
+	if (data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		im.stride = 0;
+		return im;
+	}
 
 	im.w = w;
 	im.h = h;
-	im.data = (float*)calloc(w * h, sizeof(float));
-	if (im.data == NULL)
+	im.data = (float*)data;
+
+	/* Only the padding is cleared, the pixels are about to be written */
+	if (im.stride > w)
 	{
-		fprintf(stderr, "%s(): Memory allocation failed.\n", __func__);
-		im.w = 0;
-		im.h = 0;
+		for (x = 0; x < h; ++x)
+		{
+			memset(im.data + (size_t)x * im.stride + w, 0, (size_t)(im.stride - w) * sizeof(float));
+		}
 	}
 
 	return im;
 }
 
+/* Result of an operation on im: same size, pixels left for the _into version to fill */
+static lpgm_image_t
+result_like(const lpgm_image_t* im)
+{
+	if (im == NULL || im->data == NULL)
+	{
+		return lpgm_null_image();
+	}
+
+	return lpgm_make_image_uninit(im->w, im->h);
+}
+
+/*
+ * Check the arguments of an _into operation whose result is pad pixels
+ * larger than im on every side (0 for most operations): both images valid
+ * and dst of that size. With may_alias (point operations) dst may be im
+ * itself; otherwise dst must not share memory with im.
+ * Returns 0, or -1 after logging the problem for caller.
+ */
+static int
+check_into_padded(const lpgm_image_t* im, const lpgm_image_t* dst, int pad, int may_alias, const char* caller)
+{
+	const float* im_end;
+	const float* dst_end;
+
+	if (im == NULL || im->data == NULL || dst == NULL || dst->data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid input or destination image.");
+		return -1;
+	}
+
+	if (pad < 0 || pad > (INT_MAX - ((im->w > im->h) ? im->w : im->h)) / 2)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid border size: [%d].", pad);
+		return -1;
+	}
+
+	if (dst->w != im->w + 2 * pad || dst->h != im->h + 2 * pad)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Destination is [%d x %d], expected [%d x %d].", dst->w, dst->h,
+		         im->w + 2 * pad, im->h + 2 * pad);
+		return -1;
+	}
+
+	if (may_alias && dst->data == im->data && LPGM_STRIDE(dst) == LPGM_STRIDE(im))
+	{
+		return 0;
+	}
+
+	im_end = lpgm_image_row(im, im->h - 1) + im->w;
+	dst_end = lpgm_image_row(dst, dst->h - 1) + dst->w;
+	if (dst->data < im_end && im->data < dst_end)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Destination overlaps the input image.");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Same as check_into_padded() for a result of the size of im */
+static int
+check_into(const lpgm_image_t* im, const lpgm_image_t* dst, int may_alias, const char* caller)
+{
+	return check_into_padded(im, dst, 0, may_alias, caller);
+}
+
+lpgm_status_t
+lpgm_copy_image_into(const lpgm_image_t* im, lpgm_image_t* dst)
+{
+	int x;
+
+	if (check_into(im, dst, 1, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (dst->data == im->data)
+	{
+		return LPGM_OK;
+	}
+
+	for (x = 0; x < im->h; ++x)
+	{
+		memcpy(lpgm_image_row(dst, x), lpgm_image_row(im, x), im->w * sizeof(float));
+	}
+
+	return LPGM_OK;
+}
+
 lpgm_image_t
 lpgm_copy_image(const lpgm_image_t* input_im)
 {
@@ -44,43 +221,73 @@ lpgm_copy_image(const lpgm_image_t* input_im)
 
 	if (input_im == NULL || input_im->data == NULL)
 	{
-		fprintf(stderr, "%s(): Invalid input image.\n", __func__);
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		out_im = lpgm_null_image();
 		return out_im;
 	}
 
-	out_im = lpgm_make_empty_image(input_im->w, input_im->h);
-	if (out_im.data == NULL)
+	out_im = lpgm_make_image_uninit(input_im->w, input_im->h);
+	if (out_im.data != NULL)
 	{
-		return out_im;
+		lpgm_copy_image_into(input_im, &out_im);
 	}
 
-	memcpy(out_im.data, input_im->data, input_im->w * input_im->h * sizeof(float));
-
 	return out_im;
 }
 
+/*
+ * Copy im into the middle of dst, which is border_size pixels larger on
+ * every side, and zero the border around it. Samples pass through
+ * unsigned char on the way, as lpgm_border_image() always did.
+ */
+lpgm_status_t
+lpgm_border_image_into(const lpgm_image_t* im, int border_size, lpgm_image_t* dst)
+{
+	const float* src;
+	float* out;
+	int x, y;
+
+	if (check_into_padded(im, dst, border_size, 0, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (x = 0; x < dst->h; ++x)
+	{
+		out = lpgm_image_row(dst, x);
+		if (x < border_size || x >= border_size + im->h)
+		{
+			memset(out, 0, (size_t)dst->w * sizeof(float));
+			continue;
+		}
+
+		src = lpgm_image_row(im, x - border_size);
+		memset(out, 0, (size_t)border_size * sizeof(float));
+		for (y = 0; y < im->w; ++y)
+		{
+			out[border_size + y] = (float)(unsigned char)(int)src[y];
+		}
+		memset(out + border_size + im->w, 0, (size_t)border_size * sizeof(float));
+	}
+
+	return LPGM_OK;
+}
+
 lpgm_image_t
 lpgm_border_image(const lpgm_image_t* input_im, int border_size)
 {
-	int i, j;
-	int out_im_rows, out_im_cols;
-	unsigned char val;
 	lpgm_image_t out_im;
 
-	out_im = lpgm_make_empty_image(input_im->w + 2 * border_size, input_im->h + 2 * border_size);
-	out_im_rows = out_im.h;
-	out_im_cols = out_im.w;
+	if (input_im == NULL || input_im->data == NULL || border_size < 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image or border size.");
+		return lpgm_null_image();
+	}
 
-	for (i = 0; i < out_im_rows; ++i)
+	out_im = lpgm_make_image_uninit(input_im->w + 2 * border_size, input_im->h + 2 * border_size);
+	if (out_im.data != NULL && lpgm_border_image_into(input_im, border_size, &out_im) != LPGM_OK)
 	{
-		for (j = 0; j < out_im_cols; ++j)
-		{
-			val = lpgm_get_pixel_extend_value(input_im, i - border_size, j - border_size);
-			lpgm_set_pixel_value(&out_im, i, j, val);
-		}
+		lpgm_image_destroy(&out_im);
 	}
 
 	return out_im;
@@ -93,16 +300,17 @@ lpgm_image_destroy(lpgm_image_t* im)
 	{
 		return;
 	}
-	free(im->data);
-	im->data = NULL;
-	im->w = 0;
-	im->h = 0;
+	if (!im->is_view)
+	{
+		lpgm_free(im->data);
+	}
+	*im = lpgm_null_image();
 }
 
 float
 lpgm_get_pixel_value(const lpgm_image_t* im, int x, int y)
 {
-	return im->data[x * im->w + y];
+	return im->data[(size_t)x * LPGM_STRIDE(im) + y];
 }
 
 float
@@ -119,23 +327,56 @@ lpgm_get_pixel_extend_value(const lpgm_image_t* im, int x, int y)
 void
 lpgm_set_pixel_value(lpgm_image_t* im, int x, int y, float val)
 {
-	im->data[x * im->w + y] = val;
+	im->data[(size_t)x * LPGM_STRIDE(im) + y] = val;
 }
 
 void
 lpgm_normalize_image_data(lpgm_image_t* im, float new_max)
 {
-	lpgm_normalize_array(im->data, im->w * im->h, new_max);
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	lpgm_point_op_t op = { LPGM_OP_NORMALIZE, new_max, 0.0f };
+	float range[2];
+	int x;
+	float min = 9999999;
+	float max = -999999;
+
+	if (LPGM_STRIDE(im) == im->w)
+	{
+		lpgm_normalize_array(im->data, im->w * im->h, new_max);
+		return;
+	}
+
+	/* Same as lpgm_normalize_array(), row by row so padding is left alone */
+	for (x = 0; x < im->h; ++x)
+	{
+		kernels->min_max(lpgm_image_row(im, x), im->w, &min, &max);
+	}
+
+	if ((max - min) < .000000001)
+	{
+		min = 0.0;
+		max = 1.0;
+	}
+
+	range[0] = min;
+	range[1] = max;
+	for (x = 0; x < im->h; ++x)
+	{
+		kernels->point_ops(lpgm_image_row(im, x), im->w, &op, 1, range);
+	}
 }
 
-lpgm_image_t
-lpgm_filter_image(const lpgm_image_t* im, const float* box_kernel_data, int box_kernel_size)
+lpgm_status_t
+lpgm_filter_image_into(const lpgm_image_t* im, const float* box_kernel_data, int box_kernel_size, lpgm_image_t* dst)
 {
-	lpgm_image_t out_im;
 	float total, kernel_value;
 	int x, y, m, n, im_x, im_y, kernel_x, kernel_y, kernel_move_size;
 
-	out_im = lpgm_make_empty_image(im->w, im->h);
+	if (box_kernel_data == NULL || check_into(im, dst, 0, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
 	kernel_move_size = (int)floor(box_kernel_size / 2);
 
 	for (x = 0; x < im->h; ++x)
@@ -163,10 +404,24 @@ lpgm_filter_image(const lpgm_image_t* im, const float* box_kernel_data, int box_
 				}
 			}
 
-			lpgm_set_pixel_value(&out_im, x, y, total);
+			lpgm_set_pixel_value(dst, x, y, total);
 		}
 	}
 
+	return LPGM_OK;
+}
+
+lpgm_image_t
+lpgm_filter_image(const lpgm_image_t* im, const float* box_kernel_data, int box_kernel_size)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_filter_image_into(im, box_kernel_data, box_kernel_size, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
 	return out_im;
 }
 
@@ -194,32 +449,25 @@ lpgm_clamp(float val, float min, float max)
  * 
  * Formula: out[i] = clamp(in[i] + delta, 0, 255)
  */
+lpgm_status_t
+lpgm_brightness_into(const lpgm_image_t* im, float delta, lpgm_image_t* dst)
+{
+	lpgm_point_op_t op = { LPGM_OP_BRIGHTNESS, delta, 0.0f };
+
+	return lpgm_point_ops_into(im, &op, 1, dst);
+}
+
 lpgm_image_t
 lpgm_brightness(const lpgm_image_t* im, float delta)
 {
-	int i, len;
 	lpgm_image_t out_im;
-	
-	if (im == NULL || im->data == NULL)
-	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
-	}
-	
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
-	{
-		return out_im;
-	}
-	
-	len = im->w * im->h;
-	for (i = 0; i < len; ++i)
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_brightness_into(im, delta, &out_im) != LPGM_OK)
 	{
-		out_im.data[i] = lpgm_clamp(im->data[i] + delta, 0.0f, 255.0f);
+		lpgm_image_destroy(&out_im);
 	}
-	
+
 	return out_im;
 }
 
@@ -234,32 +482,25 @@ lpgm_brightness(const lpgm_image_t* im, float delta)
  * 
  * Formula: out[i] = clamp((in[i] - 128) * factor + 128, 0, 255)
  */
+lpgm_status_t
+lpgm_contrast_into(const lpgm_image_t* im, float factor, lpgm_image_t* dst)
+{
+	lpgm_point_op_t op = { LPGM_OP_CONTRAST, factor, 0.0f };
+
+	return lpgm_point_ops_into(im, &op, 1, dst);
+}
+
 lpgm_image_t
 lpgm_contrast(const lpgm_image_t* im, float factor)
 {
-	int i, len;
 	lpgm_image_t out_im;
-	
-	if (im == NULL || im->data == NULL)
-	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
-	}
-	
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
-	{
-		return out_im;
-	}
-	
-	len = im->w * im->h;
-	for (i = 0; i < len; ++i)
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_contrast_into(im, factor, &out_im) != LPGM_OK)
 	{
-		out_im.data[i] = lpgm_clamp((im->data[i] - 128.0f) * factor + 128.0f, 0.0f, 255.0f);
+		lpgm_image_destroy(&out_im);
 	}
-	
+
 	return out_im;
 }
 
@@ -273,32 +514,25 @@ lpgm_contrast(const lpgm_image_t* im, float factor)
  * 
  * Formula: out[i] = 255 - in[i]
  */
+lpgm_status_t
+lpgm_invert_into(const lpgm_image_t* im, lpgm_image_t* dst)
+{
+	lpgm_point_op_t op = { LPGM_OP_INVERT, 0.0f, 0.0f };
+
+	return lpgm_point_ops_into(im, &op, 1, dst);
+}
+
 lpgm_image_t
 lpgm_invert(const lpgm_image_t* im)
 {
-	int i, len;
 	lpgm_image_t out_im;
-	
-	if (im == NULL || im->data == NULL)
-	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
-	}
-	
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
-	{
-		return out_im;
-	}
-	
-	len = im->w * im->h;
-	for (i = 0; i < len; ++i)
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_invert_into(im, &out_im) != LPGM_OK)
 	{
-		out_im.data[i] = 255.0f - im->data[i];
+		lpgm_image_destroy(&out_im);
 	}
-	
+
 	return out_im;
 }
 
@@ -313,60 +547,81 @@ lpgm_invert(const lpgm_image_t* im)
  * 
  * Formula: out[i] = (in[i] > threshold) ? 255 : 0
  */
+lpgm_status_t
+lpgm_threshold_into(const lpgm_image_t* im, float threshold, lpgm_image_t* dst)
+{
+	lpgm_point_op_t op = { LPGM_OP_THRESHOLD, threshold, 0.0f };
+
+	return lpgm_point_ops_into(im, &op, 1, dst);
+}
+
 lpgm_image_t
 lpgm_threshold(const lpgm_image_t* im, float threshold)
 {
-	int i, len;
 	lpgm_image_t out_im;
-	
-	if (im == NULL || im->data == NULL)
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_threshold_into(im, threshold, &out_im) != LPGM_OK)
 	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		lpgm_image_destroy(&out_im);
 	}
-	
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
+
+	return out_im;
+}
+
+/*
+ * Histogram of im over n_bins levels, samples clamped to [0, n_bins - 1].
+ * 8-bit data is counted into the caller's bins256, so the common case
+ * allocates nothing; a larger histogram is allocated and must be released
+ * with lpgm_free() when it is not bins256.
+ */
+static int*
+float_histogram(const lpgm_image_t* im, int n_bins, int* bins256)
+{
+	int* histogram;
+
+	if (n_bins <= 256)
 	{
-		return out_im;
+		histogram = bins256;
 	}
-	
-	len = im->w * im->h;
-	for (i = 0; i < len; ++i)
+	else
 	{
-		out_im.data[i] = (im->data[i] > threshold) ? 255.0f : 0.0f;
+		histogram = (int*)lpgm_malloc((size_t)n_bins * sizeof(int));
+		if (histogram == NULL)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+			return NULL;
+		}
 	}
-	
-	return out_im;
+
+	if (lpgm_count_histogram_f32(im, n_bins, histogram) != 0)
+	{
+		if (histogram != bins256)
+		{
+			lpgm_free(histogram);
+		}
+		return NULL;
+	}
+
+	return histogram;
 }
 
 /*
- * Otsu's thresholding method
- * 
- * Automatically calculates the optimal threshold value that minimizes 
- * intra-class variance (or equivalently, maximizes inter-class variance).
+ * Otsu threshold of a histogram of len samples over n_bins levels.
+ * Shared by the float and uint16 versions.
  * 
  * Algorithm:
- *   1. Compute histogram of the image
- *   2. For each possible threshold t (0-255):
+ *   For each possible threshold t (0 .. n_bins - 1):
  *      - Calculate weights w0, w1 (probability of each class)
  *      - Calculate means mu0, mu1 (mean of each class)
  *      - Calculate between-class variance: sigma_B^2 = w0 * w1 * (mu0 - mu1)^2
- *   3. Select threshold that maximizes sigma_B^2
- * 
- * Formula: sigma_B^2 = w0 * w1 * (mu0 - mu1)^2
- * 
- * Returns: Binary image thresholded with optimal value
+ *   Select threshold that maximizes sigma_B^2
  */
-lpgm_image_t
-lpgm_otsu_threshold(const lpgm_image_t* im)
+int
+lpgm_otsu_from_histogram(const int* histogram, int n_bins, int len)
 {
-	int i, t;
-	int len;
-	int histogram[256] = {0};
-	float prob[256];
+	int t;
+	float p;               /* Probability of level t */
 	float w0, w1;          /* Class probabilities */
 	float mu0, mu1;        /* Class means */
 	float sum0, sum1;
@@ -374,160 +629,417 @@ lpgm_otsu_threshold(const lpgm_image_t* im)
 	float between_var;     /* Between-class variance */
 	float max_var;
 	int best_threshold;
-	lpgm_image_t out_im;
-	
-	if (im == NULL || im->data == NULL)
-	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
-	}
-	
-	len = im->w * im->h;
-	
-	/* Step 1: Compute histogram */
-	for (i = 0; i < len; ++i)
-	{
-		int pixel = (int)lpgm_clamp(im->data[i], 0.0f, 255.0f);
-		histogram[pixel]++;
-	}
-	
-	/* Compute probability distribution */
-	for (i = 0; i < 256; ++i)
-	{
-		prob[i] = (float)histogram[i] / (float)len;
-	}
-	
+
 	/* Compute total mean (sum of i * prob[i]) */
 	total_sum = 0.0f;
-	for (i = 0; i < 256; ++i)
+	for (t = 0; t < n_bins; ++t)
 	{
-		total_sum += (float)i * prob[i];
+		total_sum += (float)t * ((float)histogram[t] / (float)len);
 	}
-	
-	/* Step 2: Find optimal threshold */
+
 	max_var = 0.0f;
 	best_threshold = 0;
 	w0 = 0.0f;
 	sum0 = 0.0f;
-	
-	for (t = 0; t < 256; ++t)
+
+	for (t = 0; t < n_bins; ++t)
 	{
-		w0 += prob[t];           /* Weight of class 0 */
+		p = (float)histogram[t] / (float)len;
+		w0 += p;                 /* Weight of class 0 */
 		w1 = 1.0f - w0;          /* Weight of class 1 */
-		
-		if (w0 == 0.0f || w1 == 0.0f)
+		sum0 += (float)t * p;
+
+		if (w0 == 0.0f || w1 <= 0.0f)
 		{
-			sum0 += (float)t * prob[t];
 			continue;
 		}
-		
-		sum0 += (float)t * prob[t];
+
 		sum1 = total_sum - sum0;
-		
+
 		mu0 = sum0 / w0;         /* Mean of class 0 */
 		mu1 = sum1 / w1;         /* Mean of class 1 */
-		
+
 		/* Between-class variance: sigma_B^2 = w0 * w1 * (mu0 - mu1)^2 */
 		between_var = w0 * w1 * (mu0 - mu1) * (mu0 - mu1);
-		
+
 		if (between_var > max_var)
 		{
 			max_var = between_var;
 			best_threshold = t;
 		}
 	}
-	
-	fprintf(stdout, "Otsu threshold: %d\n", best_threshold);
-	
-	/* Step 3: Apply threshold */
-	out_im = lpgm_threshold(im, (float)best_threshold);
-	
-	return out_im;
+
+	return best_threshold;
 }
 
 /*
- * Histogram equalization
+ * Otsu's thresholding method
  * 
- * Enhances image contrast by redistributing pixel intensities 
- * to produce a more uniform histogram.
+ * Automatically calculates the optimal threshold value that minimizes 
+ * intra-class variance (or equivalently, maximizes inter-class variance).
+ * 8-bit images use 256 bins; images with samples above 255 (16-bit data)
+ * use one bin per level and are thresholded to [0, largest level].
  * 
- * Algorithm:
- *   1. Compute histogram h[i] for i = 0..255
- *   2. Compute cumulative distribution function: CDF[i] = sum(h[0..i]) / total_pixels
- *   3. Map each pixel: out[i] = round(CDF[in[i]] * 255)
+ * Formula: sigma_B^2 = w0 * w1 * (mu0 - mu1)^2
  * 
- * Formula: out = round((CDF[in] - CDF_min) / (1 - CDF_min) * 255)
- *          where CDF_min is the minimum non-zero CDF value
+ * Returns: Binary image thresholded with optimal value; the threshold goes
+ * to *out_threshold (may be NULL)
  */
-lpgm_image_t
-lpgm_histogram_equalization(const lpgm_image_t* im)
+lpgm_status_t
+lpgm_otsu_threshold_into(const lpgm_image_t* im, int* out_threshold, lpgm_image_t* dst)
 {
-	int i;
-	int len;
-	int histogram[256] = {0};
-	float cdf[256];
-	float cdf_min;
-	int pixel;
-	lpgm_image_t out_im;
+	int x, i;
+	const float* src;
+	float* out;
+	int n_bins;
+	int bins256[256];
+	int* histogram;
+	int best_threshold;
+	float top;
 	
-	if (im == NULL || im->data == NULL)
+	if (check_into(im, dst, 1, __func__) != 0)
 	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		return LPGM_FAIL;
 	}
 	
-	len = im->w * im->h;
-	
 	/* Step 1: Compute histogram */
-	for (i = 0; i < len; ++i)
+	n_bins = lpgm_histogram_bins(im);
+	histogram = float_histogram(im, n_bins, bins256);
+	if (histogram == NULL)
 	{
-		pixel = (int)lpgm_clamp(im->data[i], 0.0f, 255.0f);
-		histogram[pixel]++;
+		return LPGM_FAIL;
 	}
 	
-	/* Step 2: Compute CDF (Cumulative Distribution Function) */
-	cdf[0] = (float)histogram[0] / (float)len;
-	for (i = 1; i < 256; ++i)
+	/* Step 2: Find optimal threshold */
+	best_threshold = lpgm_otsu_from_histogram(histogram, n_bins, im->w * im->h);
+	if (histogram != bins256)
 	{
-		cdf[i] = cdf[i - 1] + (float)histogram[i] / (float)len;
+		lpgm_free(histogram);
 	}
 	
+	lpgm_log(LPGM_LOG_INFO, __func__, "Otsu threshold: %d", best_threshold);
+	if (out_threshold != NULL)
+	{
+		*out_threshold = best_threshold;
+	}
+	
+	/* Step 3: Apply threshold, to the largest level for 16-bit data */
+	if (n_bins == 256)
+	{
+		return lpgm_threshold_into(im, (float)best_threshold, dst);
+	}
+	
+	top = (float)(n_bins - 1);
+	for (x = 0; x < im->h; ++x)
+	{
+		src = lpgm_image_row(im, x);
+		out = lpgm_image_row(dst, x);
+		for (i = 0; i < im->w; ++i)
+		{
+			out[i] = (src[i] > (float)best_threshold) ? top : 0.0f;
+		}
+	}
+	
+	return LPGM_OK;
+}
+
+int
+lpgm_otsu_threshold_value(const lpgm_image_t* im)
+{
+	int n_bins;
+	int bins256[256];
+	int* histogram;
+	int best_threshold;
+
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return -1;
+	}
+
+	n_bins = lpgm_histogram_bins(im);
+	histogram = float_histogram(im, n_bins, bins256);
+	if (histogram == NULL)
+	{
+		return -1;
+	}
+
+	best_threshold = lpgm_otsu_from_histogram(histogram, n_bins, im->w * im->h);
+	if (histogram != bins256)
+	{
+		lpgm_free(histogram);
+	}
+
+	return best_threshold;
+}
+
+lpgm_status_t
+lpgm_multi_otsu_thresholds(const lpgm_image_t* im, int n_thresholds, int* thresholds)
+{
+	int bins256[256];
+	lpgm_histogram_t hist;
+	lpgm_status_t status;
+
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return LPGM_FAIL;
+	}
+
+	hist.n_bins = lpgm_histogram_bins(im);
+	hist.total = im->w * im->h;
+	hist.counts = float_histogram(im, hist.n_bins, bins256);
+	if (hist.counts == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	status = lpgm_histogram_multi_otsu(&hist, n_thresholds, thresholds);
+	if (hist.counts != bins256)
+	{
+		lpgm_free(hist.counts);
+	}
+
+	return status;
+}
+
+lpgm_image_t
+lpgm_otsu_threshold_ex(const lpgm_image_t* im, int* out_threshold)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_otsu_threshold_into(im, out_threshold, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+lpgm_image_t
+lpgm_otsu_threshold(const lpgm_image_t* im)
+{
+	return lpgm_otsu_threshold_ex(im, NULL);
+}
+
+/*
+ * Equalization mapping of a histogram of len samples over n_bins levels:
+ * lut[v] = (CDF[v] - CDF_min) / (1 - CDF_min) * top, clamped to [0, top].
+ * Shared by the float and uint16 versions.
+ * Returns 0, or 1 if the image is flat (CDF_min == 1) and must be copied as is.
+ */
+int
+lpgm_equalization_lut(const int* histogram, int n_bins, int len, float top, float* lut)
+{
+	int i;
+	float cdf;
+	float cdf_min;
+
 	/* Find minimum non-zero CDF value */
 	cdf_min = 0.0f;
-	for (i = 0; i < 256; ++i)
+	cdf = 0.0f;
+	for (i = 0; i < n_bins; ++i)
 	{
-		if (cdf[i] > 0.0f)
+		cdf += (float)histogram[i] / (float)len;
+		if (cdf > 0.0f)
 		{
-			cdf_min = cdf[i];
+			cdf_min = cdf;
 			break;
 		}
 	}
-	
-	/* Step 3: Create equalized image */
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
+
+	if (cdf_min >= 1.0f)
 	{
-		return out_im;
+		return 1;
 	}
-	
-	for (i = 0; i < len; ++i)
+
+	/* CDF (Cumulative Distribution Function) mapped straight to output levels */
+	cdf = 0.0f;
+	for (i = 0; i < n_bins; ++i)
+	{
+		cdf += (float)histogram[i] / (float)len;
+		lut[i] = lpgm_clamp(((cdf - cdf_min) / (1.0f - cdf_min)) * top, 0.0f, top);
+	}
+
+	return 0;
+}
+
+/*
+ * Histogram equalization
+ * 
+ * Enhances image contrast by redistributing pixel intensities 
+ * to produce a more uniform histogram.
+ * 
+ * Algorithm:
+ *   1. Compute histogram h[i] for i = 0..255 (0..largest level for 16-bit data)
+ *   2. Compute cumulative distribution function: CDF[i] = sum(h[0..i]) / total_pixels
+ *   3. Build a lookup table once per level, then map each pixel through it
+ * 
+ * Formula: out = (CDF[in] - CDF_min) / (1 - CDF_min) * top
+ *          where CDF_min is the minimum non-zero CDF value and
+ *          top is 255 (or the largest level for 16-bit data)
+ */
+/* Map im through the equalization table of histogram into dst */
+static lpgm_status_t
+equalize_into(const lpgm_image_t* im, const int* histogram, int n_bins, int len, lpgm_image_t* dst)
+{
+	int x, i;
+	int flat;
+	const float* src;
+	float* out;
+	float lut256[256];
+	float* lut;
+	float top;
+
+	top = (float)(n_bins - 1);
+	lut = (n_bins <= 256) ? lut256 : (float*)lpgm_malloc(n_bins * sizeof(float));
+	if (lut == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		return LPGM_FAIL;
+	}
+
+	flat = lpgm_equalization_lut(histogram, n_bins, len, top, lut);
+	for (x = 0; x < im->h; ++x)
 	{
-		pixel = (int)lpgm_clamp(im->data[i], 0.0f, 255.0f);
-		/* Equalization formula: (cdf[v] - cdf_min) / (1 - cdf_min) * 255 */
-		if (cdf_min < 1.0f)
+		src = lpgm_image_row(im, x);
+		out = lpgm_image_row(dst, x);
+		if (flat)
 		{
-			out_im.data[i] = lpgm_clamp(((cdf[pixel] - cdf_min) / (1.0f - cdf_min)) * 255.0f, 0.0f, 255.0f);
+			if (out != src)
+			{
+				memcpy(out, src, im->w * sizeof(float));
+			}
+			continue;
 		}
-		else
+		for (i = 0; i < im->w; ++i)
 		{
-			out_im.data[i] = im->data[i];
+			out[i] = lut[(int)lpgm_clamp(src[i], 0.0f, top)];
 		}
 	}
+
+	if (lut != lut256)
+	{
+		lpgm_free(lut);
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_histogram_equalization_into(const lpgm_image_t* im, lpgm_image_t* dst)
+{
+	int n_bins;
+	int bins256[256];
+	int* histogram;
+	lpgm_status_t status;
 	
+	if (check_into(im, dst, 1, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+	
+	/* Step 1: Compute histogram */
+	n_bins = lpgm_histogram_bins(im);
+	histogram = float_histogram(im, n_bins, bins256);
+	if (histogram == NULL)
+	{
+		return LPGM_FAIL;
+	}
+	
+	/* Step 2 and 3: Map each pixel through the equalization table */
+	status = equalize_into(im, histogram, n_bins, im->w * im->h, dst);
+	
+	if (histogram != bins256)
+	{
+		lpgm_free(histogram);
+	}
+	
+	return status;
+}
+
+/*
+ * Contrast-limited adaptive histogram equalization, see clahe.c.
+ * Levels as lpgm_histogram_equalization(): 256 for 8-bit data, one per level
+ * up to the largest sample for 16-bit data.
+ */
+lpgm_status_t
+lpgm_clahe_into(const lpgm_image_t* im, int tiles_x, int tiles_y, float clip_limit, lpgm_image_t* dst)
+{
+	if (check_into(im, dst, 1, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (lpgm_clahe_run(im, NULL, tiles_x, tiles_y, clip_limit, dst, NULL, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_image_t
+lpgm_clahe(const lpgm_image_t* im, int tiles_x, int tiles_y, float clip_limit)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_clahe_into(im, tiles_x, tiles_y, clip_limit, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+/*
+ * Histogram equalization with a histogram computed beforehand, e.g. shared
+ * with lpgm_histogram_otsu() or merged over several frames. Samples are
+ * clamped to the bins of hist.
+ */
+lpgm_status_t
+lpgm_histogram_equalization_from_into(const lpgm_image_t* im, const lpgm_histogram_t* hist, lpgm_image_t* dst)
+{
+	if (check_into(im, dst, 1, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+	if (hist == NULL || hist->counts == NULL || hist->n_bins <= 0 || hist->total <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid histogram.");
+		return LPGM_FAIL;
+	}
+
+	return equalize_into(im, hist->counts, hist->n_bins, hist->total, dst);
+}
+
+lpgm_image_t
+lpgm_histogram_equalization_from(const lpgm_image_t* im, const lpgm_histogram_t* hist)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_histogram_equalization_from_into(im, hist, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+lpgm_image_t
+lpgm_histogram_equalization(const lpgm_image_t* im)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_histogram_equalization_into(im, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
 	return out_im;
 }
 
@@ -547,70 +1059,93 @@ lpgm_histogram_equalization(const lpgm_image_t* im)
  * 
  * Returns: Edge magnitude image (higher values = stronger edges)
  */
-lpgm_image_t
-lpgm_sobel(const lpgm_image_t* im)
+static const float sobel_gx[9] = {
+	-1.0f, 0.0f, 1.0f,
+	-2.0f, 0.0f, 2.0f,
+	-1.0f, 0.0f, 1.0f
+};
+static const float sobel_gy[9] = {
+	-1.0f, -2.0f, -1.0f,
+	 0.0f,  0.0f,  0.0f,
+	 1.0f,  2.0f,  1.0f
+};
+
+/* Sobel magnitude at (x, y), border pixels read as 0 */
+static float
+sobel_pixel(const lpgm_image_t* im, int x, int y)
 {
-	int x, y;
 	int i, j;
 	float gx, gy, magnitude;
 	float pixel;
-	lpgm_image_t out_im;
-	
-	/* Sobel kernels */
-	const float sobel_gx[9] = {
-		-1.0f, 0.0f, 1.0f,
-		-2.0f, 0.0f, 2.0f,
-		-1.0f, 0.0f, 1.0f
-	};
-	const float sobel_gy[9] = {
-		-1.0f, -2.0f, -1.0f,
-		 0.0f,  0.0f,  0.0f,
-		 1.0f,  2.0f,  1.0f
-	};
-	
-	if (im == NULL || im->data == NULL)
+
+	gx = 0.0f;
+	gy = 0.0f;
+
+	/* Convolve with 3x3 Sobel kernels */
+	for (i = -1; i <= 1; ++i)
 	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		for (j = -1; j <= 1; ++j)
+		{
+			/* Use lpgm_get_pixel_extend_value for border handling (returns 0) */
+			pixel = lpgm_get_pixel_extend_value(im, x + i, y + j);
+
+			/* Kernel index: (i+1)*3 + (j+1) */
+			gx += pixel * sobel_gx[(i + 1) * 3 + (j + 1)];
+			gy += pixel * sobel_gy[(i + 1) * 3 + (j + 1)];
+		}
 	}
-	
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
+
+	/* Gradient magnitude: G = sqrt(Gx^2 + Gy^2) */
+	magnitude = sqrtf(gx * gx + gy * gy);
+
+	return lpgm_clamp(magnitude, 0.0f, 255.0f);
+}
+
+/* Inner pixels go through the sobel_row kernel, the one-pixel border through sobel_pixel() */
+lpgm_status_t
+lpgm_sobel_into(const lpgm_image_t* im, lpgm_image_t* dst)
+{
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	float* out;
+	int x, y;
+
+	if (check_into(im, dst, 0, __func__) != 0)
 	{
-		return out_im;
+		return LPGM_FAIL;
 	}
-	
-	/* Apply Sobel operator to each pixel */
+
 	for (x = 0; x < im->h; ++x)
 	{
-		for (y = 0; y < im->w; ++y)
+		out = lpgm_image_row(dst, x);
+		if (x == 0 || x == im->h - 1 || im->w < 3)
 		{
-			gx = 0.0f;
-			gy = 0.0f;
-			
-			/* Convolve with 3x3 Sobel kernels */
-			for (i = -1; i <= 1; ++i)
+			for (y = 0; y < im->w; ++y)
 			{
-				for (j = -1; j <= 1; ++j)
-				{
-					/* Use lpgm_get_pixel_extend_value for border handling (returns 0) */
-					pixel = lpgm_get_pixel_extend_value(im, x + i, y + j);
-					
-					/* Kernel index: (i+1)*3 + (j+1) */
-					gx += pixel * sobel_gx[(i + 1) * 3 + (j + 1)];
-					gy += pixel * sobel_gy[(i + 1) * 3 + (j + 1)];
-				}
+				out[y] = sobel_pixel(im, x, y);
 			}
-			
-			/* Gradient magnitude: G = sqrt(Gx^2 + Gy^2) */
-			magnitude = sqrtf(gx * gx + gy * gy);
-			
-			lpgm_set_pixel_value(&out_im, x, y, lpgm_clamp(magnitude, 0.0f, 255.0f));
+			continue;
 		}
+
+		out[0] = sobel_pixel(im, x, 0);
+		kernels->sobel_row(out + 1, lpgm_image_row(im, x - 1) + 1, lpgm_image_row(im, x) + 1,
+		                   lpgm_image_row(im, x + 1) + 1, im->w - 2);
+		out[im->w - 1] = sobel_pixel(im, x, im->w - 1);
 	}
-	
+
+	return LPGM_OK;
+}
+
+lpgm_image_t
+lpgm_sobel(const lpgm_image_t* im)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_sobel_into(im, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
 	return out_im;
 }
 
@@ -629,60 +1164,105 @@ lpgm_sobel(const lpgm_image_t* im)
  * Zero-padding: Pixels outside image boundaries are treated as 0.
  * ============================================================================
  */
-lpgm_image_t
-lpgm_convolve(const lpgm_image_t* im, const float* kernel, int ksize)
+/* Convolution at (x, y), pixels outside the image read as 0 */
+static float
+convolve_pixel(const lpgm_image_t* im, int x, int y, const float* kernel, int ksize)
 {
-	int x, y, i, j;
-	int half;
+	int i, j, half;
 	float sum, pixel;
-	lpgm_image_t out_im;
+
+	half = ksize / 2;
+	sum = 0.0f;
+	for (i = -half; i <= half; ++i)
+	{
+		for (j = -half; j <= half; ++j)
+		{
+			/* Zero-padding: lpgm_get_pixel_extend_value returns 0 for out-of-bounds */
+			pixel = lpgm_get_pixel_extend_value(im, x + i, y + j);
+			sum += pixel * kernel[(i + half) * ksize + (j + half)];
+		}
+	}
+
+	return lpgm_clamp(sum, 0.0f, 255.0f);
+}
+
+/*
+ * Columns whose window is inside the image are accumulated in dst one tap
+ * at a time (axpy kernel), in the same tap order as convolve_pixel(); rows
+ * outside the image only add zeros and are skipped. The half-kernel wide
+ * left and right borders go through convolve_pixel().
+ */
+lpgm_status_t
+lpgm_convolve_into(const lpgm_image_t* im, const float* kernel, int ksize, lpgm_image_t* dst)
+{
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	int x, y, i, j, n;
+	int half;
+	const float* src;
+	float* out;
 	
-	if (im == NULL || im->data == NULL || kernel == NULL)
+	if (kernel == NULL || check_into(im, dst, 0, __func__) != 0)
 	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		return LPGM_FAIL;
 	}
 	
 	/* Kernel size must be odd */
 	if (ksize < 1 || ksize % 2 == 0)
 	{
-		fprintf(stderr, "%s(): Kernel size must be odd (3, 5, 7, ...).\n", __func__);
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Kernel size must be odd (3, 5, 7, ...).");
+		return LPGM_FAIL;
 	}
 	
 	half = ksize / 2;
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
-	{
-		return out_im;
-	}
-	
-	/* Apply convolution to each pixel */
+	n = im->w - 2 * half;
 	for (x = 0; x < im->h; ++x)
 	{
-		for (y = 0; y < im->w; ++y)
+		out = lpgm_image_row(dst, x);
+		if (n <= 0)
 		{
-			sum = 0.0f;
-			
-			for (i = -half; i <= half; ++i)
+			for (y = 0; y < im->w; ++y)
 			{
-				for (j = -half; j <= half; ++j)
-				{
-					/* Zero-padding: lpgm_get_pixel_extend_value returns 0 for out-of-bounds */
-					pixel = lpgm_get_pixel_extend_value(im, x + i, y + j);
-					sum += pixel * kernel[(i + half) * ksize + (j + half)];
-				}
+				out[y] = convolve_pixel(im, x, y, kernel, ksize);
 			}
-			
-			lpgm_set_pixel_value(&out_im, x, y, lpgm_clamp(sum, 0.0f, 255.0f));
+			continue;
+		}
+
+		memset(out + half, 0, (size_t)n * sizeof(float));
+		for (i = -half; i <= half; ++i)
+		{
+			if (x + i < 0 || x + i >= im->h)
+			{
+				continue;
+			}
+			src = lpgm_image_row(im, x + i);
+			for (j = -half; j <= half; ++j)
+			{
+				kernels->axpy(out + half, src + half + j, kernel[(i + half) * ksize + (j + half)], n);
+			}
+		}
+		kernels->clamp(out + half, n, 0.0f, 255.0f);
+
+		for (y = 0; y < half; ++y)
+		{
+			out[y] = convolve_pixel(im, x, y, kernel, ksize);
+			out[im->w - 1 - y] = convolve_pixel(im, x, im->w - 1 - y, kernel, ksize);
 		}
 	}
 	
+	return LPGM_OK;
+}
+
+lpgm_image_t
+lpgm_convolve(const lpgm_image_t* im, const float* kernel, int ksize)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_convolve_into(im, kernel, ksize, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
 	return out_im;
 }
 
@@ -700,52 +1280,40 @@ lpgm_convolve(const lpgm_image_t* im, const float* kernel, int ksize)
  * Zero-padding: Pixels outside image boundaries are treated as 0.
  * ============================================================================
  */
-lpgm_image_t
-lpgm_median_filter(const lpgm_image_t* im, int ksize)
+lpgm_status_t
+lpgm_median_filter_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst)
 {
 	int x, y, i, j, k, m;
 	int half, window_size, median_idx;
+	float window_small[MEDIAN_STACK_WINDOW];
 	float* window;
 	float temp;
-	lpgm_image_t out_im;
 	
-	if (im == NULL || im->data == NULL)
+	if (check_into(im, dst, 0, __func__) != 0)
 	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		return LPGM_FAIL;
 	}
 	
 	/* Kernel size must be odd */
 	if (ksize < 1 || ksize % 2 == 0)
 	{
-		fprintf(stderr, "%s(): Kernel size must be odd (3, 5, 7, ...).\n", __func__);
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Kernel size must be odd (3, 5, 7, ...).");
+		return LPGM_FAIL;
 	}
 	
 	half = ksize / 2;
 	window_size = ksize * ksize;
 	median_idx = window_size / 2;
 	
-	window = (float*)malloc(window_size * sizeof(float));
-	if (window == NULL)
+	window = window_small;
+	if (window_size > MEDIAN_STACK_WINDOW)
 	{
-		fprintf(stderr, "%s(): Memory allocation failed.\n", __func__);
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
-	}
-	
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
-	{
-		free(window);
-		return out_im;
+		window = (float*)lpgm_malloc(window_size * sizeof(float));
+		if (window == NULL)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+			return LPGM_FAIL;
+		}
 	}
 	
 	/* Apply median filter to each pixel */
@@ -776,11 +1344,28 @@ lpgm_median_filter(const lpgm_image_t* im, int ksize)
 				window[m + 1] = temp;
 			}
 			
-			lpgm_set_pixel_value(&out_im, x, y, window[median_idx]);
+			lpgm_set_pixel_value(dst, x, y, window[median_idx]);
 		}
 	}
 	
-	free(window);
+	if (window != window_small)
+	{
+		lpgm_free(window);
+	}
+	return LPGM_OK;
+}
+
+lpgm_image_t
+lpgm_median_filter(const lpgm_image_t* im, int ksize)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_median_filter_into(im, ksize, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
 	return out_im;
 }
 
@@ -798,31 +1383,21 @@ lpgm_median_filter(const lpgm_image_t* im, int ksize)
  * Returns a new image with noise added.
  * ============================================================================
  */
-lpgm_image_t
-lpgm_add_salt_pepper_noise(const lpgm_image_t* im, float density)
+lpgm_status_t
+lpgm_add_salt_pepper_noise_into(const lpgm_image_t* im, float density, lpgm_image_t* dst)
 {
 	int total_pixels, num_noisy;
 	int i, idx;
 	float rand_val;
-	lpgm_image_t out_im;
 	
-	if (im == NULL || im->data == NULL)
+	if (lpgm_copy_image_into(im, dst) != LPGM_OK)
 	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		return LPGM_FAIL;
 	}
 	
 	if (density < 0.0f) density = 0.0f;
 	if (density > 1.0f) density = 1.0f;
 	
-	out_im = lpgm_copy_image(im);
-	if (out_im.data == NULL)
-	{
-		return out_im;
-	}
-	
 	total_pixels = im->w * im->h;
 	num_noisy = (int)(total_pixels * density);
 	
@@ -831,9 +1406,23 @@ lpgm_add_salt_pepper_noise(const lpgm_image_t* im, float density)
 	{
 		idx = rand() % total_pixels;
 		rand_val = (rand() % 2 == 0) ? 0.0f : 255.0f;
-		out_im.data[idx] = rand_val;
+		lpgm_set_pixel_value(dst, idx / im->w, idx % im->w, rand_val);
 	}
 	
+	return LPGM_OK;
+}
+
+lpgm_image_t
+lpgm_add_salt_pepper_noise(const lpgm_image_t* im, float density)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_add_salt_pepper_noise_into(im, density, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
 	return out_im;
 }
 
@@ -852,47 +1441,178 @@ lpgm_add_salt_pepper_noise(const lpgm_image_t* im, float density)
  *           gamma = 1: no change
  * ============================================================================
  */
+lpgm_status_t
+lpgm_gamma_into(const lpgm_image_t* im, float gamma, lpgm_image_t* dst)
+{
+	lpgm_point_op_t op = { LPGM_OP_GAMMA, gamma, 0.0f };
+
+	return lpgm_point_ops_into(im, &op, 1, dst);
+}
+
 lpgm_image_t
 lpgm_gamma(const lpgm_image_t* im, float gamma)
 {
-	int x, y;
-	float normalized, corrected;
 	lpgm_image_t out_im;
-	
-	if (im == NULL || im->data == NULL)
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_gamma_into(im, gamma, &out_im) != LPGM_OK)
 	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		lpgm_image_destroy(&out_im);
 	}
-	
-	if (gamma <= 0.0f)
+
+	return out_im;
+}
+
+
+/*
+ * ============================================================================
+ * Fused Point Operations
+ * ============================================================================
+ * Runs a chain of point operations in one pass: each row is copied to dst a
+ * block of POINT_OPS_BLOCK pixels at a time and every operation runs over
+ * that block while it is in L1, one vectorized loop per operation (the
+ * point_ops kernel, see kernels.h). Memory sees a single read and a single write per pixel,
+ * against one of each per operation when the functions above are chained.
+ *
+ * The formulas are those of the single operations, so the result is the
+ * same as calling them one after another. LPGM_OP_NORMALIZE needs the range
+ * of its input, which costs one extra read-only pass over im per normalize.
+ * ============================================================================
+ */
+
+/* Pixels per block: 4 KB of floats, well inside L1 */
+#define POINT_OPS_BLOCK 1024
+
+/* Returns 0 if every operation is known and its parameters valid, otherwise -1 */
+static int
+check_point_ops(const lpgm_point_op_t* ops, int n_ops, const char* caller)
+{
+	int k;
+
+	if (n_ops < 0 || n_ops > LPGM_POINT_OPS_MAX || (ops == NULL && n_ops > 0))
 	{
-		fprintf(stderr, "%s(): Gamma must be positive.\n", __func__);
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid operation count: [%d], at most [%d].", n_ops, LPGM_POINT_OPS_MAX);
+		return -1;
 	}
-	
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
+
+	for (k = 0; k < n_ops; ++k)
 	{
-		return out_im;
+		switch (ops[k].type)
+		{
+		case LPGM_OP_BRIGHTNESS:
+		case LPGM_OP_CONTRAST:
+		case LPGM_OP_INVERT:
+		case LPGM_OP_THRESHOLD:
+		case LPGM_OP_NORMALIZE:
+			break;
+		case LPGM_OP_GAMMA:
+			if (ops[k].a <= 0.0f)
+			{
+				lpgm_log(LPGM_LOG_ERROR, caller, "Gamma must be positive (operation [%d]).", k);
+				return -1;
+			}
+			break;
+		case LPGM_OP_CLAMP:
+			if (ops[k].a > ops[k].b)
+			{
+				lpgm_log(LPGM_LOG_ERROR, caller, "Clamp range [%f, %f] is empty (operation [%d]).", ops[k].a, ops[k].b, k);
+				return -1;
+			}
+			break;
+		default:
+			lpgm_log(LPGM_LOG_ERROR, caller, "Unknown operation type: [%d] (operation [%d]).", (int)ops[k].type, k);
+			return -1;
+		}
 	}
-	
+
+	return 0;
+}
+
+/* Min and max of im after ops[0 .. n_ops - 1], without writing anything */
+static void
+point_ops_range(const lpgm_image_t* im, const lpgm_point_op_t* ops, int n_ops, const float* ranges, float* out_min, float* out_max)
+{
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	float block[POINT_OPS_BLOCK];
+	float min, max;
+	int x, i, n;
+
+	/* Not a raw pixel: ops may move every value out of the input range */
+	min = FLT_MAX;
+	max = -FLT_MAX;
 	for (x = 0; x < im->h; ++x)
 	{
-		for (y = 0; y < im->w; ++y)
+		for (i = 0; i < im->w; i += n)
 		{
-			/* Normalize to [0, 1], apply gamma, scale back to [0, 255] */
-			normalized = lpgm_get_pixel_value(im, x, y) / 255.0f;
-			corrected = 255.0f * powf(normalized, gamma);
-			lpgm_set_pixel_value(&out_im, x, y, lpgm_clamp(corrected, 0.0f, 255.0f));
+			n = (im->w - i < POINT_OPS_BLOCK) ? im->w - i : POINT_OPS_BLOCK;
+			memcpy(block, lpgm_image_row(im, x) + i, (size_t)n * sizeof(float));
+			kernels->point_ops(block, n, ops, n_ops, ranges);
+			kernels->min_max(block, n, &min, &max);
 		}
 	}
-	
+
+	*out_min = min;
+	*out_max = max;
+}
+
+lpgm_status_t
+lpgm_point_ops_into(const lpgm_image_t* im, const lpgm_point_op_t* ops, int n_ops, lpgm_image_t* dst)
+{
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	float ranges[2 * LPGM_POINT_OPS_MAX];
+	const float* src;
+	float* out;
+	int k, x, i, n;
+
+	if (check_into(im, dst, 1, __func__) != 0 || check_point_ops(ops, n_ops, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	/* The range of a normalize's input depends on the operations before it */
+	for (k = 0; k < n_ops; ++k)
+	{
+		if (ops[k].type != LPGM_OP_NORMALIZE)
+		{
+			continue;
+		}
+		point_ops_range(im, ops, k, ranges, &ranges[2 * k], &ranges[2 * k + 1]);
+		if ((ranges[2 * k + 1] - ranges[2 * k]) < .000000001)
+		{
+			ranges[2 * k] = 0.0f;
+			ranges[2 * k + 1] = 1.0f;
+		}
+	}
+
+	for (x = 0; x < im->h; ++x)
+	{
+		src = lpgm_image_row(im, x);
+		out = lpgm_image_row(dst, x);
+		for (i = 0; i < im->w; i += n)
+		{
+			n = (im->w - i < POINT_OPS_BLOCK) ? im->w - i : POINT_OPS_BLOCK;
+			if (out != src)
+			{
+				memcpy(out + i, src + i, (size_t)n * sizeof(float));
+			}
+			kernels->point_ops(out + i, n, ops, n_ops, ranges);
+		}
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_image_t
+lpgm_point_ops(const lpgm_image_t* im, const lpgm_point_op_t* ops, int n_ops)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_point_ops_into(im, ops, n_ops, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
 	return out_im;
 }
 
@@ -905,63 +1625,120 @@ lpgm_gamma(const lpgm_image_t* im, float gamma)
  */
 
 /*
- * Erosion - shrinks white regions, removes small white spots
- * Output pixel = minimum value in NxN neighborhood
+ * Min (take_max = 0) or max (take_max = 1) of the NxN neighborhood at (x, y),
+ * starting from 255 or 0; pixels outside the image read as 0.
  */
-lpgm_image_t
-lpgm_erode(const lpgm_image_t* im, int ksize)
+static float
+rank_pixel(const lpgm_image_t* im, int x, int y, int half, int take_max)
 {
-	int x, y, i, j;
-	int half;
-	float min_val, pixel;
-	lpgm_image_t out_im;
-	
-	if (im == NULL || im->data == NULL)
+	int i, j;
+	float val, pixel;
+
+	val = take_max ? 0.0f : 255.0f;
+	for (i = -half; i <= half; ++i)
 	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		for (j = -half; j <= half; ++j)
+		{
+			pixel = lpgm_get_pixel_extend_value(im, x + i, y + j);
+			if (take_max ? (pixel > val) : (pixel < val))
+			{
+				val = pixel;
+			}
+		}
 	}
-	
-	if (ksize < 1 || ksize % 2 == 0)
+
+	return val;
+}
+
+/*
+ * Erosion / dilation. Pixels whose window is inside the image fold one tap
+ * at a time into dst (min_row / max_row kernels); the border, where the
+ * window reaches outside, goes through rank_pixel().
+ */
+static lpgm_status_t
+rank_filter_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst, int take_max, const char* caller)
+{
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	int x, y, i, j, n, half;
+	const float* src;
+	float* out;
+
+	if (check_into(im, dst, 0, caller) != 0)
 	{
-		fprintf(stderr, "%s(): Kernel size must be odd.\n", __func__);
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		return LPGM_FAIL;
 	}
-	
-	half = ksize / 2;
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
+
+	if (ksize < 1 || ksize % 2 == 0)
 	{
-		return out_im;
+		lpgm_log(LPGM_LOG_ERROR, caller, "Kernel size must be odd.");
+		return LPGM_FAIL;
 	}
-	
+
+	half = ksize / 2;
+	n = im->w - 2 * half;
 	for (x = 0; x < im->h; ++x)
 	{
-		for (y = 0; y < im->w; ++y)
+		out = lpgm_image_row(dst, x);
+		if (n <= 0 || x < half || x >= im->h - half)
 		{
-			min_val = 255.0f;
-			
-			for (i = -half; i <= half; ++i)
+			for (y = 0; y < im->w; ++y)
 			{
-				for (j = -half; j <= half; ++j)
+				out[y] = rank_pixel(im, x, y, half, take_max);
+			}
+			continue;
+		}
+
+		for (y = half; y < half + n; ++y)
+		{
+			out[y] = take_max ? 0.0f : 255.0f;
+		}
+		for (i = -half; i <= half; ++i)
+		{
+			src = lpgm_image_row(im, x + i);
+			for (j = -half; j <= half; ++j)
+			{
+				if (take_max)
 				{
-					pixel = lpgm_get_pixel_extend_value(im, x + i, y + j);
-					if (pixel < min_val)
-					{
-						min_val = pixel;
-					}
+					kernels->max_row(out + half, src + half + j, n);
+				}
+				else
+				{
+					kernels->min_row(out + half, src + half + j, n);
 				}
 			}
-			
-			lpgm_set_pixel_value(&out_im, x, y, min_val);
+		}
+
+		for (y = 0; y < half; ++y)
+		{
+			out[y] = rank_pixel(im, x, y, half, take_max);
+			out[im->w - 1 - y] = rank_pixel(im, x, im->w - 1 - y, half, take_max);
 		}
 	}
-	
+
+	return LPGM_OK;
+}
+
+/*
+ * Erosion - shrinks white regions, removes small white spots
+ * Output pixel = minimum value in NxN neighborhood
+ */
+lpgm_status_t
+lpgm_erode_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst)
+{
+	return rank_filter_into(im, ksize, dst, 0, __func__);
+}
+
+lpgm_image_t
+lpgm_erode(const lpgm_image_t* im, int ksize)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_erode_into(im, ksize, &out_im) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
 	return out_im;
 }
 
@@ -969,102 +1746,127 @@ lpgm_erode(const lpgm_image_t* im, int ksize)
  * Dilation - expands white regions, fills small black holes
  * Output pixel = maximum value in NxN neighborhood
  */
+lpgm_status_t
+lpgm_dilate_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst)
+{
+	return rank_filter_into(im, ksize, dst, 1, __func__);
+}
+
 lpgm_image_t
 lpgm_dilate(const lpgm_image_t* im, int ksize)
 {
-	int x, y, i, j;
-	int half;
-	float max_val, pixel;
 	lpgm_image_t out_im;
-	
-	if (im == NULL || im->data == NULL)
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_dilate_into(im, ksize, &out_im) != LPGM_OK)
 	{
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		lpgm_image_destroy(&out_im);
 	}
+
+	return out_im;
+}
+
+/*
+ * Opening - erosion followed by dilation
+ * Removes small white spots, smooths contours
+ */
+lpgm_status_t
+lpgm_opening_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst, lpgm_image_t* tmp)
+{
+	lpgm_image_t own_tmp;
+	lpgm_status_t status;
 	
-	if (ksize < 1 || ksize % 2 == 0)
+	if (check_into(im, dst, 0, __func__) != 0)
 	{
-		fprintf(stderr, "%s(): Kernel size must be odd.\n", __func__);
-		out_im.w = 0;
-		out_im.h = 0;
-		out_im.data = NULL;
-		return out_im;
+		return LPGM_FAIL;
 	}
 	
-	half = ksize / 2;
-	out_im = lpgm_make_empty_image(im->w, im->h);
-	if (out_im.data == NULL)
+	/* Without a scratch image from the caller, allocate one for this call */
+	own_tmp = lpgm_null_image();
+	if (tmp == NULL)
 	{
-		return out_im;
+		own_tmp = lpgm_make_image_uninit(im->w, im->h);
+		if (own_tmp.data == NULL)
+		{
+			return LPGM_FAIL;
+		}
+		tmp = &own_tmp;
 	}
 	
-	for (x = 0; x < im->h; ++x)
+	status = lpgm_erode_into(im, ksize, tmp);
+	if (status == LPGM_OK)
 	{
-		for (y = 0; y < im->w; ++y)
-		{
-			max_val = 0.0f;
-			
-			for (i = -half; i <= half; ++i)
-			{
-				for (j = -half; j <= half; ++j)
-				{
-					pixel = lpgm_get_pixel_extend_value(im, x + i, y + j);
-					if (pixel > max_val)
-					{
-						max_val = pixel;
-					}
-				}
-			}
-			
-			lpgm_set_pixel_value(&out_im, x, y, max_val);
-		}
+		status = lpgm_dilate_into(tmp, ksize, dst);
 	}
 	
-	return out_im;
+	lpgm_image_destroy(&own_tmp);
+	
+	return status;
 }
 
-/*
- * Opening - erosion followed by dilation
- * Removes small white spots, smooths contours
- */
 lpgm_image_t
 lpgm_opening(const lpgm_image_t* im, int ksize)
 {
-	lpgm_image_t eroded, opened;
-	
-	eroded = lpgm_erode(im, ksize);
-	if (eroded.data == NULL)
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_opening_into(im, ksize, &out_im, NULL) != LPGM_OK)
 	{
-		return eroded;
+		lpgm_image_destroy(&out_im);
 	}
-	
-	opened = lpgm_dilate(&eroded, ksize);
-	lpgm_image_destroy(&eroded);
-	
-	return opened;
+
+	return out_im;
 }
 
 /*
  * Closing - dilation followed by erosion
  * Fills small black holes, connects nearby regions
  */
-lpgm_image_t
-lpgm_closing(const lpgm_image_t* im, int ksize)
+lpgm_status_t
+lpgm_closing_into(const lpgm_image_t* im, int ksize, lpgm_image_t* dst, lpgm_image_t* tmp)
 {
-	lpgm_image_t dilated, closed;
+	lpgm_image_t own_tmp;
+	lpgm_status_t status;
+	
+	if (check_into(im, dst, 0, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
 	
-	dilated = lpgm_dilate(im, ksize);
-	if (dilated.data == NULL)
+	/* Without a scratch image from the caller, allocate one for this call */
+	own_tmp = lpgm_null_image();
+	if (tmp == NULL)
 	{
-		return dilated;
+		own_tmp = lpgm_make_image_uninit(im->w, im->h);
+		if (own_tmp.data == NULL)
+		{
+			return LPGM_FAIL;
+		}
+		tmp = &own_tmp;
+	}
+	
+	status = lpgm_dilate_into(im, ksize, tmp);
+	if (status == LPGM_OK)
+	{
+		status = lpgm_erode_into(tmp, ksize, dst);
 	}
 	
-	closed = lpgm_erode(&dilated, ksize);
-	lpgm_image_destroy(&dilated);
+	lpgm_image_destroy(&own_tmp);
 	
-	return closed;
+	return status;
+}
+
+lpgm_image_t
+lpgm_closing(const lpgm_image_t* im, int ksize)
+{
+	lpgm_image_t out_im;
+
+	out_im = result_like(im);
+	if (out_im.data != NULL && lpgm_closing_into(im, ksize, &out_im, NULL) != LPGM_OK)
+	{
+		lpgm_image_destroy(&out_im);
+	}
+
+	return out_im;
 }
 
@@ -0,0 +1,284 @@
+/*
+ * 16-bit images
+ *
+ * Keeps samples of 12- and 16-bit PGMs (max value up to 65535) as native
+ * uint16, at half the memory of float images, for the operations that only
+ * need the sample levels (histogram equalization, Otsu).
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+lpgm_image_u16_t
+lpgm_make_empty_image_u16(int w, int h)
+{
+	lpgm_image_u16_t im;
+
+	im.w = w;
+	im.h = h;
+	im.data = (unsigned short*)lpgm_calloc((size_t)w * h, sizeof(unsigned short));
+	if (im.data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		im.w = 0;
+		im.h = 0;
+	}
+
+	return im;
+}
+
+void
+lpgm_image_u16_destroy(lpgm_image_u16_t* im)
+{
+	if (im == NULL)
+	{
+		return;
+	}
+	lpgm_free(im->data);
+	im->data = NULL;
+	im->w = 0;
+	im->h = 0;
+}
+
+lpgm_image_u16_t
+lpgm_image_to_u16(const lpgm_image_t* im)
+{
+	int i, x;
+	float v;
+	const float* src;
+	unsigned short* dst;
+	lpgm_image_u16_t out_im;
+
+	if (im == NULL || im->data == NULL)
+	{
+		out_im.w = 0;
+		out_im.h = 0;
+		out_im.data = NULL;
+		return out_im;
+	}
+
+	out_im = lpgm_make_empty_image_u16(im->w, im->h);
+	if (out_im.data == NULL)
+	{
+		return out_im;
+	}
+
+	/* Clamp and truncate like the PGM writer */
+	for (i = 0; i < im->h; ++i)
+	{
+		src = lpgm_image_row(im, i);
+		dst = out_im.data + (size_t)i * im->w;
+		for (x = 0; x < im->w; ++x)
+		{
+			v = src[x];
+			v = (v < 0.0f) ? 0.0f : v;
+			v = (v > 65535.0f) ? 65535.0f : v;
+			dst[x] = (unsigned short)(int)v;
+		}
+	}
+
+	return out_im;
+}
+
+lpgm_image_t
+lpgm_image_u16_to_image(const lpgm_image_u16_t* im)
+{
+	int i, x;
+	const unsigned short* src;
+	float* dst;
+	lpgm_image_t out_im;
+
+	if (im == NULL || im->data == NULL)
+	{
+		out_im = lpgm_null_image();
+		return out_im;
+	}
+
+	out_im = lpgm_make_empty_image(im->w, im->h);
+	if (out_im.data == NULL)
+	{
+		return out_im;
+	}
+
+	for (i = 0; i < im->h; ++i)
+	{
+		src = im->data + (size_t)i * im->w;
+		dst = lpgm_image_row(&out_im, i);
+		for (x = 0; x < im->w; ++x)
+		{
+			dst[x] = (float)src[x];
+		}
+	}
+
+	return out_im;
+}
+
+/* Histogram of im over max_val + 1 levels, samples clamped to max_val. Free with lpgm_free(). */
+static int*
+u16_histogram(const lpgm_image_u16_t* im, int max_val)
+{
+	int* histogram;
+
+	histogram = (int*)lpgm_malloc(((size_t)max_val + 1) * sizeof(int));
+	if (histogram == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		return NULL;
+	}
+
+	if (lpgm_count_histogram_u16(im->data, im->w, im->h, max_val + 1, histogram) != 0)
+	{
+		lpgm_free(histogram);
+		return NULL;
+	}
+
+	return histogram;
+}
+
+static int
+u16_args_valid(const lpgm_image_u16_t* im, int max_val, const char* caller)
+{
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid input image.");
+		return 0;
+	}
+
+	if (max_val < 1 || max_val > 65535)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Max_val: [%d] must be in [1, 65535].", max_val);
+		return 0;
+	}
+
+	return 1;
+}
+
+int
+lpgm_otsu_threshold_value_u16(const lpgm_image_u16_t* im, int max_val)
+{
+	int* histogram;
+	int best_threshold;
+
+	if (!u16_args_valid(im, max_val, __func__))
+	{
+		return -1;
+	}
+
+	histogram = u16_histogram(im, max_val);
+	if (histogram == NULL)
+	{
+		return -1;
+	}
+
+	best_threshold = lpgm_otsu_from_histogram(histogram, max_val + 1, im->w * im->h);
+	lpgm_free(histogram);
+
+	return best_threshold;
+}
+
+lpgm_image_u16_t
+lpgm_otsu_threshold_u16(const lpgm_image_u16_t* im, int max_val, int* out_threshold)
+{
+	int i, len;
+	int* histogram;
+	int best_threshold;
+	lpgm_image_u16_t out_im;
+
+	out_im.w = 0;
+	out_im.h = 0;
+	out_im.data = NULL;
+	if (!u16_args_valid(im, max_val, __func__))
+	{
+		return out_im;
+	}
+
+	len = im->w * im->h;
+	histogram = u16_histogram(im, max_val);
+	if (histogram == NULL)
+	{
+		return out_im;
+	}
+
+	best_threshold = lpgm_otsu_from_histogram(histogram, max_val + 1, len);
+	lpgm_free(histogram);
+
+	lpgm_log(LPGM_LOG_INFO, __func__, "Otsu threshold: %d", best_threshold);
+	if (out_threshold != NULL)
+	{
+		*out_threshold = best_threshold;
+	}
+
+	out_im = lpgm_make_empty_image_u16(im->w, im->h);
+	if (out_im.data == NULL)
+	{
+		return out_im;
+	}
+
+	for (i = 0; i < len; ++i)
+	{
+		out_im.data[i] = (unsigned short)((im->data[i] > best_threshold) ? max_val : 0);
+	}
+
+	return out_im;
+}
+
+lpgm_image_u16_t
+lpgm_histogram_equalization_u16(const lpgm_image_u16_t* im, int max_val)
+{
+	int i, len;
+	int* histogram;
+	float* lut;
+	unsigned short* levels;
+	unsigned int top;
+	lpgm_image_u16_t out_im;
+
+	out_im.w = 0;
+	out_im.h = 0;
+	out_im.data = NULL;
+	if (!u16_args_valid(im, max_val, __func__))
+	{
+		return out_im;
+	}
+
+	len = im->w * im->h;
+	histogram = u16_histogram(im, max_val);
+	lut = (float*)lpgm_malloc(((size_t)max_val + 1) * sizeof(float));
+	levels = (unsigned short*)lpgm_malloc(((size_t)max_val + 1) * sizeof(unsigned short));
+	out_im = lpgm_make_empty_image_u16(im->w, im->h);
+	if (histogram == NULL || lut == NULL || levels == NULL || out_im.data == NULL)
+	{
+		lpgm_free(histogram);
+		lpgm_free(lut);
+		lpgm_free(levels);
+		lpgm_image_u16_destroy(&out_im);
+		return out_im;
+	}
+
+	if (lpgm_equalization_lut(histogram, max_val + 1, len, (float)max_val, lut) != 0)
+	{
+		memcpy(out_im.data, im->data, (size_t)len * sizeof(unsigned short));
+	}
+	else
+	{
+		/* Round the table once, then the per-pixel pass is a plain lookup */
+		for (i = 0; i <= max_val; ++i)
+		{
+			levels[i] = (unsigned short)(lut[i] + 0.5f);
+		}
+
+		top = (unsigned int)max_val;
+		for (i = 0; i < len; ++i)
+		{
+			out_im.data[i] = levels[(im->data[i] > top) ? top : im->data[i]];
+		}
+	}
+
+	lpgm_free(histogram);
+	lpgm_free(lut);
+	lpgm_free(levels);
+
+	return out_im;
+}
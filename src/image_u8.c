@@ -0,0 +1,1230 @@
+/*
+ * 8-bit images
+ *
+ * Keeps samples of 8-bit PGMs as native uint8, at a quarter of the memory
+ * and bandwidth of float images. The operations mirror their float versions
+ * in image.c and produce the bytes lpgm_file_write() would write for the
+ * float result (clamp to [0, 255], truncate), except lpgm_convolve_u8(),
+ * which uses fixed-point weights.
+ *
+ * Point operations become a 256-entry table (lpgm_lut_u8_t) built once per
+ * call; tables compose, so a chain of them costs a single pass.
+ * Convert with lpgm_image_u8_to_image() where float is needed (FFT, DFT).
+ */
+
+#include "internal.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Fractional bits of the fixed-point kernel weights in lpgm_convolve_u8() */
+#define U8_KERNEL_SHIFT 12
+
+/* Convolution weights and median windows up to this many taps live on the stack */
+#define U8_STACK_WINDOW (15 * 15)
+
+static lpgm_image_u8_t
+null_image_u8(void)
+{
+	lpgm_image_u8_t im = {0, 0, NULL, 0, 0};
+
+	return im;
+}
+
+/* Rows are padded to a multiple of 64 bytes and start on 64-byte boundaries. */
+lpgm_image_u8_t
+lpgm_make_empty_image_u8(int w, int h)
+{
+	lpgm_image_u8_t im;
+	size_t size;
+	void* data;
+
+	im = null_image_u8();
+	if (w <= 0 || h <= 0)
+	{
+		return im;
+	}
+
+	im.stride = (w + LPGM_ROW_ALIGN - 1) / LPGM_ROW_ALIGN * LPGM_ROW_ALIGN;
+	size = (size_t)im.stride * h;
+	data = lpgm_aligned_alloc(size);
+	if (data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		im.stride = 0;
+		return im;
+	}
+	memset(data, 0, size);
+
+	im.w = w;
+	im.h = h;
+	im.data = (unsigned char*)data;
+
+	return im;
+}
+
+lpgm_image_u8_t
+lpgm_image_u8_roi(const lpgm_image_u8_t* im, int row, int col, int w, int h)
+{
+	lpgm_image_u8_t view;
+
+	view = null_image_u8();
+	if (im == NULL || im->data == NULL || row < 0 || col < 0 || w <= 0 || h <= 0 || row + h > im->h || col + w > im->w)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Region [%d, %d] %d x %d is outside the image.", row, col, w, h);
+		return view;
+	}
+
+	view.w = w;
+	view.h = h;
+	view.stride = LPGM_STRIDE(im);
+	view.data = im->data + (size_t)row * view.stride + col;
+	view.is_view = 1;
+
+	return view;
+}
+
+void
+lpgm_image_u8_destroy(lpgm_image_u8_t* im)
+{
+	if (im == NULL)
+	{
+		return;
+	}
+	if (!im->is_view)
+	{
+		lpgm_free(im->data);
+	}
+	*im = null_image_u8();
+}
+
+lpgm_image_u8_t
+lpgm_image_to_u8(const lpgm_image_t* im)
+{
+	int i, x;
+	float v;
+	const float* src;
+	unsigned char* dst;
+	lpgm_image_u8_t out_im;
+
+	if (im == NULL || im->data == NULL)
+	{
+		return null_image_u8();
+	}
+
+	out_im = lpgm_make_empty_image_u8(im->w, im->h);
+	if (out_im.data == NULL)
+	{
+		return out_im;
+	}
+
+	/* Clamp and truncate like the PGM writer */
+	for (i = 0; i < im->h; ++i)
+	{
+		src = lpgm_image_row(im, i);
+		dst = LPGM_U8_ROW(&out_im, i);
+		for (x = 0; x < im->w; ++x)
+		{
+			v = src[x];
+			v = (v < 0.0f) ? 0.0f : v;
+			v = (v > 255.0f) ? 255.0f : v;
+			dst[x] = (unsigned char)(int)v;
+		}
+	}
+
+	return out_im;
+}
+
+lpgm_image_t
+lpgm_image_u8_to_image(const lpgm_image_u8_t* im)
+{
+	int i, x;
+	const unsigned char* src;
+	float* dst;
+	lpgm_image_t out_im;
+
+	if (im == NULL || im->data == NULL)
+	{
+		out_im = lpgm_null_image();
+		return out_im;
+	}
+
+	out_im = lpgm_make_empty_image(im->w, im->h);
+	if (out_im.data == NULL)
+	{
+		return out_im;
+	}
+
+	for (i = 0; i < im->h; ++i)
+	{
+		src = LPGM_U8_ROW(im, i);
+		dst = lpgm_image_row(&out_im, i);
+		for (x = 0; x < im->w; ++x)
+		{
+			dst[x] = (float)src[x];
+		}
+	}
+
+	return out_im;
+}
+
+/* Pixel at (x, y), or 0 outside the image (zero padding, as in image.c) */
+static inline int
+u8_extend_value(const lpgm_image_u8_t* im, int x, int y)
+{
+	if (x < 0 || x >= im->h || y < 0 || y >= im->w)
+	{
+		return 0;
+	}
+
+	return LPGM_U8_ROW(im, x)[y];
+}
+
+/* Quantize a float result into a table entry like the PGM writer: clamp, truncate */
+static unsigned char
+u8_level(float v)
+{
+	v = (v < 0.0f) ? 0.0f : v;
+	v = (v > 255.0f) ? 255.0f : v;
+
+	return (unsigned char)(int)v;
+}
+
+/* New image of the size of im (null for an invalid im), for the _into operations to fill */
+static lpgm_image_u8_t
+result_like_u8(const lpgm_image_u8_t* im)
+{
+	if (im == NULL || im->data == NULL)
+	{
+		return null_image_u8();
+	}
+
+	return lpgm_make_empty_image_u8(im->w, im->h);
+}
+
+/*
+ * Check the arguments of a u8 _into operation, as check_into() in image.c:
+ * both images valid and of the same size; dst may be im itself only with
+ * may_alias (point operations) and must not otherwise overlap it.
+ * Returns 0, or -1 after logging the problem for caller.
+ */
+static int
+check_into_u8(const lpgm_image_u8_t* im, const lpgm_image_u8_t* dst, int may_alias, const char* caller)
+{
+	const unsigned char* im_end;
+	const unsigned char* dst_end;
+
+	if (im == NULL || im->data == NULL || dst == NULL || dst->data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid input or destination image.");
+		return -1;
+	}
+
+	if (dst->w != im->w || dst->h != im->h)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Destination is [%d x %d], input is [%d x %d].", dst->w, dst->h, im->w, im->h);
+		return -1;
+	}
+
+	if (may_alias && dst->data == im->data && LPGM_STRIDE(dst) == LPGM_STRIDE(im))
+	{
+		return 0;
+	}
+
+	im_end = LPGM_U8_ROW(im, im->h - 1) + im->w;
+	dst_end = LPGM_U8_ROW(dst, dst->h - 1) + dst->w;
+	if (dst->data < im_end && im->data < dst_end)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Destination overlaps the input image.");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Point-operation tables. Each builder evaluates the float formula once per
+ * level and quantizes like the PGM writer, so applying the table gives the
+ * same bytes as the u8 operation. Composing tables is exact for a chain of
+ * u8 operations, since each of them quantizes its result anyway.
+ */
+
+lpgm_status_t
+lpgm_lut_identity(lpgm_lut_u8_t* lut)
+{
+	int v;
+
+	if (lut == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (v = 0; v < 256; ++v)
+	{
+		lut->v[v] = (unsigned char)v;
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_lut_brightness(lpgm_lut_u8_t* lut, float delta)
+{
+	int v;
+
+	if (lut == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (v = 0; v < 256; ++v)
+	{
+		lut->v[v] = u8_level((float)v + delta);
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_lut_contrast(lpgm_lut_u8_t* lut, float factor)
+{
+	int v;
+
+	if (lut == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (v = 0; v < 256; ++v)
+	{
+		lut->v[v] = u8_level(((float)v - 128.0f) * factor + 128.0f);
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_lut_invert(lpgm_lut_u8_t* lut)
+{
+	int v;
+
+	if (lut == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (v = 0; v < 256; ++v)
+	{
+		lut->v[v] = (unsigned char)(255 - v);
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_lut_threshold(lpgm_lut_u8_t* lut, float threshold)
+{
+	int v;
+
+	if (lut == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (v = 0; v < 256; ++v)
+	{
+		lut->v[v] = ((float)v > threshold) ? 255 : 0;
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_lut_gamma(lpgm_lut_u8_t* lut, float gamma)
+{
+	int v;
+
+	if (lut == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (gamma <= 0.0f)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Gamma must be positive.");
+		return LPGM_FAIL;
+	}
+
+	for (v = 0; v < 256; ++v)
+	{
+		lut->v[v] = u8_level(255.0f * powf((float)v / 255.0f, gamma));
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_lut_compose(const lpgm_lut_u8_t* first, const lpgm_lut_u8_t* then, lpgm_lut_u8_t* out)
+{
+	lpgm_lut_u8_t composed;
+	int v;
+
+	if (first == NULL || then == NULL || out == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	/* Through a copy: out may be first or then */
+	for (v = 0; v < 256; ++v)
+	{
+		composed.v[v] = then->v[first->v[v]];
+	}
+	*out = composed;
+
+	return LPGM_OK;
+}
+
+/* Each row goes through the lut_apply kernel: pshufb or vpermi2b lookups where the CPU has them */
+lpgm_status_t
+lpgm_apply_lut_u8_into(const lpgm_image_u8_t* im, const lpgm_lut_u8_t* lut, lpgm_image_u8_t* dst)
+{
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	int x;
+
+	if (lut == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid lookup table.");
+		return LPGM_FAIL;
+	}
+
+	/* In place is fine, any other overlap is not */
+	if (check_into_u8(im, dst, 1, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (x = 0; x < im->h; ++x)
+	{
+		kernels->lut_apply(LPGM_U8_ROW(im, x), LPGM_U8_ROW(dst, x), im->w, lut->v);
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_image_u8_t
+lpgm_apply_lut_u8(const lpgm_image_u8_t* im, const lpgm_lut_u8_t* lut)
+{
+	lpgm_image_u8_t out_im;
+
+	if (im == NULL || im->data == NULL || lut == NULL)
+	{
+		return null_image_u8();
+	}
+
+	out_im = lpgm_make_empty_image_u8(im->w, im->h);
+	if (out_im.data == NULL)
+	{
+		return out_im;
+	}
+
+	if (lpgm_apply_lut_u8_into(im, lut, &out_im) != LPGM_OK)
+	{
+		lpgm_image_u8_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+/* Point operations: build the table, then one pass over the pixels */
+
+lpgm_image_u8_t
+lpgm_brightness_u8(const lpgm_image_u8_t* im, float delta)
+{
+	lpgm_lut_u8_t lut;
+
+	lpgm_lut_brightness(&lut, delta);
+
+	return lpgm_apply_lut_u8(im, &lut);
+}
+
+lpgm_image_u8_t
+lpgm_contrast_u8(const lpgm_image_u8_t* im, float factor)
+{
+	lpgm_lut_u8_t lut;
+
+	lpgm_lut_contrast(&lut, factor);
+
+	return lpgm_apply_lut_u8(im, &lut);
+}
+
+lpgm_image_u8_t
+lpgm_invert_u8(const lpgm_image_u8_t* im)
+{
+	lpgm_lut_u8_t lut;
+
+	lpgm_lut_invert(&lut);
+
+	return lpgm_apply_lut_u8(im, &lut);
+}
+
+lpgm_image_u8_t
+lpgm_threshold_u8(const lpgm_image_u8_t* im, float threshold)
+{
+	lpgm_lut_u8_t lut;
+
+	lpgm_lut_threshold(&lut, threshold);
+
+	return lpgm_apply_lut_u8(im, &lut);
+}
+
+lpgm_image_u8_t
+lpgm_gamma_u8(const lpgm_image_u8_t* im, float gamma)
+{
+	lpgm_lut_u8_t lut;
+
+	if (im == NULL || im->data == NULL)
+	{
+		return null_image_u8();
+	}
+
+	if (lpgm_lut_gamma(&lut, gamma) != LPGM_OK)
+	{
+		return null_image_u8();
+	}
+
+	return lpgm_apply_lut_u8(im, &lut);
+}
+
+int
+lpgm_otsu_threshold_value_u8(const lpgm_image_u8_t* im)
+{
+	int histogram[256];
+
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		return -1;
+	}
+
+	if (lpgm_count_histogram_u8(im, histogram) != 0)
+	{
+		return -1;
+	}
+
+	return lpgm_otsu_from_histogram(histogram, 256, im->w * im->h);
+}
+
+lpgm_image_u8_t
+lpgm_otsu_threshold_u8(const lpgm_image_u8_t* im, int* out_threshold)
+{
+	int histogram[256];
+	int best_threshold;
+
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		return null_image_u8();
+	}
+
+	if (lpgm_count_histogram_u8(im, histogram) != 0)
+	{
+		return null_image_u8();
+	}
+	best_threshold = lpgm_otsu_from_histogram(histogram, 256, im->w * im->h);
+
+	lpgm_log(LPGM_LOG_INFO, __func__, "Otsu threshold: %d", best_threshold);
+	if (out_threshold != NULL)
+	{
+		*out_threshold = best_threshold;
+	}
+
+	return lpgm_threshold_u8(im, (float)best_threshold);
+}
+
+lpgm_status_t
+lpgm_lut_histogram_equalization_from(lpgm_lut_u8_t* lut, const lpgm_histogram_t* hist)
+{
+	float levels[256];
+	int v;
+
+	if (lut == NULL || hist == NULL || hist->counts == NULL || hist->n_bins != 256 || hist->total <= 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (lpgm_equalization_lut(hist->counts, 256, hist->total, 255.0f, levels))
+	{
+		/* Flat image: nothing to spread */
+		return lpgm_lut_identity(lut);
+	}
+
+	for (v = 0; v < 256; ++v)
+	{
+		lut->v[v] = u8_level(levels[v]);
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_lut_histogram_equalization(lpgm_lut_u8_t* lut, const lpgm_image_u8_t* im)
+{
+	int counts[256];
+	lpgm_histogram_t hist;
+
+	if (lut == NULL || im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	hist.n_bins = 256;
+	hist.counts = counts;
+	if (lpgm_histogram_u8_into(im, &hist) != LPGM_OK)
+	{
+		return LPGM_FAIL;
+	}
+
+	return lpgm_lut_histogram_equalization_from(lut, &hist);
+}
+
+lpgm_image_u8_t
+lpgm_histogram_equalization_u8(const lpgm_image_u8_t* im)
+{
+	lpgm_lut_u8_t lut;
+
+	if (lpgm_lut_histogram_equalization(&lut, im) != LPGM_OK)
+	{
+		return null_image_u8();
+	}
+
+	return lpgm_apply_lut_u8(im, &lut);
+}
+
+lpgm_image_u8_t
+lpgm_clahe_u8(const lpgm_image_u8_t* im, int tiles_x, int tiles_y, float clip_limit)
+{
+	lpgm_image_u8_t out_im;
+
+	if (im == NULL || im->data == NULL || im->w <= 0 || im->h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return null_image_u8();
+	}
+
+	out_im = lpgm_make_empty_image_u8(im->w, im->h);
+	if (out_im.data != NULL && lpgm_clahe_run(NULL, im, tiles_x, tiles_y, clip_limit, NULL, &out_im, __func__) != 0)
+	{
+		lpgm_image_u8_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+/* Sobel magnitude at (x, y) through u8_extend_value(), for the one-pixel border */
+static unsigned char
+sobel_pixel_u8(const lpgm_image_u8_t* im, int x, int y)
+{
+	int gx, gy;
+	int p00, p01, p02, p10, p12, p20, p21, p22;
+
+	p00 = u8_extend_value(im, x - 1, y - 1);
+	p01 = u8_extend_value(im, x - 1, y);
+	p02 = u8_extend_value(im, x - 1, y + 1);
+	p10 = u8_extend_value(im, x, y - 1);
+	p12 = u8_extend_value(im, x, y + 1);
+	p20 = u8_extend_value(im, x + 1, y - 1);
+	p21 = u8_extend_value(im, x + 1, y);
+	p22 = u8_extend_value(im, x + 1, y + 1);
+
+	gx = (p02 + 2 * p12 + p22) - (p00 + 2 * p10 + p20);
+	gy = (p20 + 2 * p21 + p22) - (p00 + 2 * p01 + p02);
+
+	return u8_level(sqrtf((float)(gx * gx + gy * gy)));
+}
+
+/*
+ * Sobel magnitude of n pixels whose 3x3 windows lie inside the image, from
+ * the rows above, at and below them: no bounds checks and no branches, so
+ * the compiler can vectorize it.
+ */
+static void
+sobel_row_u8(unsigned char* out, const unsigned char* above, const unsigned char* row, const unsigned char* below,
+             int n)
+{
+	int y, gx, gy;
+	float magnitude;
+
+	for (y = 0; y < n; ++y)
+	{
+		gx = (above[y + 1] + 2 * row[y + 1] + below[y + 1]) - (above[y - 1] + 2 * row[y - 1] + below[y - 1]);
+		gy = (below[y - 1] + 2 * below[y] + below[y + 1]) - (above[y - 1] + 2 * above[y] + above[y + 1]);
+
+		magnitude = sqrtf((float)(gx * gx + gy * gy));
+		out[y] = (unsigned char)(int)((magnitude > 255.0f) ? 255.0f : magnitude);
+	}
+}
+
+/*
+ * Sobel edge detection, integer gradients.
+ * G = sqrt(Gx^2 + Gy^2) clamped to 255, zero padding at the borders.
+ * Inner pixels go through sobel_row_u8(), the one-pixel border through sobel_pixel_u8().
+ */
+lpgm_status_t
+lpgm_sobel_u8_into(const lpgm_image_u8_t* im, lpgm_image_u8_t* dst)
+{
+	unsigned char* out;
+	int x, y;
+
+	if (check_into_u8(im, dst, 0, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	for (x = 0; x < im->h; ++x)
+	{
+		out = LPGM_U8_ROW(dst, x);
+		if (x == 0 || x == im->h - 1 || im->w < 3)
+		{
+			for (y = 0; y < im->w; ++y)
+			{
+				out[y] = sobel_pixel_u8(im, x, y);
+			}
+			continue;
+		}
+
+		out[0] = sobel_pixel_u8(im, x, 0);
+		sobel_row_u8(out + 1, LPGM_U8_ROW(im, x - 1) + 1, LPGM_U8_ROW(im, x) + 1, LPGM_U8_ROW(im, x + 1) + 1,
+		             im->w - 2);
+		out[im->w - 1] = sobel_pixel_u8(im, x, im->w - 1);
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_image_u8_t
+lpgm_sobel_u8(const lpgm_image_u8_t* im)
+{
+	lpgm_image_u8_t out_im;
+
+	out_im = result_like_u8(im);
+	if (out_im.data != NULL && lpgm_sobel_u8_into(im, &out_im) != LPGM_OK)
+	{
+		lpgm_image_u8_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+/* Quantize a fixed-point sum; the shift floors, which matches truncation for the positive sums kept */
+static inline unsigned char
+u8_fixed_level(int sum)
+{
+	sum >>= U8_KERNEL_SHIFT;
+
+	return (unsigned char)((sum < 0) ? 0 : (sum > 255) ? 255 : sum);
+}
+
+/* Convolution at (x, y) through u8_extend_value(), for pixels whose window reaches outside */
+static unsigned char
+convolve_pixel_u8(const lpgm_image_u8_t* im, int x, int y, const int* weights, int half)
+{
+	int i, j, k, sum;
+
+	sum = 0;
+	k = 0;
+	for (i = -half; i <= half; ++i)
+	{
+		for (j = -half; j <= half; ++j)
+		{
+			sum += u8_extend_value(im, x + i, y + j) * weights[k++];
+		}
+	}
+
+	return u8_fixed_level(sum);
+}
+
+/*
+ * NxN convolution with fixed-point weights: each weight is rounded to a
+ * multiple of 1 / 2^U8_KERNEL_SHIFT, keeping the sum of the kernel, and the
+ * sum is accumulated in int.
+ * Results can differ from lpgm_convolve() by one level where the float
+ * sum lands next to an integer. Windows inside the image read the rows
+ * directly; the border goes through convolve_pixel_u8().
+ */
+lpgm_status_t
+lpgm_convolve_u8_into(const lpgm_image_u8_t* im, const float* kernel, int ksize, lpgm_image_u8_t* dst)
+{
+	int x, y, i, j, k, n;
+	int half, sum;
+	int weights_small[U8_STACK_WINDOW];
+	int* weights;
+	long long abs_sum, fixed_sum;
+	double kernel_sum;
+	const unsigned char* src;
+	unsigned char* out;
+
+	if (check_into_u8(im, dst, 0, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (kernel == NULL || ksize < 1 || ksize % 2 == 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Kernel size must be odd (3, 5, 7, ...).");
+		return LPGM_FAIL;
+	}
+
+	weights = weights_small;
+	if (ksize * ksize > U8_STACK_WINDOW)
+	{
+		weights = (int*)lpgm_malloc((size_t)ksize * ksize * sizeof(int));
+		if (weights == NULL)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+			return LPGM_FAIL;
+		}
+	}
+
+	/*
+	 * Rounding each weight on its own can lose the total (a 3x3 box gives
+	 * 9 * 455 = 4095), which darkens flat areas by a level; the center tap
+	 * takes the difference so the weights add up to the rounded float sum.
+	 */
+	kernel_sum = 0.0;
+	fixed_sum = 0;
+	for (k = 0; k < ksize * ksize; ++k)
+	{
+		weights[k] = (int)lrintf(kernel[k] * (float)(1 << U8_KERNEL_SHIFT));
+		kernel_sum += kernel[k];
+		fixed_sum += weights[k];
+	}
+	weights[(ksize * ksize) / 2] += (int)(llrint(kernel_sum * (double)(1 << U8_KERNEL_SHIFT)) - fixed_sum);
+
+	/* The worst-case sum must fit in an int */
+	abs_sum = 0;
+	for (k = 0; k < ksize * ksize; ++k)
+	{
+		abs_sum += (weights[k] < 0) ? -(long long)weights[k] : weights[k];
+	}
+	if (abs_sum * 255 > INT_MAX)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Kernel weights too large for fixed point.");
+		if (weights != weights_small)
+		{
+			lpgm_free(weights);
+		}
+		return LPGM_FAIL;
+	}
+
+	half = ksize / 2;
+	n = im->w - 2 * half;
+	for (x = 0; x < im->h; ++x)
+	{
+		out = LPGM_U8_ROW(dst, x);
+		if (n <= 0 || x < half || x >= im->h - half)
+		{
+			for (y = 0; y < im->w; ++y)
+			{
+				out[y] = convolve_pixel_u8(im, x, y, weights, half);
+			}
+			continue;
+		}
+
+		for (y = half; y < half + n; ++y)
+		{
+			sum = 0;
+			k = 0;
+			for (i = -half; i <= half; ++i)
+			{
+				src = LPGM_U8_ROW(im, x + i) + y - half;
+				for (j = 0; j < ksize; ++j)
+				{
+					sum += src[j] * weights[k++];
+				}
+			}
+			out[y] = u8_fixed_level(sum);
+		}
+
+		for (y = 0; y < half; ++y)
+		{
+			out[y] = convolve_pixel_u8(im, x, y, weights, half);
+			out[im->w - 1 - y] = convolve_pixel_u8(im, x, im->w - 1 - y, weights, half);
+		}
+	}
+
+	if (weights != weights_small)
+	{
+		lpgm_free(weights);
+	}
+	return LPGM_OK;
+}
+
+lpgm_image_u8_t
+lpgm_convolve_u8(const lpgm_image_u8_t* im, const float* kernel, int ksize)
+{
+	lpgm_image_u8_t out_im;
+
+	out_im = result_like_u8(im);
+	if (out_im.data != NULL && lpgm_convolve_u8_into(im, kernel, ksize, &out_im) != LPGM_OK)
+	{
+		lpgm_image_u8_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+/* Median of the window_size samples of window, sorting it in place (insertion sort, efficient for small arrays) */
+static unsigned char
+window_median_u8(unsigned char* window, int window_size)
+{
+	int i, m;
+	unsigned char temp;
+
+	for (i = 1; i < window_size; ++i)
+	{
+		temp = window[i];
+		m = i - 1;
+		while (m >= 0 && window[m] > temp)
+		{
+			window[m + 1] = window[m];
+			m--;
+		}
+		window[m + 1] = temp;
+	}
+
+	return window[window_size / 2];
+}
+
+/* Median of the NxN window at (x, y) through u8_extend_value(), for the border */
+static unsigned char
+median_pixel_u8(const lpgm_image_u8_t* im, int x, int y, int half, unsigned char* window)
+{
+	int i, j, k;
+
+	k = 0;
+	for (i = -half; i <= half; ++i)
+	{
+		for (j = -half; j <= half; ++j)
+		{
+			window[k++] = (unsigned char)u8_extend_value(im, x + i, y + j);
+		}
+	}
+
+	return window_median_u8(window, k);
+}
+
+/*
+ * NxN median filter, zero padding at the borders. Windows inside the image
+ * are copied straight from the rows, the border goes through median_pixel_u8().
+ */
+lpgm_status_t
+lpgm_median_filter_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst)
+{
+	int x, y, i, k, n;
+	int half, window_size;
+	unsigned char window_small[U8_STACK_WINDOW];
+	unsigned char* window;
+	unsigned char* out;
+
+	if (check_into_u8(im, dst, 0, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (ksize < 1 || ksize % 2 == 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Kernel size must be odd (3, 5, 7, ...).");
+		return LPGM_FAIL;
+	}
+
+	half = ksize / 2;
+	window_size = ksize * ksize;
+
+	window = window_small;
+	if (window_size > U8_STACK_WINDOW)
+	{
+		window = (unsigned char*)lpgm_malloc(window_size);
+		if (window == NULL)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+			return LPGM_FAIL;
+		}
+	}
+
+	n = im->w - 2 * half;
+	for (x = 0; x < im->h; ++x)
+	{
+		out = LPGM_U8_ROW(dst, x);
+		if (n <= 0 || x < half || x >= im->h - half)
+		{
+			for (y = 0; y < im->w; ++y)
+			{
+				out[y] = median_pixel_u8(im, x, y, half, window);
+			}
+			continue;
+		}
+
+		for (y = half; y < half + n; ++y)
+		{
+			k = 0;
+			for (i = -half; i <= half; ++i)
+			{
+				memcpy(window + k, LPGM_U8_ROW(im, x + i) + y - half, (size_t)ksize);
+				k += ksize;
+			}
+			out[y] = window_median_u8(window, window_size);
+		}
+
+		for (y = 0; y < half; ++y)
+		{
+			out[y] = median_pixel_u8(im, x, y, half, window);
+			out[im->w - 1 - y] = median_pixel_u8(im, x, im->w - 1 - y, half, window);
+		}
+	}
+
+	if (window != window_small)
+	{
+		lpgm_free(window);
+	}
+	return LPGM_OK;
+}
+
+lpgm_image_u8_t
+lpgm_median_filter_u8(const lpgm_image_u8_t* im, int ksize)
+{
+	lpgm_image_u8_t out_im;
+
+	out_im = result_like_u8(im);
+	if (out_im.data != NULL && lpgm_median_filter_u8_into(im, ksize, &out_im) != LPGM_OK)
+	{
+		lpgm_image_u8_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+/* Min (take_max = 0) or max (take_max = 1) of the NxN window at (x, y), zero padding, for the border */
+static unsigned char
+rank_pixel_u8(const lpgm_image_u8_t* im, int x, int y, int half, int take_max)
+{
+	int i, j, best, pixel;
+
+	best = take_max ? 0 : 255;
+	for (i = -half; i <= half; ++i)
+	{
+		for (j = -half; j <= half; ++j)
+		{
+			pixel = u8_extend_value(im, x + i, y + j);
+			best = take_max ? ((pixel > best) ? pixel : best) : ((pixel < best) ? pixel : best);
+		}
+	}
+
+	return (unsigned char)best;
+}
+
+/* Fold one row of taps into out: out[i] = min / max(out[i], src[i]), branch-free so it vectorizes */
+static void
+min_row_u8(unsigned char* out, const unsigned char* src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		out[i] = (src[i] < out[i]) ? src[i] : out[i];
+	}
+}
+
+static void
+max_row_u8(unsigned char* out, const unsigned char* src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		out[i] = (src[i] > out[i]) ? src[i] : out[i];
+	}
+}
+
+/*
+ * Minimum (erode) or maximum (dilate) over an NxN square, zero padding at
+ * the borders. Pixels whose window is inside the image fold one tap at a
+ * time into dst; the border goes through rank_pixel_u8().
+ */
+static lpgm_status_t
+rank_filter_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst, int take_max, const char* caller)
+{
+	int x, y, i, j, n, half;
+	const unsigned char* src;
+	unsigned char* out;
+
+	if (check_into_u8(im, dst, 0, caller) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (ksize < 1 || ksize % 2 == 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Kernel size must be odd.");
+		return LPGM_FAIL;
+	}
+
+	half = ksize / 2;
+	n = im->w - 2 * half;
+	for (x = 0; x < im->h; ++x)
+	{
+		out = LPGM_U8_ROW(dst, x);
+		if (n <= 0 || x < half || x >= im->h - half)
+		{
+			for (y = 0; y < im->w; ++y)
+			{
+				out[y] = rank_pixel_u8(im, x, y, half, take_max);
+			}
+			continue;
+		}
+
+		memset(out + half, take_max ? 0 : 255, (size_t)n);
+		for (i = -half; i <= half; ++i)
+		{
+			src = LPGM_U8_ROW(im, x + i);
+			for (j = -half; j <= half; ++j)
+			{
+				if (take_max)
+				{
+					max_row_u8(out + half, src + half + j, n);
+				}
+				else
+				{
+					min_row_u8(out + half, src + half + j, n);
+				}
+			}
+		}
+
+		for (y = 0; y < half; ++y)
+		{
+			out[y] = rank_pixel_u8(im, x, y, half, take_max);
+			out[im->w - 1 - y] = rank_pixel_u8(im, x, im->w - 1 - y, half, take_max);
+		}
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_erode_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst)
+{
+	return rank_filter_u8_into(im, ksize, dst, 0, __func__);
+}
+
+lpgm_status_t
+lpgm_dilate_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst)
+{
+	return rank_filter_u8_into(im, ksize, dst, 1, __func__);
+}
+
+lpgm_image_u8_t
+lpgm_erode_u8(const lpgm_image_u8_t* im, int ksize)
+{
+	lpgm_image_u8_t out_im;
+
+	out_im = result_like_u8(im);
+	if (out_im.data != NULL && lpgm_erode_u8_into(im, ksize, &out_im) != LPGM_OK)
+	{
+		lpgm_image_u8_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+lpgm_image_u8_t
+lpgm_dilate_u8(const lpgm_image_u8_t* im, int ksize)
+{
+	lpgm_image_u8_t out_im;
+
+	out_im = result_like_u8(im);
+	if (out_im.data != NULL && lpgm_dilate_u8_into(im, ksize, &out_im) != LPGM_OK)
+	{
+		lpgm_image_u8_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+/*
+ * Opening (close_op = 0: erode, then dilate) or closing (close_op = 1:
+ * dilate, then erode) through tmp, or a scratch image allocated for the
+ * call when tmp is NULL.
+ */
+static lpgm_status_t
+open_close_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst, lpgm_image_u8_t* tmp, int close_op,
+                   const char* caller)
+{
+	lpgm_image_u8_t own_tmp;
+	lpgm_status_t status;
+
+	if (check_into_u8(im, dst, 0, caller) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	own_tmp = null_image_u8();
+	if (tmp == NULL)
+	{
+		own_tmp = lpgm_make_empty_image_u8(im->w, im->h);
+		if (own_tmp.data == NULL)
+		{
+			return LPGM_FAIL;
+		}
+		tmp = &own_tmp;
+	}
+
+	status = rank_filter_u8_into(im, ksize, tmp, close_op, caller);
+	if (status == LPGM_OK)
+	{
+		status = rank_filter_u8_into(tmp, ksize, dst, !close_op, caller);
+	}
+
+	lpgm_image_u8_destroy(&own_tmp);
+
+	return status;
+}
+
+lpgm_status_t
+lpgm_opening_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst, lpgm_image_u8_t* tmp)
+{
+	return open_close_u8_into(im, ksize, dst, tmp, 0, __func__);
+}
+
+lpgm_status_t
+lpgm_closing_u8_into(const lpgm_image_u8_t* im, int ksize, lpgm_image_u8_t* dst, lpgm_image_u8_t* tmp)
+{
+	return open_close_u8_into(im, ksize, dst, tmp, 1, __func__);
+}
+
+lpgm_image_u8_t
+lpgm_opening_u8(const lpgm_image_u8_t* im, int ksize)
+{
+	lpgm_image_u8_t out_im;
+
+	out_im = result_like_u8(im);
+	if (out_im.data != NULL && lpgm_opening_u8_into(im, ksize, &out_im, NULL) != LPGM_OK)
+	{
+		lpgm_image_u8_destroy(&out_im);
+	}
+
+	return out_im;
+}
+
+lpgm_image_u8_t
+lpgm_closing_u8(const lpgm_image_u8_t* im, int ksize)
+{
+	lpgm_image_u8_t out_im;
+
+	out_im = result_like_u8(im);
+	if (out_im.data != NULL && lpgm_closing_u8_into(im, ksize, &out_im, NULL) != LPGM_OK)
+	{
+		lpgm_image_u8_destroy(&out_im);
+	}
+
+	return out_im;
+}
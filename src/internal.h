@@ -0,0 +1,181 @@
+#ifndef PGM_INTERNAL_H
+#define PGM_INTERNAL_H
+
+/*
+ * Internal helpers shared between the library translation units.
+ * Not installed, not part of the public API.
+ */
+
+#include "../include/pigiem.h"
+
+#include <limits.h>
+#include <stdio.h>
+
+/*
+ * Size of the stdio buffer and of the blocks used to move raster data.
+ * Big enough to amortize read overhead, small enough to stay on the stack.
+ */
+#define LPGM_IO_BLOCK_SIZE (64 * 1024)
+
+/*
+ * Widest plain sample plus the separating space: float rows are written as
+ * unclamped ints, so up to eleven characters (-2147483648)
+ */
+#define LPGM_P2_MAX_SAMPLE_CHARS 12
+
+/* Bytes needed to format one P2 row of w samples, newline included */
+#define LPGM_P2_ROW_TEXT_SIZE(w) ((size_t)(w) * LPGM_P2_MAX_SAMPLE_CHARS + 1)
+
+/* Image size whose pixel count w * h fits the int the raster loops count with */
+#define LPGM_SIZE_VALID(w, h) ((w) > 0 && (h) > 0 && (w) <= INT_MAX / (h))
+
+/* Row alignment of images made by lpgm_make_empty_image(), in bytes and in floats */
+#define LPGM_ROW_ALIGN 64
+#define LPGM_ROW_ALIGN_FLOATS (LPGM_ROW_ALIGN / (int)sizeof(float))
+
+/* Row stride of an image in floats; 0 means packed rows */
+#define LPGM_STRIDE(im) (((im)->stride > 0) ? (im)->stride : (im)->w)
+
+/* First sample of row in a uint8 image (honors stride) */
+#define LPGM_U8_ROW(im, row) ((im)->data + (size_t)(row) * LPGM_STRIDE(im))
+
+/* Image without data, returned by operations on invalid input */
+static inline lpgm_image_t
+lpgm_null_image(void)
+{
+	lpgm_image_t im = {0, 0, NULL, 0, 0};
+
+	return im;
+}
+
+/* Histogram bin of a float sample: truncated and clamped to [0, top]; NaN counts as 0 */
+static inline int
+lpgm_sample_bin(float v, float top_f, int top)
+{
+	if (!(v > 0.0f))
+	{
+		return 0;
+	}
+
+	return (v < top_f) ? (int)v : top;
+}
+
+/* Bytes per P5 sample: 1 up to max value 255, 2 (big-endian) above */
+#define LPGM_SAMPLE_BYTES(max_val) (((max_val) > 255) ? 2 : 1)
+
+/* Bytes of writer scratch needed to quantize one row of w samples, any bit depth */
+#define LPGM_ROW_SAMPLES_SIZE(w) ((size_t)(w) * 2)
+
+/* PGM header and raster helpers shared by the file, map and stream readers (pgm_io.c) */
+int lpgm_read_header(FILE* file_ptr, lpgm_t* pgm);
+int lpgm_read_header_summary(FILE* file_ptr, lpgm_t* pgm);
+int lpgm_read_raster(FILE* file_ptr, const lpgm_t* header, float* out, int count);
+int lpgm_read_raster_u16(FILE* file_ptr, const lpgm_t* header, unsigned short* out, int count);
+int lpgm_write_header(FILE* file_ptr, const lpgm_t* pgm);
+int lpgm_write_rows(FILE* file_ptr, const lpgm_t* header, const float* rows, int w, int stride, int n_rows,
+                    unsigned char* row_samples, char* row_text);
+int lpgm_write_rows_u16(FILE* file_ptr, const lpgm_t* header, const unsigned short* rows, int w, int n_rows,
+                        unsigned char* row_samples, char* row_text);
+
+/* Histogram helpers shared by the float and uint16 operations (image.c) */
+int lpgm_otsu_from_histogram(const int* histogram, int n_bins, int len);
+int lpgm_equalization_lut(const int* histogram, int n_bins, int len, float top, float* lut);
+
+/*
+ * Histogram engine (histogram.c): fill histogram[0 .. n_bins - 1] with the
+ * sample counts of an image, samples clamped to [0, n_bins - 1] (float NaN
+ * counts as 0). Large images are counted on lpgm_get_num_threads() threads.
+ * Return 0 or -1 on allocation failure.
+ */
+int lpgm_count_histogram_f32(const lpgm_image_t* im, int n_bins, int* histogram);
+int lpgm_count_histogram_u8(const lpgm_image_u8_t* im, int* histogram);
+int lpgm_count_histogram_u16(const unsigned short* data, int w, int h, int n_bins, int* histogram);
+
+/* Count n float samples / bytes into one histogram without clearing it (histogram.c) */
+void lpgm_count_row_f32(const float* src, int n, int n_bins, int* histogram);
+void lpgm_count_row_u8(const unsigned char* src, int n, int* histogram);
+
+/* Bins needed for im: 256 for 8-bit data, else one per level up to the largest sample (histogram.c) */
+int lpgm_histogram_bins(const lpgm_image_t* im);
+
+/*
+ * CLAHE (clahe.c) of either a float image (im_u8 NULL) or a uint8 image
+ * (im NULL) into a float dst or a uint8 dst_u8 of the same size; dst may be
+ * the input. Returns 0, or -1 after logging the problem for caller.
+ */
+int lpgm_clahe_run(const lpgm_image_t* im, const lpgm_image_u8_t* im_u8, int tiles_x, int tiles_y, float clip_limit,
+                   lpgm_image_t* dst, lpgm_image_u8_t* dst_u8, const char* caller);
+
+/* lpgm_make_empty_image() without clearing the pixels, for results about to be overwritten (image.c) */
+lpgm_image_t lpgm_make_image_uninit(int w, int h);
+
+/*
+ * Report a message from func at level (utils.c). Dropped without formatting
+ * when level is above lpgm_set_log_level(), otherwise handed to the callback
+ * set with lpgm_set_log_callback() or printed as "func(): message".
+ */
+#if defined(__GNUC__)
+__attribute__((format(printf, 3, 4)))
+#endif
+void lpgm_log(lpgm_log_level_t level, const char* func, const char* format, ...);
+
+/*
+ * Heap entry points of the library (utils.c): every block it allocates goes
+ * through these to the context bound to the calling thread, or else to the
+ * lpgm_set_allocator() hooks. Release with lpgm_free().
+ * lpgm_aligned_alloc() returns LPGM_ROW_ALIGN-aligned memory.
+ */
+void* lpgm_malloc(size_t size);
+void* lpgm_calloc(size_t n, size_t size);
+void* lpgm_realloc(void* ptr, size_t size);
+void* lpgm_aligned_alloc(size_t size);
+void lpgm_free(void* ptr);
+
+/*
+ * Allocate straight from the lpgm_set_allocator() hooks, bypassing any bound
+ * context (LPGM_ROW_ALIGN-aligned if aligned is set). Counted in the
+ * allocation and byte counters. Release with lpgm_sys_free().
+ */
+void* lpgm_sys_alloc(size_t size, int aligned);
+void lpgm_sys_free(void* ptr);
+
+/*
+ * Hooks of the allocation contexts (context.c) used by the entry points above.
+ * lpgm_context_alloc() returns 0 if no context is bound to the calling thread
+ * (or size is too large for it), otherwise 1 with the block or NULL in *ptr.
+ * lpgm_context_block_size() returns the usable size of a context block or 0
+ * for memory no context owns; lpgm_context_free() returns 1 if it took ptr back.
+ */
+int lpgm_context_alloc(size_t size, void** ptr);
+size_t lpgm_context_block_size(const void* ptr);
+int lpgm_context_free(void* ptr);
+
+/*
+ * Hot loops, one table per instruction set (kernels.h, simd.c). All tables
+ * give identical results; lpgm_get_kernels() returns the one chosen for
+ * this CPU when the library was loaded.
+ */
+typedef struct
+{
+	lpgm_simd_level_t level;
+	void (*point_ops)(float* v, int n, const lpgm_point_op_t* ops, int n_ops, const float* ranges);
+	void (*clamp)(float* v, int n, float min, float max);
+	void (*min_max)(const float* v, int n, float* min, float* max);
+	void (*axpy)(float* out, const float* src, float k, int n);
+	void (*min_row)(float* out, const float* src, int n);
+	void (*max_row)(float* out, const float* src, int n);
+	void (*sobel_row)(float* out, const float* r0, const float* r1, const float* r2, int n);
+	void (*fft_stage)(lpgm_signal_t* data, int n, int m, const lpgm_signal_t* twiddles);
+	void (*lut_apply)(const unsigned char* src, unsigned char* dst, int n, const unsigned char* lut);
+} lpgm_kernels_t;
+
+const lpgm_kernels_t* lpgm_get_kernels(void);
+
+/*
+ * Run task(ctx, i) for i = 0 .. n_tasks - 1 on a pool of worker threads
+ * and the calling thread, in no particular order; tasks must not wait for
+ * each other. Returns when all tasks are done.
+ */
+void lpgm_parallel_run(int n_tasks, void (*task)(void* ctx, int index), void* ctx);
+
+#endif // PGM_INTERNAL_H
@@ -0,0 +1,292 @@
+/*
+ * Hot loops of the library, compiled once per instruction set by simd.c.
+ *
+ * No include guard on purpose: simd.c includes this file several times,
+ * each time with KERNEL(name) giving the functions a distinct prefix and a
+ * "#pragma GCC target" selecting the instruction set. The bodies are plain C
+ * that the compiler vectorizes for that target.
+ *
+ * Every kernel performs the same floating-point operations in the same order
+ * for each pixel as the reference loop it replaces (the build disables FMA
+ * contraction), so all variants produce identical results.
+ */
+
+/* Clamp like lpgm_clamp() in image.c, NaN passes through */
+static inline float
+KERNEL(clamp1)(float v, float min, float max)
+{
+	v = (v < min) ? min : v;
+	v = (v > max) ? max : v;
+
+	return v;
+}
+
+static void
+KERNEL(clamp)(float* restrict v, int n, float min, float max)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		v[i] = KERNEL(clamp1)(v[i], min, max);
+	}
+}
+
+/* Apply a chain of point operations to n values in place, see lpgm_point_ops_into() */
+static void
+KERNEL(point_ops)(float* restrict v, int n, const lpgm_point_op_t* ops, int n_ops, const float* ranges)
+{
+	float a, b, min, max;
+	int k, i;
+
+	for (k = 0; k < n_ops; ++k)
+	{
+		a = ops[k].a;
+		b = ops[k].b;
+		switch (ops[k].type)
+		{
+		case LPGM_OP_BRIGHTNESS:
+			for (i = 0; i < n; ++i)
+			{
+				v[i] = KERNEL(clamp1)(v[i] + a, 0.0f, 255.0f);
+			}
+			break;
+		case LPGM_OP_CONTRAST:
+			for (i = 0; i < n; ++i)
+			{
+				v[i] = KERNEL(clamp1)((v[i] - 128.0f) * a + 128.0f, 0.0f, 255.0f);
+			}
+			break;
+		case LPGM_OP_GAMMA:
+			for (i = 0; i < n; ++i)
+			{
+				v[i] = KERNEL(clamp1)(255.0f * powf(v[i] / 255.0f, a), 0.0f, 255.0f);
+			}
+			break;
+		case LPGM_OP_CLAMP:
+			KERNEL(clamp)(v, n, a, b);
+			break;
+		case LPGM_OP_INVERT:
+			for (i = 0; i < n; ++i)
+			{
+				v[i] = 255.0f - v[i];
+			}
+			break;
+		case LPGM_OP_THRESHOLD:
+			for (i = 0; i < n; ++i)
+			{
+				v[i] = (v[i] > a) ? 255.0f : 0.0f;
+			}
+			break;
+		case LPGM_OP_NORMALIZE:
+			min = ranges[2 * k];
+			max = ranges[2 * k + 1];
+			for (i = 0; i < n; ++i)
+			{
+				v[i] = (v[i] - min) / (max - min) * a;
+			}
+			break;
+		}
+	}
+}
+
+/* Widen *min and *max to cover v[0 .. n - 1]; 16 independent lanes so the loop vectorizes */
+static void
+KERNEL(min_max)(const float* restrict v, int n, float* min, float* max)
+{
+	float lane_min[16], lane_max[16];
+	int i, l;
+
+	for (l = 0; l < 16; ++l)
+	{
+		lane_min[l] = *min;
+		lane_max[l] = *max;
+	}
+
+	for (i = 0; i + 16 <= n; i += 16)
+	{
+		for (l = 0; l < 16; ++l)
+		{
+			lane_min[l] = (v[i + l] < lane_min[l]) ? v[i + l] : lane_min[l];
+			lane_max[l] = (v[i + l] > lane_max[l]) ? v[i + l] : lane_max[l];
+		}
+	}
+	for (; i < n; ++i)
+	{
+		lane_min[0] = (v[i] < lane_min[0]) ? v[i] : lane_min[0];
+		lane_max[0] = (v[i] > lane_max[0]) ? v[i] : lane_max[0];
+	}
+
+	for (l = 0; l < 16; ++l)
+	{
+		*min = (lane_min[l] < *min) ? lane_min[l] : *min;
+		*max = (lane_max[l] > *max) ? lane_max[l] : *max;
+	}
+}
+
+/* One convolution tap over a row: out[i] += src[i] * k */
+static void
+KERNEL(axpy)(float* restrict out, const float* restrict src, float k, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		out[i] += src[i] * k;
+	}
+}
+
+/* One tap of an erosion / dilation: out[i] = min / max(out[i], src[i]) */
+static void
+KERNEL(min_row)(float* restrict out, const float* restrict src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		out[i] = (src[i] < out[i]) ? src[i] : out[i];
+	}
+}
+
+static void
+KERNEL(max_row)(float* restrict out, const float* restrict src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		out[i] = (src[i] > out[i]) ? src[i] : out[i];
+	}
+}
+
+/*
+ * Sobel magnitude of n pixels whose rows above, at and below are r0, r1, r2.
+ * Reads r*[-1 .. n]. Taps are summed in the order of lpgm_sobel_into().
+ */
+static void
+KERNEL(sobel_row)(float* restrict out, const float* r0, const float* r1, const float* r2, int n)
+{
+	float gx, gy;
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		gx = 0.0f;
+		gx += r0[i - 1] * -1.0f;
+		gx += r0[i] * 0.0f;
+		gx += r0[i + 1] * 1.0f;
+		gx += r1[i - 1] * -2.0f;
+		gx += r1[i] * 0.0f;
+		gx += r1[i + 1] * 2.0f;
+		gx += r2[i - 1] * -1.0f;
+		gx += r2[i] * 0.0f;
+		gx += r2[i + 1] * 1.0f;
+
+		gy = 0.0f;
+		gy += r0[i - 1] * -1.0f;
+		gy += r0[i] * -2.0f;
+		gy += r0[i + 1] * -1.0f;
+		gy += r1[i - 1] * 0.0f;
+		gy += r1[i] * 0.0f;
+		gy += r1[i + 1] * 0.0f;
+		gy += r2[i - 1] * 1.0f;
+		gy += r2[i] * 2.0f;
+		gy += r2[i + 1] * 1.0f;
+
+		out[i] = KERNEL(clamp1)(sqrtf(gx * gx + gy * gy), 0.0f, 255.0f);
+	}
+}
+
+/* A variant may bring its own table lookup instead, see simd.c */
+#ifndef KERNEL_LUT_APPLY
+#define KERNEL_LUT_APPLY KERNEL(lut_apply)
+#define KERNEL_LUT_APPLY_DEFAULT
+
+/* dst[i] = lut[src[i]] for n bytes (dst may be src), eight per step so loads and stores overlap */
+static void
+KERNEL(lut_apply)(const unsigned char* src, unsigned char* dst, int n, const unsigned char* lut)
+{
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+	{
+		unsigned char a0 = lut[src[i]], a1 = lut[src[i + 1]], a2 = lut[src[i + 2]], a3 = lut[src[i + 3]];
+		unsigned char a4 = lut[src[i + 4]], a5 = lut[src[i + 5]], a6 = lut[src[i + 6]], a7 = lut[src[i + 7]];
+
+		dst[i] = a0;
+		dst[i + 1] = a1;
+		dst[i + 2] = a2;
+		dst[i + 3] = a3;
+		dst[i + 4] = a4;
+		dst[i + 5] = a5;
+		dst[i + 6] = a6;
+		dst[i + 7] = a7;
+	}
+	for (; i < n; ++i)
+	{
+		dst[i] = lut[src[i]];
+	}
+}
+
+#endif
+
+/* A variant may take the butterflies of another one instead, see simd.c */
+#ifndef KERNEL_FFT_STAGE
+#define KERNEL_FFT_STAGE KERNEL(fft_stage)
+#define KERNEL_FFT_STAGE_DEFAULT
+
+/*
+ * One radix-2 stage of lpgm_fft(): butterflies of size m over n points,
+ * twiddles[j] = W_m^j for j < m / 2.
+ */
+static void
+KERNEL(fft_stage)(lpgm_signal_t* data, int n, int m, const lpgm_signal_t* restrict twiddles)
+{
+	lpgm_signal_t* restrict even;
+	lpgm_signal_t* restrict odd;
+	float t_real, t_imag;
+	int k, j, m2;
+
+	m2 = m / 2;
+	for (k = 0; k < n; k += m)
+	{
+		even = data + k;
+		odd = data + k + m2;
+		for (j = 0; j < m2; ++j)
+		{
+			t_real = twiddles[j].real * odd[j].real - twiddles[j].imaginary * odd[j].imaginary;
+			t_imag = twiddles[j].real * odd[j].imaginary + twiddles[j].imaginary * odd[j].real;
+
+			odd[j].real = even[j].real - t_real;
+			odd[j].imaginary = even[j].imaginary - t_imag;
+
+			even[j].real = even[j].real + t_real;
+			even[j].imaginary = even[j].imaginary + t_imag;
+		}
+	}
+}
+
+#endif
+
+static const lpgm_kernels_t KERNEL(kernels) = {
+	KERNEL_LEVEL,
+	KERNEL(point_ops),
+	KERNEL(clamp),
+	KERNEL(min_max),
+	KERNEL(axpy),
+	KERNEL(min_row),
+	KERNEL(max_row),
+	KERNEL(sobel_row),
+	KERNEL_FFT_STAGE,
+	KERNEL_LUT_APPLY,
+};
+
+#ifdef KERNEL_FFT_STAGE_DEFAULT
+#undef KERNEL_FFT_STAGE
+#undef KERNEL_FFT_STAGE_DEFAULT
+#endif
+
+#ifdef KERNEL_LUT_APPLY_DEFAULT
+#undef KERNEL_LUT_APPLY
+#undef KERNEL_LUT_APPLY_DEFAULT
+#endif
@@ -0,0 +1,315 @@
+/*
+ * Multi-frame PGM streams
+ *
+ * Netpbm allows several PGM images to follow each other in one stream
+ * (e.g. a camera bridge writing frames to stdout). The reader decodes them
+ * one at a time into at most two buffers that are reused for every frame:
+ *
+ *   without prefetch: one slot, decoded on the caller thread by next()
+ *   with prefetch:    two slots, the caller processes one while a worker
+ *                     thread decodes the next frame into the other
+ *
+ * A slot only grows when a frame is larger than any before it, so a stream
+ * of same-sized frames allocates nothing after the first one.
+ */
+
+#include "internal.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct lpgm_frame_reader
+{
+	FILE* file_ptr;
+	int prefetch;            /* 1 if a worker thread decodes ahead */
+	lpgm_t slots[2];         /* Decoded frames, header and pixels */
+	int capacity[2];         /* Pixels allocated in each slot */
+	int frames_decoded;      /* Only touched by whoever is decoding */
+	lpgm_status_t finished;  /* LPGM_OK while frames remain, then LPGM_END or LPGM_FAIL */
+
+	/* Worker state, guarded by lock */
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int job_pending;         /* Worker must decode into job_slot */
+	int job_slot;
+	int ready;               /* Worker finished a job with ready_status */
+	lpgm_status_t ready_status;
+	int stop;
+};
+
+/*
+ * Decode the next frame of the stream into slot.
+ * Returns LPGM_OK, LPGM_END if the stream ends cleanly before a frame, or LPGM_FAIL.
+ */
+static lpgm_status_t
+decode_frame(lpgm_frame_reader_t* reader, int slot)
+{
+	lpgm_context_t* previous;
+	lpgm_t header;
+	lpgm_t* frame;
+	float* data;
+	int c, len, n;
+
+	/* Whitespace may separate frames; end of stream here is the normal end */
+	do
+	{
+		c = getc(reader->file_ptr);
+	} while (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f');
+	if (c == EOF)
+	{
+		return LPGM_END;
+	}
+	ungetc(c, reader->file_ptr);
+
+	if (lpgm_read_header_summary(reader->file_ptr, &header) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading header of frame [%d].", reader->frames_decoded);
+		return LPGM_FAIL;
+	}
+
+	if (!LPGM_SIZE_VALID(header.im.w, header.im.h))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid image size: [%d x %d].", header.im.w, header.im.h);
+		return LPGM_FAIL;
+	}
+
+	frame = &reader->slots[slot];
+	len = header.im.w * header.im.h;
+	if (len > reader->capacity[slot])
+	{
+		/* Slots outlive any frame, keep them out of a bound context */
+		previous = lpgm_context_bind(NULL);
+		data = (float*)lpgm_realloc(frame->im.data, (size_t)len * sizeof(float));
+		lpgm_context_bind(previous);
+		if (data == NULL)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+			return LPGM_FAIL;
+		}
+		frame->im.data = data;
+		reader->capacity[slot] = len;
+	}
+
+	memcpy(frame->magic_number, header.magic_number, sizeof(frame->magic_number));
+	frame->max_val = header.max_val;
+	frame->im.w = header.im.w;
+	frame->im.h = header.im.h;
+	frame->im.stride = header.im.w;
+	frame->im.is_view = 1;   /* The reader owns the pixels */
+
+	n = lpgm_read_raster(reader->file_ptr, &header, frame->im.data, len);
+	if (n != len)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Short frame [%d], expected [%d] pixels but read [%d].", reader->frames_decoded, len, n);
+		return LPGM_FAIL;
+	}
+	reader->frames_decoded++;
+
+	return LPGM_OK;
+}
+
+static void*
+prefetch_worker(void* arg)
+{
+	lpgm_frame_reader_t* reader = (lpgm_frame_reader_t*)arg;
+	lpgm_status_t status;
+	int slot;
+
+	pthread_mutex_lock(&reader->lock);
+	while (1)
+	{
+		while (!reader->job_pending && !reader->stop)
+		{
+			pthread_cond_wait(&reader->cond, &reader->lock);
+		}
+		if (reader->stop)
+		{
+			break;
+		}
+		slot = reader->job_slot;
+		pthread_mutex_unlock(&reader->lock);
+
+		status = decode_frame(reader, slot);
+
+		pthread_mutex_lock(&reader->lock);
+		reader->job_pending = 0;
+		reader->ready = 1;
+		reader->ready_status = status;
+		pthread_cond_broadcast(&reader->cond);
+	}
+	pthread_mutex_unlock(&reader->lock);
+
+	return NULL;
+}
+
+/* Set up a reader over an open stream; takes ownership of file_ptr. */
+static lpgm_frame_reader_t*
+make_reader(FILE* file_ptr, int prefetch)
+{
+	lpgm_context_t* previous;
+	lpgm_frame_reader_t* reader;
+
+	previous = lpgm_context_bind(NULL);
+	reader = (lpgm_frame_reader_t*)lpgm_calloc(1, sizeof(*reader));
+	lpgm_context_bind(previous);
+	if (reader == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		fclose(file_ptr);
+		return NULL;
+	}
+	setvbuf(file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+	reader->file_ptr = file_ptr;
+	reader->finished = LPGM_OK;
+
+	if (!prefetch)
+	{
+		return reader;
+	}
+
+	pthread_mutex_init(&reader->lock, NULL);
+	pthread_cond_init(&reader->cond, NULL);
+	reader->prefetch = 1;
+
+	/* Start decoding the first frame right away */
+	reader->job_pending = 1;
+	reader->job_slot = 0;
+	if (pthread_create(&reader->worker, NULL, prefetch_worker, reader) != 0)
+	{
+		/* No thread: fall back to decoding on the caller thread */
+		pthread_mutex_destroy(&reader->lock);
+		pthread_cond_destroy(&reader->cond);
+		reader->prefetch = 0;
+		reader->job_pending = 0;
+	}
+
+	return reader;
+}
+
+lpgm_frame_reader_t*
+lpgm_frame_reader_open(const char* file_name, int prefetch)
+{
+	FILE* file_ptr;
+
+	file_ptr = fopen(file_name, "rb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return NULL;
+	}
+
+	return make_reader(file_ptr, prefetch);
+}
+
+lpgm_frame_reader_t*
+lpgm_frame_reader_open_fd(int fd, int prefetch)
+{
+	FILE* file_ptr;
+	int dup_fd;
+
+	dup_fd = dup(fd);
+	if (dup_fd < 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid file descriptor: [%d].", fd);
+		return NULL;
+	}
+
+	file_ptr = fdopen(dup_fd, "rb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file descriptor: [%d].", fd);
+		close(dup_fd);
+		return NULL;
+	}
+
+	return make_reader(file_ptr, prefetch);
+}
+
+lpgm_status_t
+lpgm_frame_reader_next(lpgm_frame_reader_t* reader, lpgm_t** frame)
+{
+	lpgm_status_t status;
+	int slot;
+
+	if (reader == NULL || frame == NULL)
+	{
+		return LPGM_FAIL;
+	}
+	*frame = NULL;
+
+	if (reader->finished != LPGM_OK)
+	{
+		return reader->finished;
+	}
+
+	if (!reader->prefetch)
+	{
+		slot = 0;
+		status = decode_frame(reader, slot);
+	}
+	else
+	{
+		pthread_mutex_lock(&reader->lock);
+		while (!reader->ready)
+		{
+			pthread_cond_wait(&reader->cond, &reader->lock);
+		}
+		reader->ready = 0;
+		status = reader->ready_status;
+		slot = reader->job_slot;
+
+		/* Hand out the decoded slot, decode ahead into the one the caller gives back */
+		if (status == LPGM_OK)
+		{
+			reader->job_slot = 1 - slot;
+			reader->job_pending = 1;
+			pthread_cond_broadcast(&reader->cond);
+		}
+		pthread_mutex_unlock(&reader->lock);
+	}
+
+	if (status != LPGM_OK)
+	{
+		reader->finished = status;
+		return status;
+	}
+
+	*frame = &reader->slots[slot];
+
+	return LPGM_OK;
+}
+
+void
+lpgm_frame_reader_close(lpgm_frame_reader_t* reader)
+{
+	if (reader == NULL)
+	{
+		return;
+	}
+
+	if (reader->prefetch)
+	{
+		/* Let a decode in flight finish, then stop the worker */
+		pthread_mutex_lock(&reader->lock);
+		while (reader->job_pending)
+		{
+			pthread_cond_wait(&reader->cond, &reader->lock);
+		}
+		reader->stop = 1;
+		pthread_cond_broadcast(&reader->cond);
+		pthread_mutex_unlock(&reader->lock);
+
+		pthread_join(reader->worker, NULL);
+		pthread_mutex_destroy(&reader->lock);
+		pthread_cond_destroy(&reader->cond);
+	}
+
+	fclose(reader->file_ptr);
+	lpgm_free(reader->slots[0].im.data);
+	lpgm_free(reader->slots[1].im.data);
+	lpgm_free(reader);
+}
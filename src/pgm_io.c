@@ -1,8 +1,14 @@
-#include "../include/pigiem.h"
+#include "internal.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 enum lpgm_e_file_formats
 {
@@ -10,7 +16,28 @@ enum lpgm_e_file_formats
 	lpgm_e_file_formats_P5_binary
 };
 
-static enum lpgm_e_file_formats g_pgm_file_format_flag;
+/*
+ * Map a magic number to its file format. The format is always derived from
+ * the lpgm_t being read or written, so no state is shared between threads.
+ */
+static int
+file_format_of(const char* magic_number, enum lpgm_e_file_formats* format)
+{
+	if (strcmp(magic_number, "P5") == 0)
+	{
+		*format = lpgm_e_file_formats_P5_binary;
+	}
+	else if (strcmp(magic_number, "P2") == 0)
+	{
+		*format = lpgm_e_file_formats_P2_ascii;
+	}
+	else
+	{
+		return -1;
+	}
+
+	return 0;
+}
 
 static void
 go_new_line(FILE* file_ptr)
@@ -31,53 +58,82 @@ static int
 read_magic_number(FILE* file_ptr, lpgm_t* pgm)
 {
 	int c1, c2;
+	enum lpgm_e_file_formats format;
 
-	c1 = fgetc(file_ptr);
+	/* Whitespace before the magic number is skipped: it may end the previous image of a stream */
+	do
+	{
+		c1 = fgetc(file_ptr);
+	} while (c1 == ' ' || c1 == '\n' || c1 == '\t' || c1 == '\r' || c1 == '\v' || c1 == '\f');
 	c2 = fgetc(file_ptr);
 	if (c1 == EOF || c2 == EOF)
 	{
-		fprintf(stderr, "%s(): Unexpected end of file.\n", __func__);
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Unexpected end of file.");
 		return -1;
 	}
 	pgm->magic_number[0] = (char)c1;
 	pgm->magic_number[1] = (char)c2;
 	pgm->magic_number[2] = '\0';
 
-	if (strcmp(pgm->magic_number, "P5") == 0)
+	if (file_format_of(pgm->magic_number, &format) != 0)
 	{
-		g_pgm_file_format_flag = lpgm_e_file_formats_P5_binary;
-	}
-	else if (strcmp(pgm->magic_number, "P2") == 0)
-	{
-		g_pgm_file_format_flag = lpgm_e_file_formats_P2_ascii;
-	}
-	else
-	{
-		fprintf(stderr, "%s(): Your image type: [%s], type must be: [%s] or [%s]. \n", __func__, pgm->magic_number, "P5", "P2");
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Your image type: [%s], type must be: [%s] or [%s].", pgm->magic_number, "P5", "P2");
 		return -1;
 	}
 
-	fprintf(stdout, "%s(): Magic number: [%s]. \n", __func__, pgm->magic_number);
-
 	go_new_line(file_ptr);
 
 	return 0;
 }
 
+/* Append c to a comment of *len chars, growing it geometrically. Returns 0 or -1. */
+static int
+append_comment_char(char** text, int* len, int* capacity, char c)
+{
+	char* grown;
+	int new_capacity;
+
+	/* Keep room for the terminating '\0' */
+	if (*len + 1 >= *capacity)
+	{
+		new_capacity = (*capacity == 0) ? 64 : *capacity * 2;
+		grown = (char*)lpgm_realloc(*text, (size_t)new_capacity);
+		if (grown == NULL)
+		{
+			return -1;
+		}
+		*text = grown;
+		*capacity = new_capacity;
+	}
+	(*text)[(*len)++] = c;
+
+	return 0;
+}
+
+/*
+ * Read the comment lines that follow the magic number.
+ * They are joined into *comment, or skipped when comment is NULL.
+ */
 static int
-read_comments(FILE* file_ptr, lpgm_t* pgm)
+read_comments(FILE* file_ptr, char** comment)
 {
 	int c;
-	int i, start_line_flag;
+	int i, capacity, start_line_flag;
+	char* text;
 
-	pgm->comment = NULL;
+	text = NULL;
 	i = 0;
+	capacity = 0;
 	start_line_flag = 1;
 	while (1)
 	{
 		c = fgetc(file_ptr);
 		if (c == EOF)
 		{
+			if (text != NULL)
+			{
+				text[i] = '\0';
+			}
 			break;
 		}
 
@@ -89,37 +145,43 @@ read_comments(FILE* file_ptr, lpgm_t* pgm)
 		{
 			if (i > 0)
 			{
-				pgm->comment[i - 1] = '\0'; // delete ' '
+				text[i - 1] = '\0'; // delete ' '
 			}
-			fseek(file_ptr, -1L, SEEK_CUR); // -1 back, go start
+			ungetc(c, file_ptr); // give back, go start
 			break;
 		}
 		else if (start_line_flag == 0 && c == '\n') // new line
 		{
 			start_line_flag = 1;
 
-			pgm->comment = realloc(pgm->comment, (i + 1) * sizeof(char));
-			pgm->comment[i] = ' ';
-			++i;
+			if (comment != NULL && append_comment_char(&text, &i, &capacity, ' ') != 0)
+			{
+				lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+				lpgm_free(text);
+				return -1;
+			}
 		}
 		else if (start_line_flag == 0 && c != '\n') // store comments
 		{
-			pgm->comment = realloc(pgm->comment, (i + 1) * sizeof(char));
-			pgm->comment[i] = c;
-			++i;
+			if (comment != NULL && append_comment_char(&text, &i, &capacity, (char)c) != 0)
+			{
+				lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+				lpgm_free(text);
+				return -1;
+			}
 		}
 	}
 
-	if (i > 0)
+	if (comment != NULL)
 	{
-		fprintf(stdout, "%s(): Comment: [%s]. \n", __func__, pgm->comment);
+		*comment = text;
 	}
 
 	return 0;
 }
 
 static int
-read_height_and_weight(FILE* file_ptr, lpgm_t* pgm)
+read_width_and_height(FILE* file_ptr, lpgm_t* pgm)
 {
 	int c;
 	char buffer[64];
@@ -131,20 +193,20 @@ read_height_and_weight(FILE* file_ptr, lpgm_t* pgm)
 		c = fgetc(file_ptr);
 		if (c == EOF)
 		{
-			fprintf(stderr, "%s(): Unexpected end of file.\n", __func__);
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Unexpected end of file.");
 			return -1;
 		}
 
-		if (c == '\n') // end
+		if (c == '\n') // height end
 		{
 			buffer[array_location] = '\0';
-			pgm->im.w = atoi(buffer); // w
+			pgm->im.h = atoi(buffer);
 			break;
 		}
-		else if (c == ' ') // height end
+		else if (c == ' ') // width end
 		{
 			buffer[array_location] = '\0';
-			pgm->im.h = atoi(buffer);
+			pgm->im.w = atoi(buffer);
 			array_location = 0;
 		}
 
@@ -154,8 +216,6 @@ read_height_and_weight(FILE* file_ptr, lpgm_t* pgm)
 			++array_location;
 		}
 	}
-	fprintf(stdout, "%s(): Height: [%d] , weight: [%d]. \n", __func__, pgm->im.h, pgm->im.w);
-
 	return 0;
 }
 
@@ -165,7 +225,7 @@ read_max_pixel_value(FILE* file_ptr, lpgm_t* pgm)
 	int c;
 	int array_location;
 	char buffer[64];
-	const int max_value_L = 255;
+	const int max_value_L = 65535;
 
 	array_location = 0;
 	while (1)
@@ -173,7 +233,7 @@ read_max_pixel_value(FILE* file_ptr, lpgm_t* pgm)
 		c = fgetc(file_ptr);
 		if (c == EOF)
 		{
-			fprintf(stderr, "%s(): Unexpected end of file.\n", __func__);
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Unexpected end of file.");
 			return -1;
 		}
 
@@ -191,174 +251,1944 @@ read_max_pixel_value(FILE* file_ptr, lpgm_t* pgm)
 		}
 	}
 
-	if (pgm->max_val != max_value_L)
+	/* 1 .. 255: one byte per P5 sample, 256 .. 65535: two bytes, big-endian */
+	if (pgm->max_val < 1 || pgm->max_val > max_value_L)
 	{
-		fprintf(stderr, "%s(): Max_val: [%d] max_value_L: [%d]. \n", __func__, pgm->max_val, max_value_L);
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Max_val: [%d] must be in [1, %d].", pgm->max_val, max_value_L);
 		return -1;
 	}
-	fprintf(stdout, "%s(): Max_val: [%d] \n", __func__, pgm->max_val);
 
 	return 0;
 }
 
-static int
-read_pixel_data(FILE* file_ptr, lpgm_t* pgm)
+/*
+ * Read the whole header (magic number, comments, size and max value).
+ * Leaves the stream at the first raster byte. On failure pgm->comment is freed.
+ */
+int
+lpgm_read_header(FILE* file_ptr, lpgm_t* pgm)
 {
-	int i;
+	pgm->comment = NULL;
+	pgm->im.data = NULL;
 
-	pgm->im.data = (float*)calloc(pgm->im.w * pgm->im.h, sizeof(float));
-	if (pgm->im.data == NULL)
+	if (read_magic_number(file_ptr, pgm) != 0 || read_comments(file_ptr, &pgm->comment) != 0 ||
+	    read_width_and_height(file_ptr, pgm) != 0 || read_max_pixel_value(file_ptr, pgm) != 0)
 	{
-		fprintf(stderr, "%s(): Memory allocation failed.\n", __func__);
+		lpgm_free(pgm->comment);
+		pgm->comment = NULL;
 		return -1;
 	}
 
-	i = 0;
-	while (1)
+	return 0;
+}
+
+/*
+ * Same as lpgm_read_header(), but the comment is skipped rather than stored
+ * (pgm->comment is NULL), so nothing is allocated.
+ */
+int
+lpgm_read_header_summary(FILE* file_ptr, lpgm_t* pgm)
+{
+	pgm->comment = NULL;
+	pgm->im.data = NULL;
+
+	if (read_magic_number(file_ptr, pgm) != 0 || read_comments(file_ptr, NULL) != 0 ||
+	    read_width_and_height(file_ptr, pgm) != 0 || read_max_pixel_value(file_ptr, pgm) != 0)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Block converters from raw P5 bytes. Plain counted loops without branches
+ * so the compiler can vectorize them; 16-bit samples are big-endian.
+ */
+static void
+widen_u8_to_float(const unsigned char* src, float* dst, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+	{
+		dst[i] = (float)src[i];
+	}
+}
+
+static void
+widen_be16_to_float(const unsigned char* src, float* dst, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+	{
+		dst[i] = (float)(((unsigned int)src[2 * i] << 8) | src[2 * i + 1]);
+	}
+}
+
+static void
+widen_u8_to_u16(const unsigned char* src, unsigned short* dst, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+	{
+		dst[i] = src[i];
+	}
+}
+
+static void
+swap_be16_to_u16(const unsigned char* src, unsigned short* dst, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+	{
+		dst[i] = (unsigned short)(((unsigned int)src[2 * i] << 8) | src[2 * i + 1]);
+	}
+}
+
+/*
+ * Parse up to count plain (P2) samples from the stream.
+ *
+ * Samples are always non-negative decimal integers, so they are accumulated
+ * digit by digit straight from the stdio buffer instead of going through
+ * fscanf("%f"). Any whitespace separates samples and '#' starts a comment
+ * that runs to the end of the line. If out is NULL samples are only counted.
+ * Returns the number of samples parsed, or -1 on an invalid character.
+ */
+static int
+parse_p2_values(FILE* file_ptr, float* out, int count)
+{
+	int c, n, in_number;
+	unsigned int value;
+
+	n = 0;
+	value = 0;
+	in_number = 0;
+
+	flockfile(file_ptr);
+	while (n < count)
 	{
-		if (g_pgm_file_format_flag == lpgm_e_file_formats_P2_ascii)
+		c = getc_unlocked(file_ptr);
+		if (c >= '0' && c <= '9')
+		{
+			value = value * 10 + (unsigned int)(c - '0');
+			in_number = 1;
+			continue;
+		}
+
+		if (in_number)
 		{
-			if (fscanf(file_ptr, "%f", &pgm->im.data[i]) != 1)
+			if (out != NULL)
 			{
-				break;
+				out[n] = (float)value;
 			}
+			++n;
+			value = 0;
+			in_number = 0;
+		}
+
+		if (c == EOF)
+		{
+			break;
 		}
-		else if (g_pgm_file_format_flag == lpgm_e_file_formats_P5_binary)
+		else if (c == '#')
 		{
-			pgm->im.data[i] = (float)fgetc(file_ptr);
+			do
+			{
+				c = getc_unlocked(file_ptr);
+			} while (c != '\n' && c != '\r' && c != EOF);
 		}
-		++i;
-
-		if (feof(file_ptr))
+		else if (c != ' ' && c != '\n' && c != '\t' && c != '\r' && c != '\v' && c != '\f')
 		{
+			n = -1;
 			break;
 		}
 	}
-	fprintf(stdout, "%s(): Readed [%d] pixels from file. \n", __func__, i);
+	funlockfile(file_ptr);
 
-	return 0;
+	return n;
 }
 
-lpgm_status_t
-lpgm_file_read(const char* file_name, lpgm_t* pgm)
+/* Below this raster size spawning threads costs more than it saves */
+#define LPGM_P2_PARALLEL_MIN_BYTES (1024 * 1024)
+
+/* Shared state of a multi-threaded P2 parse */
+typedef struct
 {
-	FILE* file_ptr;
+	char* buffer;   /* Whole P2 raster text */
+	size_t* bounds; /* Chunk i is buffer[bounds[i] .. bounds[i + 1]) */
+	int* counts;    /* Samples found in each chunk */
+	int* offsets;   /* First output sample of each chunk */
+	float* out;
+	int len;        /* Samples wanted in total */
+	int pass;       /* 0: count samples, 1: store samples */
+	int error;
+} p2_parallel_job_t;
 
-	file_ptr = fopen(file_name, "r");
-	if (file_ptr == NULL)
+static void
+p2_parallel_task(void* ctx, int index)
+{
+	p2_parallel_job_t* job = (p2_parallel_job_t*)ctx;
+	FILE* chunk_ptr;
+	size_t chunk_len;
+	int n, want;
+
+	want = INT_MAX;
+	chunk_len = job->bounds[index + 1] - job->bounds[index];
+	if (chunk_len == 0)
 	{
-		fprintf(stderr, "%s(): Error opening file: [%s]. \n", __func__, file_name);
-		return LPGM_FAIL;
+		job->counts[index] = 0;
+		return;
 	}
 
-	if (read_magic_number(file_ptr, pgm) != 0)
+	if (job->pass == 1)
 	{
-		fprintf(stderr, "%s(): Error reading magic number from file: [%s]. \n", __func__, file_name);
-		fclose(file_ptr);
-		return LPGM_FAIL;
+		want = job->len - job->offsets[index];
+		if (want > job->counts[index])
+		{
+			want = job->counts[index];
+		}
+		if (want <= 0)
+		{
+			return;
+		}
 	}
 
-	if (read_comments(file_ptr, pgm) != 0)
+	chunk_ptr = fmemopen(job->buffer + job->bounds[index], chunk_len, "r");
+	if (chunk_ptr == NULL)
 	{
-		fprintf(stderr, "%s(): Error reading comments from file: [%s]. \n", __func__, file_name);
-		fclose(file_ptr);
-		return LPGM_FAIL;
+		job->error = 1;
+		return;
 	}
 
-	if (read_height_and_weight(file_ptr, pgm) != 0)
+	if (job->pass == 0)
 	{
-		fprintf(stderr, "%s(): Error reading height and weight from file: [%s]. \n", __func__, file_name);
-		fclose(file_ptr);
-		return LPGM_FAIL;
+		n = parse_p2_values(chunk_ptr, NULL, want);
+		job->counts[index] = n;
 	}
-
-	if (read_max_pixel_value(file_ptr, pgm) != 0)
+	else
 	{
-		fprintf(stderr, "%s(): Error reading max pixel value from file: [%s]. \n", __func__, file_name);
-		fclose(file_ptr);
-		return LPGM_FAIL;
+		n = parse_p2_values(chunk_ptr, job->out + job->offsets[index], want);
 	}
 
-	if (read_pixel_data(file_ptr, pgm) != 0)
+	if (n < 0)
 	{
-		fprintf(stderr, "%s(): Error reading pixel data from file: [%s]. \n", __func__, file_name);
-		fclose(file_ptr);
-		return LPGM_FAIL;
+		job->error = 1;
 	}
-
-	// close file
-	fclose(file_ptr);
-
-	return LPGM_OK;
+	fclose(chunk_ptr);
 }
 
 /*
- * write pgm struct data to file
+ * Multi-threaded P2 parse: load the rest of the file, split it at line
+ * breaks (a comment never spans a line break), count the samples of each
+ * chunk in parallel, then parse each chunk into its slice of the output.
+ * Returns the number of samples stored, -1 on a parse error, or -2 when the
+ * stream cannot be split (the caller then falls back to the serial parser).
  */
-lpgm_status_t
-lpgm_file_write(const lpgm_t* pgm, const char* file_name)
+static int
+read_p2_pixel_data_parallel(FILE* file_ptr, float* out, int len, int num_threads)
 {
-	FILE* file_ptr = NULL;
-	int i, j;
+	struct stat st;
+	long start;
+	size_t size, i;
+	int t, total;
+	p2_parallel_job_t job;
 
-	if (g_pgm_file_format_flag == lpgm_e_file_formats_P5_binary)
+	start = ftell(file_ptr);
+	if (start < 0 || fstat(fileno(file_ptr), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= start)
 	{
-		file_ptr = fopen(file_name, "wb");
+		return -2;
 	}
-	else if (g_pgm_file_format_flag == lpgm_e_file_formats_P2_ascii)
+
+	size = (size_t)(st.st_size - start);
+	if (size < LPGM_P2_PARALLEL_MIN_BYTES)
 	{
-		file_ptr = fopen(file_name, "w");
+		return -2;
 	}
 
-	if (file_ptr == NULL)
+	memset(&job, 0, sizeof(job));
+	job.buffer = (char*)lpgm_malloc(size);
+	job.bounds = (size_t*)lpgm_malloc((num_threads + 1) * sizeof(size_t));
+	job.counts = (int*)lpgm_calloc(num_threads, sizeof(int));
+	job.offsets = (int*)lpgm_calloc(num_threads, sizeof(int));
+	if (job.buffer == NULL || job.bounds == NULL || job.counts == NULL || job.offsets == NULL)
 	{
-		fprintf(stderr, "%s(): Error opening file: [%s]. \n", __func__, file_name);
-		return LPGM_FAIL;
+		lpgm_free(job.buffer);
+		lpgm_free(job.bounds);
+		lpgm_free(job.counts);
+		lpgm_free(job.offsets);
+		return -2;
 	}
 
-	// write file header
-	if (pgm->comment == NULL)
+	size = fread(job.buffer, 1, size, file_ptr);
+
+	/* Chunk boundaries: just past the first line break after each even split */
+	job.bounds[0] = 0;
+	for (t = 1; t < num_threads; ++t)
 	{
-		fprintf(file_ptr, "%s\n%d %d\n%d\n", pgm->magic_number, pgm->im.h, pgm->im.w, pgm->max_val);
+		i = size / num_threads * t;
+		if (i < job.bounds[t - 1])
+		{
+			i = job.bounds[t - 1];
+		}
+		while (i < size && job.buffer[i] != '\n')
+		{
+			++i;
+		}
+		job.bounds[t] = (i < size) ? i + 1 : size;
 	}
-	else
+	job.bounds[num_threads] = size;
+
+	job.out = out;
+	job.len = len;
+
+	job.pass = 0;
+	lpgm_parallel_run(num_threads, p2_parallel_task, &job);
+
+	total = 0;
+	for (t = 0; t < num_threads && job.error == 0; ++t)
+	{
+		job.offsets[t] = total;
+		total += job.counts[t];
+	}
+
+	if (job.error == 0)
+	{
+		job.pass = 1;
+		lpgm_parallel_run(num_threads, p2_parallel_task, &job);
+	}
+
+	lpgm_free(job.buffer);
+	lpgm_free(job.bounds);
+	lpgm_free(job.counts);
+	lpgm_free(job.offsets);
+
+	if (job.error != 0)
+	{
+		return -1;
+	}
+
+	return (total < len) ? total : len;
+}
+
+/*
+ * Read the P5 raster in large blocks and convert each block to float (out)
+ * or to native uint16 (out16). Returns the number of samples actually read.
+ */
+static int
+read_p5_pixel_data(FILE* file_ptr, float* out, unsigned short* out16, int len, int sample_bytes)
+{
+	unsigned char block[LPGM_IO_BLOCK_SIZE];
+	size_t total, want, got;
+
+	total = 0;
+	while (total < (size_t)len)
 	{
-		fprintf(file_ptr, "%s\n#%s\n%d %d\n%d\n", pgm->magic_number, pgm->comment, pgm->im.h, pgm->im.w, pgm->max_val);
+		want = ((size_t)len - total) * sample_bytes;
+		if (want > sizeof(block))
+		{
+			want = sizeof(block);
+		}
+
+		got = fread(block, 1, want, file_ptr) / sample_bytes;
+		if (sample_bytes == 1 && out != NULL)
+		{
+			widen_u8_to_float(block, out + total, got);
+		}
+		else if (sample_bytes == 1)
+		{
+			widen_u8_to_u16(block, out16 + total, got);
+		}
+		else if (out != NULL)
+		{
+			widen_be16_to_float(block, out + total, got);
+		}
+		else
+		{
+			swap_be16_to_u16(block, out16 + total, got);
+		}
+		total += got;
+
+		if (got * sample_bytes < want)
+		{
+			break;
+		}
 	}
 
-	// write image data
-	for (i = 0; i < pgm->im.h; ++i)
+	return (int)total;
+}
+
+/*
+ * Same as read_p5_pixel_data() into float, but straight from fd with read(),
+ * asking for no more bytes than the raster has left so nothing past it is consumed.
+ */
+static int
+read_p5_pixel_data_fd(int fd, float* out, int len, int sample_bytes)
+{
+	unsigned char block[LPGM_IO_BLOCK_SIZE];
+	size_t total, want, got;
+	ssize_t n;
+
+	total = 0;
+	while (total < (size_t)len)
 	{
-		for (j = 0; j < pgm->im.w; ++j)
+		want = ((size_t)len - total) * sample_bytes;
+		if (want > sizeof(block))
+		{
+			want = sizeof(block);
+		}
+
+		/* A pipe may return less than asked: fill the block, keeping whole samples */
+		got = 0;
+		while (got < want)
 		{
-			if (g_pgm_file_format_flag == lpgm_e_file_formats_P5_binary)
+			n = read(fd, block + got, want - got);
+			if (n < 0 && errno == EINTR)
 			{
-				fputc((unsigned char)pgm->im.data[i * pgm->im.w + j], file_ptr);
+				continue;
 			}
-			else if (g_pgm_file_format_flag == lpgm_e_file_formats_P2_ascii)
+			if (n <= 0)
 			{
-				fprintf(file_ptr, "%d ", (int)pgm->im.data[i * pgm->im.w + j]);
+				break;
 			}
+			got += (size_t)n;
+		}
+
+		got /= sample_bytes;
+		if (sample_bytes == 1)
+		{
+			widen_u8_to_float(block, out + total, got);
+		}
+		else
+		{
+			widen_be16_to_float(block, out + total, got);
 		}
-		if (g_pgm_file_format_flag == lpgm_e_file_formats_P2_ascii)
+		total += got;
+
+		if (got * sample_bytes < want)
 		{
-			fprintf(file_ptr, "%c", '\n');
+			break;
 		}
 	}
 
-	// close file
-	fclose(file_ptr);
+	return (int)total;
+}
 
-	return LPGM_OK;
+/*
+ * Read count samples of the raster into out, in the format and sample size
+ * given by header. Returns the number of samples read, or -1 on a parse error.
+ */
+int
+lpgm_read_raster(FILE* file_ptr, const lpgm_t* header, float* out, int count)
+{
+	enum lpgm_e_file_formats format;
+
+	if (file_format_of(header->magic_number, &format) != 0)
+	{
+		return -1;
+	}
+
+	if (format == lpgm_e_file_formats_P5_binary)
+	{
+		return read_p5_pixel_data(file_ptr, out, NULL, count, LPGM_SAMPLE_BYTES(header->max_val));
+	}
+
+	return parse_p2_values(file_ptr, out, count);
 }
 
-void
-lpgm_file_destroy(lpgm_t* pgm)
+/* Same as lpgm_read_raster(), but keeps the samples as native uint16. */
+int
+lpgm_read_raster_u16(FILE* file_ptr, const lpgm_t* header, unsigned short* out, int count)
 {
-	if (pgm->comment != NULL)
+	float block[LPGM_IO_BLOCK_SIZE / sizeof(float)];
+	enum lpgm_e_file_formats format;
+	int total, want, got, i;
+
+	if (file_format_of(header->magic_number, &format) != 0)
 	{
-		free(pgm->comment);
-		pgm->comment = NULL;
+		return -1;
 	}
-	lpgm_image_destroy(&pgm->im);
+
+	if (format == lpgm_e_file_formats_P5_binary)
+	{
+		return read_p5_pixel_data(file_ptr, NULL, out, count, LPGM_SAMPLE_BYTES(header->max_val));
+	}
+
+	/* P2: parse a block of samples at a time, then narrow */
+	total = 0;
+	while (total < count)
+	{
+		want = count - total;
+		if (want > (int)(sizeof(block) / sizeof(block[0])))
+		{
+			want = (int)(sizeof(block) / sizeof(block[0]));
+		}
+
+		got = parse_p2_values(file_ptr, block, want);
+		if (got < 0)
+		{
+			return -1;
+		}
+		for (i = 0; i < got; ++i)
+		{
+			out[total + i] = (unsigned short)block[i];
+		}
+		total += got;
+
+		if (got < want)
+		{
+			break;
+		}
+	}
+
+	return total;
+}
+
+/* Same as lpgm_read_raster() for 8-bit files, keeping the samples as uint8. */
+static int
+read_raster_u8(FILE* file_ptr, const lpgm_t* header, unsigned char* out, int count)
+{
+	float block[LPGM_IO_BLOCK_SIZE / sizeof(float)];
+	enum lpgm_e_file_formats format;
+	int total, want, got, i;
+
+	if (file_format_of(header->magic_number, &format) != 0)
+	{
+		return -1;
+	}
+
+	if (format == lpgm_e_file_formats_P5_binary)
+	{
+		return (int)fread(out, 1, count, file_ptr);
+	}
+
+	/* P2: parse a block of samples at a time, then narrow */
+	total = 0;
+	while (total < count)
+	{
+		want = count - total;
+		if (want > (int)(sizeof(block) / sizeof(block[0])))
+		{
+			want = (int)(sizeof(block) / sizeof(block[0]));
+		}
+
+		got = parse_p2_values(file_ptr, block, want);
+		if (got < 0)
+		{
+			return -1;
+		}
+		for (i = 0; i < got; ++i)
+		{
+			out[total + i] = (unsigned char)((block[i] > 255.0f) ? 255.0f : block[i]);
+		}
+		total += got;
+
+		if (got < want)
+		{
+			break;
+		}
+	}
+
+	return total;
+}
+
+/*
+ * Move rows stored packed (w floats apart) at the start of im->data to their
+ * stride, last row first so no row is overwritten before it is moved.
+ */
+static void
+unpack_rows(lpgm_image_t* im)
+{
+	int stride, i;
+
+	stride = LPGM_STRIDE(im);
+	if (stride == im->w)
+	{
+		return;
+	}
+
+	for (i = im->h - 1; i > 0; --i)
+	{
+		memmove(im->data + (size_t)i * stride, im->data + (size_t)i * im->w, (size_t)im->w * sizeof(float));
+	}
+	for (i = 0; i < im->h; ++i)
+	{
+		memset(im->data + (size_t)i * stride + im->w, 0, (size_t)(stride - im->w) * sizeof(float));
+	}
+}
+
+/*
+ * Read the raster of pgm into a new image. With fd >= 0 the stream is an
+ * unbuffered one over fd and the raster must not be read past its end:
+ * P5 samples then come straight from fd and P2 is parsed serially.
+ */
+static int
+read_pixel_data(FILE* file_ptr, int fd, lpgm_t* pgm)
+{
+	int len, i;
+	enum lpgm_e_file_formats format;
+
+	if (file_format_of(pgm->magic_number, &format) != 0)
+	{
+		return -1;
+	}
+
+	if (!LPGM_SIZE_VALID(pgm->im.w, pgm->im.h))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid image size: [%d x %d].", pgm->im.w, pgm->im.h);
+		return -1;
+	}
+
+	pgm->im = lpgm_make_image_uninit(pgm->im.w, pgm->im.h);
+	if (pgm->im.data == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		return -1;
+	}
+	len = pgm->im.w * pgm->im.h;
+
+	/* Parse packed into the front of the buffer, then spread the rows to their stride */
+	if (format == lpgm_e_file_formats_P5_binary && fd >= 0)
+	{
+		i = read_p5_pixel_data_fd(fd, pgm->im.data, len, LPGM_SAMPLE_BYTES(pgm->max_val));
+	}
+	else if (format == lpgm_e_file_formats_P2_ascii && fd < 0 && lpgm_get_num_threads() > 1)
+	{
+		i = read_p2_pixel_data_parallel(file_ptr, pgm->im.data, len, lpgm_get_num_threads());
+		if (i == -2)
+		{
+			i = lpgm_read_raster(file_ptr, pgm, pgm->im.data, len);
+		}
+	}
+	else
+	{
+		i = lpgm_read_raster(file_ptr, pgm, pgm->im.data, len);
+	}
+
+	if (i < 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid character in pixel data.");
+		lpgm_image_destroy(&pgm->im);
+		return -1;
+	}
+
+	if (i != len)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Short file, expected [%d] pixels but read [%d].", len, i);
+		lpgm_image_destroy(&pgm->im);
+		return -1;
+	}
+	unpack_rows(&pgm->im);
+	lpgm_log(LPGM_LOG_INFO, __func__, "Readed [%d] pixels from file.", i);
+
+	return 0;
+}
+
+/*
+ * Read a whole PGM (header and raster) from an open stream into pgm; fd as in read_pixel_data().
+ * caller and source only label the messages, e.g. "lpgm_file_read" and a file name.
+ */
+static int
+read_pgm(FILE* file_ptr, int fd, lpgm_t* pgm, const char* caller, const char* source)
+{
+	if (lpgm_read_header(file_ptr, pgm) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Error reading header from: [%s].", source);
+		return -1;
+	}
+
+	lpgm_log(LPGM_LOG_INFO, caller, "Magic number: [%s].", pgm->magic_number);
+	if (pgm->comment != NULL)
+	{
+		lpgm_log(LPGM_LOG_INFO, caller, "Comment: [%s].", pgm->comment);
+	}
+	lpgm_log(LPGM_LOG_INFO, caller, "Width: [%d] , height: [%d].", pgm->im.w, pgm->im.h);
+	lpgm_log(LPGM_LOG_INFO, caller, "Max_val: [%d]", pgm->max_val);
+
+	if (read_pixel_data(file_ptr, fd, pgm) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Error reading pixel data from: [%s].", source);
+		lpgm_free(pgm->comment);
+		pgm->comment = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+lpgm_status_t
+lpgm_file_read(const char* file_name, lpgm_t* pgm)
+{
+	FILE* file_ptr;
+	int status;
+
+	file_ptr = fopen(file_name, "rb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	status = read_pgm(file_ptr, -1, pgm, __func__, file_name);
+
+	// close file
+	fclose(file_ptr);
+
+	return (status == 0) ? LPGM_OK : LPGM_FAIL;
+}
+
+/*
+ * Decode a PGM held in memory
+ *
+ * The buffer is read in place through a read-only memory stream, so the
+ * same parsers as lpgm_file_read() run without any temporary file.
+ */
+lpgm_status_t
+lpgm_mem_read(const void* data, size_t size, lpgm_t* pgm)
+{
+	FILE* file_ptr;
+	int status;
+
+	if (data == NULL || size == 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Empty input buffer.");
+		return LPGM_FAIL;
+	}
+
+	file_ptr = fmemopen((void*)data, size, "rb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening memory stream.");
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	status = read_pgm(file_ptr, -1, pgm, __func__, "memory");
+	fclose(file_ptr);
+
+	return (status == 0) ? LPGM_OK : LPGM_FAIL;
+}
+
+/*
+ * Decode a PGM from an open file descriptor (pipe, socket, shared memory file)
+ *
+ * Reads through a duplicate of fd, so fd itself stays open. Nothing past the
+ * image is consumed, so several images can be read back-to-back from one
+ * pipe: the header goes through an unbuffered stream (one byte per read()),
+ * then a P5 raster is read() in blocks of exactly the bytes left. A P2
+ * raster is parsed byte by byte and ends at the delimiter after its last sample.
+ */
+lpgm_status_t
+lpgm_fd_read(int fd, lpgm_t* pgm)
+{
+	FILE* file_ptr;
+	int dup_fd, status;
+	char source[32];
+
+	snprintf(source, sizeof(source), "fd %d", fd);
+
+	dup_fd = dup(fd);
+	if (dup_fd < 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid file descriptor: [%d].", fd);
+		return LPGM_FAIL;
+	}
+
+	file_ptr = fdopen(dup_fd, "rb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file descriptor: [%d].", fd);
+		close(dup_fd);
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IONBF, 0);
+
+	status = read_pgm(file_ptr, dup_fd, pgm, __func__, source);
+	fclose(file_ptr);
+
+	return (status == 0) ? LPGM_OK : LPGM_FAIL;
+}
+
+/*
+ * Read only the header of a PGM file
+ *
+ * Runs the same magic number, comment, size and max value readers as
+ * lpgm_file_read() through a small stdio buffer, skips storing the comment,
+ * never touches the raster and prints nothing on success.
+ */
+lpgm_status_t
+lpgm_file_probe(const char* file_name, lpgm_info_t* info)
+{
+	FILE* file_ptr;
+	char probe_buffer[512];
+	lpgm_t header;
+	int status;
+
+	file_ptr = fopen(file_name, "rb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+	/* Headers are tiny: do not let stdio read a whole default-sized block */
+	setvbuf(file_ptr, probe_buffer, _IOFBF, sizeof(probe_buffer));
+
+	status = lpgm_read_header_summary(file_ptr, &header);
+	fclose(file_ptr);
+
+	if (status != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading header from file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+
+	memcpy(info->magic_number, header.magic_number, sizeof(info->magic_number));
+	info->max_val = header.max_val;
+	info->w = header.im.w;
+	info->h = header.im.h;
+
+	return LPGM_OK;
+}
+
+/*
+ * Read a PGM file keeping the samples as native uint16 (8- or 16-bit files).
+ * The header summary goes to info, the comment is skipped.
+ */
+lpgm_status_t
+lpgm_file_read_u16(const char* file_name, lpgm_image_u16_t* im, lpgm_info_t* info)
+{
+	FILE* file_ptr;
+	lpgm_t header;
+	int len, n;
+
+	im->w = 0;
+	im->h = 0;
+	im->data = NULL;
+
+	file_ptr = fopen(file_name, "rb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	if (lpgm_read_header_summary(file_ptr, &header) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading header from file: [%s].", file_name);
+		fclose(file_ptr);
+		return LPGM_FAIL;
+	}
+
+	if (!LPGM_SIZE_VALID(header.im.w, header.im.h))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid image size: [%d x %d].", header.im.w, header.im.h);
+		fclose(file_ptr);
+		return LPGM_FAIL;
+	}
+
+	*im = lpgm_make_empty_image_u16(header.im.w, header.im.h);
+	if (im->data == NULL)
+	{
+		fclose(file_ptr);
+		return LPGM_FAIL;
+	}
+
+	len = header.im.w * header.im.h;
+	n = lpgm_read_raster_u16(file_ptr, &header, im->data, len);
+	fclose(file_ptr);
+
+	if (n != len)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading pixel data from file: [%s], expected [%d] pixels but read [%d].",
+		        file_name, len, n);
+		lpgm_image_u16_destroy(im);
+		return LPGM_FAIL;
+	}
+
+	if (info != NULL)
+	{
+		memcpy(info->magic_number, header.magic_number, sizeof(info->magic_number));
+		info->max_val = header.max_val;
+		info->w = header.im.w;
+		info->h = header.im.h;
+	}
+
+	return LPGM_OK;
+}
+
+/*
+ * Read an 8-bit PGM file keeping the samples as native uint8, row by row
+ * into the aligned image. The header summary goes to info, the comment is skipped.
+ */
+lpgm_status_t
+lpgm_file_read_u8(const char* file_name, lpgm_image_u8_t* im, lpgm_info_t* info)
+{
+	FILE* file_ptr;
+	lpgm_t header;
+	int i, n;
+
+	im->w = 0;
+	im->h = 0;
+	im->data = NULL;
+	im->stride = 0;
+	im->is_view = 0;
+
+	file_ptr = fopen(file_name, "rb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	if (lpgm_read_header_summary(file_ptr, &header) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading header from file: [%s].", file_name);
+		fclose(file_ptr);
+		return LPGM_FAIL;
+	}
+
+	if (header.max_val > 255)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Max_val: [%d] needs 16-bit samples, use lpgm_file_read_u16().", header.max_val);
+		fclose(file_ptr);
+		return LPGM_FAIL;
+	}
+
+	if (!LPGM_SIZE_VALID(header.im.w, header.im.h))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid image size: [%d x %d].", header.im.w, header.im.h);
+		fclose(file_ptr);
+		return LPGM_FAIL;
+	}
+
+	*im = lpgm_make_empty_image_u8(header.im.w, header.im.h);
+	if (im->data == NULL)
+	{
+		fclose(file_ptr);
+		return LPGM_FAIL;
+	}
+
+	n = header.im.w;
+	for (i = 0; i < header.im.h && n == header.im.w; ++i)
+	{
+		n = read_raster_u8(file_ptr, &header, LPGM_U8_ROW(im, i), header.im.w);
+	}
+	fclose(file_ptr);
+
+	if (n != header.im.w)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading pixel data from file: [%s], short or invalid row [%d].", file_name,
+		        i - 1);
+		lpgm_image_u8_destroy(im);
+		return LPGM_FAIL;
+	}
+
+	if (info != NULL)
+	{
+		memcpy(info->magic_number, header.magic_number, sizeof(info->magic_number));
+		info->max_val = header.max_val;
+		info->w = header.im.w;
+		info->h = header.im.h;
+	}
+
+	return LPGM_OK;
+}
+
+/* "00" "01" ... "99": two output digits per table lookup */
+static const char g_digit_pairs[200 + 1] =
+	"00010203040506070809101112131415161718192021222324"
+	"25262728293031323334353637383940414243444546474849"
+	"50515253545556575859606162636465666768697071727374"
+	"75767778798081828384858687888990919293949596979899";
+
+/*
+ * Format a non-negative integer in decimal, two digits at a time.
+ * Returns the position just past the last written digit.
+ */
+static char*
+format_uint(unsigned int value, char* out)
+{
+	char digits[10];
+	char* p;
+	size_t len;
+
+	p = digits + sizeof(digits);
+	while (value >= 100)
+	{
+		p -= 2;
+		memcpy(p, &g_digit_pairs[(value % 100) * 2], 2);
+		value /= 100;
+	}
+	if (value >= 10)
+	{
+		p -= 2;
+		memcpy(p, &g_digit_pairs[value * 2], 2);
+	}
+	else
+	{
+		*--p = (char)('0' + value);
+	}
+
+	len = (size_t)(digits + sizeof(digits) - p);
+	memcpy(out, p, len);
+
+	return out + len;
+}
+
+/* Format a signed integer in decimal. Returns the position just past the last digit. */
+static char*
+format_int(int value, char* out)
+{
+	if (value < 0)
+	{
+		*out++ = '-';
+		return format_uint(0u - (unsigned int)value, out);
+	}
+
+	return format_uint((unsigned int)value, out);
+}
+
+/*
+ * Plain sample of a float as the old fprintf("%d ", (int)v) writer gave it:
+ * truncated, not clamped. Out of the int range saturates instead of being
+ * undefined; NaN gives 0.
+ */
+static inline int
+p2_level(float v)
+{
+	if (!(v < 2147483648.0f))
+	{
+		return (v != v) ? 0 : INT_MAX;
+	}
+	if (v < -2147483648.0f)
+	{
+		return INT_MIN;
+	}
+
+	return (int)v;
+}
+
+/*
+ * Quantize a row of float samples to bytes: clamp to [0, max_val], then
+ * truncate toward zero like the (unsigned char) cast of the old writer.
+ * Branch-free so the compiler can vectorize it.
+ */
+static void
+quantize_row_u8(const float* src, unsigned char* dst, int len, float max_val)
+{
+	int i;
+	float v;
+
+	for (i = 0; i < len; ++i)
+	{
+		v = src[i];
+		v = (v < 0.0f) ? 0.0f : v;
+		v = (v > max_val) ? max_val : v;
+		dst[i] = (unsigned char)(int)v;
+	}
+}
+
+/* Same as quantize_row_u8() for 16-bit files (max_val 256 .. 65535). */
+static void
+quantize_row_u16(const float* src, unsigned short* dst, int len, float max_val)
+{
+	int i;
+	float v;
+
+	for (i = 0; i < len; ++i)
+	{
+		v = src[i];
+		v = (v < 0.0f) ? 0.0f : v;
+		v = (v > max_val) ? max_val : v;
+		dst[i] = (unsigned short)(int)v;
+	}
+}
+
+/* Clamp uint16 samples to [0, max_val], narrowing or copying them. */
+static void
+clamp_row_u16_to_u8(const unsigned short* src, unsigned char* dst, int len, unsigned int max_val)
+{
+	int i;
+
+	for (i = 0; i < len; ++i)
+	{
+		dst[i] = (unsigned char)((src[i] > max_val) ? max_val : src[i]);
+	}
+}
+
+static void
+clamp_row_u16(const unsigned short* src, unsigned short* dst, int len, unsigned int max_val)
+{
+	int i;
+
+	for (i = 0; i < len; ++i)
+	{
+		dst[i] = (unsigned short)((src[i] > max_val) ? max_val : src[i]);
+	}
+}
+
+static void
+clamp_row_u8(const unsigned char* src, unsigned char* dst, int len, unsigned int max_val)
+{
+	int i;
+
+	for (i = 0; i < len; ++i)
+	{
+		dst[i] = (unsigned char)((src[i] > max_val) ? max_val : src[i]);
+	}
+}
+
+/*
+ * Turn a row of native uint16 samples into big-endian P5 bytes in place:
+ * sample i occupies exactly bytes 2i and 2i + 1, so no scratch is needed.
+ */
+static void
+swap_row_u16_to_be16(unsigned short* samples, int len)
+{
+	int i;
+	unsigned short v;
+	unsigned char* bytes;
+
+	bytes = (unsigned char*)samples;
+	for (i = 0; i < len; ++i)
+	{
+		v = samples[i];
+		bytes[2 * i] = (unsigned char)(v >> 8);
+		bytes[2 * i + 1] = (unsigned char)(v & 0xff);
+	}
+}
+
+/* Format a quantized row as plain (P2) text: "v v v ... \n". Returns its length. */
+static size_t
+format_p2_row(const unsigned char* samples, int len, char* out)
+{
+	int i;
+	char* p;
+
+	p = out;
+	for (i = 0; i < len; ++i)
+	{
+		p = format_uint(samples[i], p);
+		*p++ = ' ';
+	}
+	*p++ = '\n';
+
+	return (size_t)(p - out);
+}
+
+/* Format a float row as plain (P2) text with unclamped, truncated samples. */
+static size_t
+format_p2_row_f32(const float* src, int len, char* out)
+{
+	int i;
+	char* p;
+
+	p = out;
+	for (i = 0; i < len; ++i)
+	{
+		p = format_int(p2_level(src[i]), p);
+		*p++ = ' ';
+	}
+	*p++ = '\n';
+
+	return (size_t)(p - out);
+}
+
+static size_t
+format_p2_row_u16(const unsigned short* samples, int len, char* out)
+{
+	int i;
+	char* p;
+
+	p = out;
+	for (i = 0; i < len; ++i)
+	{
+		p = format_uint(samples[i], p);
+		*p++ = ' ';
+	}
+	*p++ = '\n';
+
+	return (size_t)(p - out);
+}
+
+/*
+ * Emit one row that has been quantized into row_samples: w bytes for 8-bit
+ * files, w native uint16 for 16-bit files (swapped to big-endian in place).
+ */
+static int
+emit_row(FILE* file_ptr, enum lpgm_e_file_formats format, int sample_bytes, unsigned char* row_samples, int w,
+         char* row_text)
+{
+	size_t row_len;
+
+	if (format == lpgm_e_file_formats_P5_binary)
+	{
+		if (sample_bytes == 2)
+		{
+			swap_row_u16_to_be16((unsigned short*)row_samples, w);
+		}
+		row_len = (size_t)w * sample_bytes;
+		return (fwrite(row_samples, 1, row_len, file_ptr) == row_len) ? 0 : -1;
+	}
+
+	if (sample_bytes == 2)
+	{
+		row_len = format_p2_row_u16((const unsigned short*)row_samples, w, row_text);
+	}
+	else
+	{
+		row_len = format_p2_row(row_samples, w, row_text);
+	}
+
+	return (fwrite(row_text, 1, row_len, file_ptr) == row_len) ? 0 : -1;
+}
+
+/* Write the header of pgm (magic number, comment, size, max value). */
+int
+lpgm_write_header(FILE* file_ptr, const lpgm_t* pgm)
+{
+	int n;
+
+	if (pgm->comment == NULL)
+	{
+		n = fprintf(file_ptr, "%s\n%d %d\n%d\n", pgm->magic_number, pgm->im.w, pgm->im.h, pgm->max_val);
+	}
+	else
+	{
+		n = fprintf(file_ptr, "%s\n#%s\n%d %d\n%d\n", pgm->magic_number, pgm->comment, pgm->im.w, pgm->im.h, pgm->max_val);
+	}
+
+	return (n < 0) ? -1 : 0;
+}
+
+/*
+ * Write n_rows rows of w samples, stride floats apart, in the format and sample size given by header.
+ * P5 rows are quantized into row_samples (LPGM_ROW_SAMPLES_SIZE(w) bytes) in one
+ * pass, clamped to header->max_val, and emitted with a single fwrite(). P2 rows
+ * are formatted into row_text (LPGM_P2_ROW_TEXT_SIZE(w) bytes, may be NULL for
+ * P5) unclamped, byte-identical to the old fprintf() writer.
+ */
+int
+lpgm_write_rows(FILE* file_ptr, const lpgm_t* header, const float* rows, int w, int stride, int n_rows,
+                unsigned char* row_samples, char* row_text)
+{
+	int i, sample_bytes;
+	size_t row_len;
+	float clamp_max;
+	enum lpgm_e_file_formats format;
+
+	if (file_format_of(header->magic_number, &format) != 0)
+	{
+		return -1;
+	}
+
+	if (format == lpgm_e_file_formats_P2_ascii)
+	{
+		for (i = 0; i < n_rows; ++i)
+		{
+			row_len = format_p2_row_f32(rows + (size_t)i * stride, w, row_text);
+			if (fwrite(row_text, 1, row_len, file_ptr) != row_len)
+			{
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	sample_bytes = LPGM_SAMPLE_BYTES(header->max_val);
+	clamp_max = (header->max_val > 0 && header->max_val <= 65535) ? (float)header->max_val : 255.0f;
+	for (i = 0; i < n_rows; ++i)
+	{
+		if (sample_bytes == 2)
+		{
+			quantize_row_u16(rows + (size_t)i * stride, (unsigned short*)row_samples, w, clamp_max);
+		}
+		else
+		{
+			quantize_row_u8(rows + (size_t)i * stride, row_samples, w, clamp_max);
+		}
+
+		if (emit_row(file_ptr, format, sample_bytes, row_samples, w, row_text) != 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Same as lpgm_write_rows() for native uint16 rows. */
+int
+lpgm_write_rows_u16(FILE* file_ptr, const lpgm_t* header, const unsigned short* rows, int w, int n_rows,
+                    unsigned char* row_samples, char* row_text)
+{
+	int i, sample_bytes;
+	unsigned int clamp_max;
+	enum lpgm_e_file_formats format;
+
+	if (file_format_of(header->magic_number, &format) != 0)
+	{
+		return -1;
+	}
+
+	sample_bytes = LPGM_SAMPLE_BYTES(header->max_val);
+	clamp_max = (header->max_val > 0 && header->max_val <= 65535) ? (unsigned int)header->max_val : 255u;
+	for (i = 0; i < n_rows; ++i)
+	{
+		if (sample_bytes == 2)
+		{
+			clamp_row_u16(rows + (size_t)i * w, (unsigned short*)row_samples, w, clamp_max);
+		}
+		else
+		{
+			clamp_row_u16_to_u8(rows + (size_t)i * w, row_samples, w, clamp_max);
+		}
+
+		if (emit_row(file_ptr, format, sample_bytes, row_samples, w, row_text) != 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Same as lpgm_write_rows() for native uint8 rows, stride bytes apart (8-bit files only). */
+static int
+write_rows_u8(FILE* file_ptr, const lpgm_t* header, const unsigned char* rows, int w, int stride, int n_rows,
+              unsigned char* row_samples, char* row_text)
+{
+	int i;
+	enum lpgm_e_file_formats format;
+
+	if (file_format_of(header->magic_number, &format) != 0)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < n_rows; ++i)
+	{
+		clamp_row_u8(rows + (size_t)i * stride, row_samples, w, (unsigned int)header->max_val);
+
+		if (emit_row(file_ptr, format, 1, row_samples, w, row_text) != 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Write pgm (header and raster) to an open stream, in the format named by
+ * pgm->magic_number. Returns 0, or -1 on an allocation or write error.
+ */
+static int
+write_pgm(FILE* file_ptr, const lpgm_t* pgm, enum lpgm_e_file_formats format)
+{
+	int status;
+	unsigned char* row_samples;
+	char* row_text;
+
+	row_samples = (unsigned char*)lpgm_malloc(LPGM_ROW_SAMPLES_SIZE(pgm->im.w));
+	row_text = NULL;
+	if (format == lpgm_e_file_formats_P2_ascii)
+	{
+		row_text = (char*)lpgm_malloc(LPGM_P2_ROW_TEXT_SIZE(pgm->im.w));
+	}
+	if (row_samples == NULL || (format == lpgm_e_file_formats_P2_ascii && row_text == NULL))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		lpgm_free(row_samples);
+		lpgm_free(row_text);
+		return -1;
+	}
+
+	status = lpgm_write_header(file_ptr, pgm);
+	if (status == 0)
+	{
+		status = lpgm_write_rows(file_ptr, pgm, pgm->im.data, pgm->im.w, LPGM_STRIDE(&pgm->im), pgm->im.h, row_samples,
+		                         row_text);
+	}
+
+	lpgm_free(row_samples);
+	lpgm_free(row_text);
+
+	return status;
+}
+
+/* Check pgm before encoding it and return its format. */
+static int
+check_pgm_to_write(const lpgm_t* pgm, enum lpgm_e_file_formats* format, const char* caller)
+{
+	if (pgm == NULL || pgm->im.data == NULL || pgm->im.w <= 0 || pgm->im.h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Invalid input image.");
+		return -1;
+	}
+
+	if (file_format_of(pgm->magic_number, format) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, caller, "Image type: [%s], type must be: [%s] or [%s].", pgm->magic_number, "P5", "P2");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * write pgm struct data to file
+ */
+lpgm_status_t
+lpgm_file_write(const lpgm_t* pgm, const char* file_name)
+{
+	FILE* file_ptr = NULL;
+	int status;
+	enum lpgm_e_file_formats format;
+
+	if (check_pgm_to_write(pgm, &format, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	file_ptr = fopen(file_name, (format == lpgm_e_file_formats_P5_binary) ? "wb" : "w");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	status = write_pgm(file_ptr, pgm, format);
+
+	// close file
+	if (fclose(file_ptr) != 0 || status != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error writing file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+
+	return LPGM_OK;
+}
+
+/*
+ * Upper bound of the encoded size of pgm: header plus the widest raster
+ * (two bytes per P5 sample above max value 255; for P2, LPGM_P2_MAX_SAMPLE_CHARS per
+ * sample, a signed int and a space, plus a newline per row).
+ */
+size_t
+lpgm_mem_write_bound(const lpgm_t* pgm)
+{
+	size_t header_size, raster_size;
+	enum lpgm_e_file_formats format;
+
+	if (pgm == NULL || file_format_of(pgm->magic_number, &format) != 0 || pgm->im.w <= 0 || pgm->im.h <= 0)
+	{
+		return 0;
+	}
+
+	/* "P5\n#<comment>\n<w> <h>\n<max>\n", each number at most 11 characters */
+	header_size = 3 + 3 * 12 + 2;
+	if (pgm->comment != NULL)
+	{
+		header_size += strlen(pgm->comment) + 2;
+	}
+
+	if (format == lpgm_e_file_formats_P5_binary)
+	{
+		raster_size = (size_t)pgm->im.w * pgm->im.h * LPGM_SAMPLE_BYTES(pgm->max_val);
+	}
+	else
+	{
+		raster_size = LPGM_P2_ROW_TEXT_SIZE(pgm->im.w) * pgm->im.h;
+	}
+
+	return header_size + raster_size;
+}
+
+/*
+ * Encode pgm into a caller buffer of capacity bytes
+ *
+ * Rows are written straight into the buffer (the memory stream is unbuffered).
+ * Fails if the image does not fit; lpgm_mem_write_bound() gives a size that always does.
+ */
+lpgm_status_t
+lpgm_mem_write(const lpgm_t* pgm, void* buffer, size_t capacity, size_t* out_size)
+{
+	FILE* file_ptr;
+	int status;
+	long size;
+	enum lpgm_e_file_formats format;
+
+	if (check_pgm_to_write(pgm, &format, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (buffer == NULL || capacity == 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Empty output buffer.");
+		return LPGM_FAIL;
+	}
+
+	file_ptr = fmemopen(buffer, capacity, "wb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening memory stream.");
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IONBF, 0);
+
+	status = write_pgm(file_ptr, pgm, format);
+	size = ftell(file_ptr);
+	if (fclose(file_ptr) != 0 || status != 0 || size < 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Image does not fit in [%zu] bytes.", capacity);
+		return LPGM_FAIL;
+	}
+
+	if (out_size != NULL)
+	{
+		*out_size = (size_t)size;
+	}
+
+	return LPGM_OK;
+}
+
+/*
+ * Encode pgm into a buffer that grows as needed (open_memstream()).
+ * On success *out_data holds *out_size bytes; release it with free().
+ */
+lpgm_status_t
+lpgm_mem_write_alloc(const lpgm_t* pgm, void** out_data, size_t* out_size)
+{
+	FILE* file_ptr;
+	char* data;
+	size_t size;
+	int status;
+	enum lpgm_e_file_formats format;
+
+	if (check_pgm_to_write(pgm, &format, __func__) != 0 || out_data == NULL || out_size == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	data = NULL;
+	size = 0;
+	file_ptr = open_memstream(&data, &size);
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening memory stream.");
+		return LPGM_FAIL;
+	}
+	/* No setvbuf() here: the memory stream is its own buffer */
+
+	status = write_pgm(file_ptr, pgm, format);
+	if (fclose(file_ptr) != 0 || status != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error writing memory stream.");
+		free(data);   /* open_memstream() memory, not ours */
+		return LPGM_FAIL;
+	}
+
+	*out_data = data;
+	*out_size = size;
+
+	return LPGM_OK;
+}
+
+/*
+ * Encode pgm to an open file descriptor (pipe, socket, file).
+ * Writes through a duplicate of fd and flushes it, fd itself stays open.
+ */
+lpgm_status_t
+lpgm_fd_write(const lpgm_t* pgm, int fd)
+{
+	FILE* file_ptr;
+	int dup_fd, status;
+	enum lpgm_e_file_formats format;
+
+	if (check_pgm_to_write(pgm, &format, __func__) != 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	dup_fd = dup(fd);
+	if (dup_fd < 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid file descriptor: [%d].", fd);
+		return LPGM_FAIL;
+	}
+
+	file_ptr = fdopen(dup_fd, "wb");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file descriptor: [%d].", fd);
+		close(dup_fd);
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	status = write_pgm(file_ptr, pgm, format);
+	if (fclose(file_ptr) != 0 || status != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error writing file descriptor: [%d].", fd);
+		return LPGM_FAIL;
+	}
+
+	return LPGM_OK;
+}
+
+/*
+ * Write a uint16 image. Format and max value come from info (info->w and
+ * info->h are ignored); samples above max value are clamped.
+ */
+lpgm_status_t
+lpgm_file_write_u16(const lpgm_image_u16_t* im, const lpgm_info_t* info, const char* file_name)
+{
+	FILE* file_ptr = NULL;
+	int status;
+	unsigned char* row_samples;
+	char* row_text;
+	lpgm_t header;
+	enum lpgm_e_file_formats format;
+
+	if (im == NULL || im->data == NULL || info == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return LPGM_FAIL;
+	}
+
+	if (file_format_of(info->magic_number, &format) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Image type: [%s], type must be: [%s] or [%s].", info->magic_number, "P5", "P2");
+		return LPGM_FAIL;
+	}
+
+	if (info->max_val < 1 || info->max_val > 65535)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Max_val: [%d] must be in [1, 65535].", info->max_val);
+		return LPGM_FAIL;
+	}
+
+	memcpy(header.magic_number, info->magic_number, sizeof(header.magic_number));
+	header.comment = NULL;
+	header.max_val = info->max_val;
+	header.im.w = im->w;
+	header.im.h = im->h;
+	header.im.data = NULL;
+
+	file_ptr = fopen(file_name, (format == lpgm_e_file_formats_P5_binary) ? "wb" : "w");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	row_samples = (unsigned char*)lpgm_malloc(LPGM_ROW_SAMPLES_SIZE(im->w));
+	row_text = NULL;
+	if (format == lpgm_e_file_formats_P2_ascii)
+	{
+		row_text = (char*)lpgm_malloc(LPGM_P2_ROW_TEXT_SIZE(im->w));
+	}
+	if (row_samples == NULL || (format == lpgm_e_file_formats_P2_ascii && row_text == NULL))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		lpgm_free(row_samples);
+		lpgm_free(row_text);
+		fclose(file_ptr);
+		return LPGM_FAIL;
+	}
+
+	status = lpgm_write_header(file_ptr, &header);
+	if (status == 0)
+	{
+		status = lpgm_write_rows_u16(file_ptr, &header, im->data, im->w, im->h, row_samples, row_text);
+	}
+
+	lpgm_free(row_samples);
+	lpgm_free(row_text);
+
+	if (fclose(file_ptr) != 0 || status != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error writing file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+
+	return LPGM_OK;
+}
+
+/*
+ * Write a uint8 image. Format and max value (at most 255) come from info
+ * (info->w and info->h are ignored); samples above max value are clamped.
+ */
+lpgm_status_t
+lpgm_file_write_u8(const lpgm_image_u8_t* im, const lpgm_info_t* info, const char* file_name)
+{
+	FILE* file_ptr = NULL;
+	int status;
+	unsigned char* row_samples;
+	char* row_text;
+	lpgm_t header;
+	enum lpgm_e_file_formats format;
+
+	if (im == NULL || im->data == NULL || info == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid input image.");
+		return LPGM_FAIL;
+	}
+
+	if (file_format_of(info->magic_number, &format) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Image type: [%s], type must be: [%s] or [%s].", info->magic_number, "P5", "P2");
+		return LPGM_FAIL;
+	}
+
+	if (info->max_val < 1 || info->max_val > 255)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Max_val: [%d] must be in [1, 255].", info->max_val);
+		return LPGM_FAIL;
+	}
+
+	memcpy(header.magic_number, info->magic_number, sizeof(header.magic_number));
+	header.comment = NULL;
+	header.max_val = info->max_val;
+	header.im = lpgm_null_image();
+	header.im.w = im->w;
+	header.im.h = im->h;
+
+	file_ptr = fopen(file_name, (format == lpgm_e_file_formats_P5_binary) ? "wb" : "w");
+	if (file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+	setvbuf(file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	row_samples = (unsigned char*)lpgm_malloc(im->w);
+	row_text = NULL;
+	if (format == lpgm_e_file_formats_P2_ascii)
+	{
+		row_text = (char*)lpgm_malloc(LPGM_P2_ROW_TEXT_SIZE(im->w));
+	}
+	if (row_samples == NULL || (format == lpgm_e_file_formats_P2_ascii && row_text == NULL))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		lpgm_free(row_samples);
+		lpgm_free(row_text);
+		fclose(file_ptr);
+		return LPGM_FAIL;
+	}
+
+	status = lpgm_write_header(file_ptr, &header);
+	if (status == 0)
+	{
+		status = write_rows_u8(file_ptr, &header, im->data, im->w, LPGM_STRIDE(im), im->h, row_samples, row_text);
+	}
+
+	lpgm_free(row_samples);
+	lpgm_free(row_text);
+
+	if (fclose(file_ptr) != 0 || status != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error writing file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+
+	return LPGM_OK;
+}
+
+void
+lpgm_file_destroy(lpgm_t* pgm)
+{
+	if (pgm->comment != NULL)
+	{
+		lpgm_free(pgm->comment);
+		pgm->comment = NULL;
+	}
+	lpgm_image_destroy(&pgm->im);
+}
+
+/*
+ * Parse a PGM header that lives in memory (e.g. a file mapping) by running the
+ * regular header readers over a memory stream. Returns the raster offset, or -1.
+ */
+static long
+parse_header_in_memory(void* addr, size_t len, lpgm_map_t* map)
+{
+	FILE* header_ptr;
+	lpgm_t header;
+	long offset;
+
+	header_ptr = fmemopen(addr, len, "r");
+	if (header_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Could not open memory stream.");
+		return -1;
+	}
+
+	if (lpgm_read_header(header_ptr, &header) != 0)
+	{
+		fclose(header_ptr);
+		return -1;
+	}
+	offset = ftell(header_ptr);
+	fclose(header_ptr);
+
+	memcpy(map->magic_number, header.magic_number, sizeof(map->magic_number));
+	map->comment = header.comment;
+	map->max_val = header.max_val;
+	map->w = header.im.w;
+	map->h = header.im.h;
+
+	return offset;
+}
+
+/*
+ * Memory-map a P5 file
+ *
+ * The header is parsed directly from the mapping and the raster is exposed as
+ * an 8-bit view, so reading an image costs no copy and no float expansion.
+ * The mapping is private and writable: a written page is copied on the first
+ * write, so a view of the raster can take in-place operations without
+ * touching the file. Use lpgm_map_to_image() when a float image is needed.
+ */
+lpgm_status_t
+lpgm_file_map(const char* file_name, lpgm_map_t* map)
+{
+	int fd;
+	struct stat st;
+	void* addr;
+	long offset;
+
+	memset(map, 0, sizeof(*map));
+
+	fd = open(file_name, O_RDONLY);
+	if (fd < 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading size of file: [%s].", file_name);
+		close(fd);
+		return LPGM_FAIL;
+	}
+
+	addr = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error mapping file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+	map->map_addr = addr;
+	map->map_len = (size_t)st.st_size;
+
+	offset = parse_header_in_memory(addr, map->map_len, map);
+	if (offset < 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading header from file: [%s].", file_name);
+		lpgm_file_unmap(map);
+		return LPGM_FAIL;
+	}
+
+	if (strcmp(map->magic_number, "P5") != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Only P5 files can be mapped, file: [%s] is [%s].", file_name, map->magic_number);
+		lpgm_file_unmap(map);
+		return LPGM_FAIL;
+	}
+
+	if (map->max_val > 255)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Only 8-bit files can be mapped, file: [%s] has max value [%d].", file_name, map->max_val);
+		lpgm_file_unmap(map);
+		return LPGM_FAIL;
+	}
+
+	if (!LPGM_SIZE_VALID(map->w, map->h) || (size_t)offset + (size_t)map->w * map->h > map->map_len)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Short file, [%d x %d] raster does not fit in file: [%s].", map->w, map->h, file_name);
+		lpgm_file_unmap(map);
+		return LPGM_FAIL;
+	}
+
+	map->stride = map->w;
+	map->data = (const unsigned char*)addr + offset;
+
+	/* The raster is consumed front to back by nearly every operation */
+	madvise(addr, map->map_len, MADV_SEQUENTIAL);
+
+	return LPGM_OK;
+}
+
+void
+lpgm_file_unmap(lpgm_map_t* map)
+{
+	if (map->map_addr != NULL)
+	{
+		munmap(map->map_addr, map->map_len);
+	}
+	lpgm_free(map->comment);
+	memset(map, 0, sizeof(*map));
+}
+
+lpgm_image_t
+lpgm_map_to_image(const lpgm_map_t* map)
+{
+	int i;
+	lpgm_image_t out_im;
+
+	if (map == NULL || map->data == NULL)
+	{
+		out_im = lpgm_null_image();
+		return out_im;
+	}
+
+	out_im = lpgm_make_empty_image(map->w, map->h);
+	if (out_im.data == NULL)
+	{
+		return out_im;
+	}
+
+	for (i = 0; i < map->h; ++i)
+	{
+		widen_u8_to_float(map->data + (size_t)i * map->stride, lpgm_image_row(&out_im, i), map->w);
+	}
+
+	return out_im;
+}
+
+/*
+ * View the mapped raster as a uint8 image: no copy, the view shares the
+ * mapping (stride included). Writes stay in the private mapping; the view
+ * must not be used after unmap.
+ */
+lpgm_image_u8_t
+lpgm_map_to_image_u8(const lpgm_map_t* map)
+{
+	lpgm_image_u8_t view = {0, 0, NULL, 0, 0};
+
+	if (map == NULL || map->data == NULL)
+	{
+		return view;
+	}
+
+	view.w = map->w;
+	view.h = map->h;
+	view.stride = map->stride;
+	view.data = (unsigned char*)map->data;
+	view.is_view = 1;
+
+	return view;
 }
@@ -0,0 +1,549 @@
+/*
+ * Streaming PGM I/O
+ *
+ * Reads and writes PGM files a strip of rows at a time, so images far larger
+ * than memory can be processed. Neighborhood operations keep a rolling window
+ * of rows: the strip being produced plus "halo" rows above and below it.
+ *
+ *   strip r:   rows [r - halo, r + strip_rows + halo) are in memory
+ *   strip r+1: the overlapping rows are moved up, only new rows are read
+ */
+
+#include "internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Streams live across frames: their buffers never come from a bound context */
+static lpgm_status_t
+open_stream(const char* file_name, lpgm_stream_t* stream)
+{
+	memset(stream, 0, sizeof(*stream));
+
+	stream->file_ptr = fopen(file_name, "rb");
+	if (stream->file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		return LPGM_FAIL;
+	}
+	setvbuf(stream->file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	if (lpgm_read_header(stream->file_ptr, &stream->header) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error reading header from file: [%s].", file_name);
+		fclose(stream->file_ptr);
+		stream->file_ptr = NULL;
+		return LPGM_FAIL;
+	}
+
+	if (stream->header.im.w <= 0 || stream->header.im.h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid image size: [%d x %d].", stream->header.im.w, stream->header.im.h);
+		lpgm_stream_close(stream);
+		return LPGM_FAIL;
+	}
+
+	return LPGM_OK;
+}
+
+static lpgm_status_t
+create_stream(const char* file_name, const lpgm_t* header, lpgm_stream_t* stream)
+{
+	int w;
+
+	memset(stream, 0, sizeof(*stream));
+
+	w = header->im.w;
+	if (w <= 0 || header->im.h <= 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Invalid image size: [%d x %d].", w, header->im.h);
+		return LPGM_FAIL;
+	}
+
+	memcpy(stream->header.magic_number, header->magic_number, sizeof(stream->header.magic_number));
+	stream->header.max_val = header->max_val;
+	stream->header.im.w = w;
+	stream->header.im.h = header->im.h;
+	if (header->comment != NULL)
+	{
+		stream->header.comment = (char*)lpgm_malloc(strlen(header->comment) + 1);
+		if (stream->header.comment == NULL)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+			return LPGM_FAIL;
+		}
+		strcpy(stream->header.comment, header->comment);
+	}
+
+	stream->row_samples = (unsigned char*)lpgm_malloc(LPGM_ROW_SAMPLES_SIZE(w));
+	stream->row_text = (char*)lpgm_malloc(LPGM_P2_ROW_TEXT_SIZE(w));
+	if (stream->row_samples == NULL || stream->row_text == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Memory allocation failed.");
+		lpgm_stream_close(stream);
+		return LPGM_FAIL;
+	}
+
+	stream->file_ptr = fopen(file_name, "wb");
+	if (stream->file_ptr == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error opening file: [%s].", file_name);
+		lpgm_stream_close(stream);
+		return LPGM_FAIL;
+	}
+	setvbuf(stream->file_ptr, NULL, _IOFBF, LPGM_IO_BLOCK_SIZE);
+
+	if (lpgm_write_header(stream->file_ptr, &stream->header) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error writing header to file: [%s].", file_name);
+		lpgm_stream_close(stream);
+		return LPGM_FAIL;
+	}
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_stream_open(const char* file_name, lpgm_stream_t* stream)
+{
+	lpgm_context_t* previous;
+	lpgm_status_t status;
+
+	previous = lpgm_context_bind(NULL);
+	status = open_stream(file_name, stream);
+	lpgm_context_bind(previous);
+
+	return status;
+}
+
+lpgm_status_t
+lpgm_stream_create(const char* file_name, const lpgm_t* header, lpgm_stream_t* stream)
+{
+	lpgm_context_t* previous;
+	lpgm_status_t status;
+
+	previous = lpgm_context_bind(NULL);
+	status = create_stream(file_name, header, stream);
+	lpgm_context_bind(previous);
+
+	return status;
+}
+
+int
+lpgm_stream_read_rows(lpgm_stream_t* stream, float* rows, int n_rows)
+{
+	int w, n;
+
+	if (stream == NULL || stream->file_ptr == NULL || rows == NULL || n_rows < 0)
+	{
+		return -1;
+	}
+
+	if (n_rows > stream->header.im.h - stream->rows_done)
+	{
+		n_rows = stream->header.im.h - stream->rows_done;
+	}
+	if (n_rows == 0)
+	{
+		return 0;
+	}
+
+	/* A call returns at most INT_MAX samples; the caller reads the rest with the next one */
+	w = stream->header.im.w;
+	if (n_rows > INT_MAX / w)
+	{
+		n_rows = INT_MAX / w;
+	}
+	n = lpgm_read_raster(stream->file_ptr, &stream->header, rows, n_rows * w);
+	if (n != n_rows * w)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Short file, expected [%d] pixels but read [%d].", n_rows * w, n);
+		return -1;
+	}
+	stream->rows_done += n_rows;
+
+	return n_rows;
+}
+
+lpgm_status_t
+lpgm_stream_write_rows(lpgm_stream_t* stream, const float* rows, int n_rows)
+{
+	if (stream == NULL || stream->file_ptr == NULL || stream->row_samples == NULL || rows == NULL || n_rows < 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (n_rows > stream->header.im.h - stream->rows_done)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Too many rows, image has [%d] rows.", stream->header.im.h);
+		return LPGM_FAIL;
+	}
+
+	if (lpgm_write_rows(stream->file_ptr, &stream->header, rows, stream->header.im.w, stream->header.im.w, n_rows,
+	                    stream->row_samples, stream->row_text) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error writing rows.");
+		return LPGM_FAIL;
+	}
+	stream->rows_done += n_rows;
+
+	return LPGM_OK;
+}
+
+int
+lpgm_stream_read_image(lpgm_stream_t* stream, lpgm_image_t* im)
+{
+	int i, n;
+
+	if (stream == NULL || im == NULL || im->data == NULL || im->w != stream->header.im.w || im->h < 0)
+	{
+		return -1;
+	}
+
+	if (LPGM_STRIDE(im) == im->w)
+	{
+		return lpgm_stream_read_rows(stream, im->data, im->h);
+	}
+
+	for (i = 0; i < im->h; ++i)
+	{
+		n = lpgm_stream_read_rows(stream, lpgm_image_row(im, i), 1);
+		if (n < 0)
+		{
+			return -1;
+		}
+		if (n == 0)
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
+lpgm_status_t
+lpgm_stream_write_image(lpgm_stream_t* stream, const lpgm_image_t* im)
+{
+	if (stream == NULL || stream->file_ptr == NULL || stream->row_samples == NULL || im == NULL || im->data == NULL
+	    || im->w != stream->header.im.w || im->h < 0)
+	{
+		return LPGM_FAIL;
+	}
+
+	if (im->h > stream->header.im.h - stream->rows_done)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Too many rows, image has [%d] rows.", stream->header.im.h);
+		return LPGM_FAIL;
+	}
+
+	if (lpgm_write_rows(stream->file_ptr, &stream->header, im->data, im->w, LPGM_STRIDE(im), im->h,
+	                    stream->row_samples, stream->row_text) != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Error writing rows.");
+		return LPGM_FAIL;
+	}
+	stream->rows_done += im->h;
+
+	return LPGM_OK;
+}
+
+lpgm_status_t
+lpgm_stream_close(lpgm_stream_t* stream)
+{
+	lpgm_status_t status = LPGM_OK;
+	int is_writer;
+
+	if (stream == NULL)
+	{
+		return LPGM_FAIL;
+	}
+
+	is_writer = (stream->row_samples != NULL);
+	if (stream->file_ptr != NULL)
+	{
+		if (fclose(stream->file_ptr) != 0)
+		{
+			status = LPGM_FAIL;
+		}
+		if (is_writer && stream->rows_done != stream->header.im.h)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Incomplete image, wrote [%d] of [%d] rows.", stream->rows_done, stream->header.im.h);
+			status = LPGM_FAIL;
+		}
+	}
+
+	lpgm_free(stream->header.comment);
+	lpgm_free(stream->row_samples);
+	lpgm_free(stream->row_text);
+	memset(stream, 0, sizeof(*stream));
+
+	return status;
+}
+
+lpgm_status_t
+lpgm_stream_filter(lpgm_stream_t* in, lpgm_stream_t* out, int halo, int strip_rows, lpgm_strip_fn fn, void* user_data)
+{
+	int w, h, r, n, got, need_first, need_end, drop, stride;
+	int win_first, win_rows;
+	lpgm_image_t window, view, result;
+	lpgm_status_t status;
+
+	if (in == NULL || out == NULL || fn == NULL || halo < 0 || strip_rows < 1)
+	{
+		return LPGM_FAIL;
+	}
+
+	w = in->header.im.w;
+	h = in->header.im.h;
+	if (out->header.im.w != w || out->header.im.h != h || in->rows_done != 0 || out->rows_done != 0)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Streams must have the same size and be at their first row.");
+		return LPGM_FAIL;
+	}
+
+	/* The window never holds more than the whole image */
+	halo = (halo > h) ? h : halo;
+	strip_rows = (strip_rows > h) ? h : strip_rows;
+	win_rows = ((long long)strip_rows + 2LL * halo > h) ? h : strip_rows + 2 * halo;
+	if (!LPGM_SIZE_VALID(w, win_rows))
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Strip window [%d x %d] is too large.", w, win_rows);
+		return LPGM_FAIL;
+	}
+
+	window = lpgm_make_empty_image(w, win_rows);
+	if (window.data == NULL)
+	{
+		return LPGM_FAIL;
+	}
+	stride = window.stride;
+
+	/* The window holds image rows [win_first, win_first + win_rows) */
+	win_first = 0;
+	win_rows = 0;
+	status = LPGM_OK;
+	for (r = 0; r < h && status == LPGM_OK; r += n)
+	{
+		n = (h - r < strip_rows) ? h - r : strip_rows;
+		need_first = (r - halo < 0) ? 0 : r - halo;
+		need_end = (halo > h - (r + n)) ? h : r + n + halo;
+
+		/* Drop the rows above the window, keep the overlap */
+		drop = need_first - win_first;
+		if (drop > 0)
+		{
+			if (drop < win_rows)
+			{
+				memmove(window.data, window.data + (size_t)drop * stride, (size_t)(win_rows - drop) * stride * sizeof(float));
+				win_rows -= drop;
+			}
+			else
+			{
+				win_rows = 0;
+			}
+			win_first = need_first;
+		}
+
+		/* Pull in the rows below */
+		got = 0;
+		if (need_end > win_first + win_rows)
+		{
+			view = lpgm_image_roi(&window, win_rows, 0, w, need_end - (win_first + win_rows));
+			got = lpgm_stream_read_image(in, &view);
+		}
+		if (got != need_end - (win_first + win_rows))
+		{
+			status = LPGM_FAIL;
+			break;
+		}
+		win_rows += got;
+
+		view = lpgm_image_roi(&window, 0, 0, w, win_rows);
+		result = fn(&view, user_data);
+		if (result.data == NULL || result.w != w || result.h != win_rows)
+		{
+			lpgm_log(LPGM_LOG_ERROR, __func__, "Strip function failed.");
+			lpgm_image_destroy(&result);
+			status = LPGM_FAIL;
+			break;
+		}
+
+		view = lpgm_image_roi(&result, r - win_first, 0, w, n);
+		status = lpgm_stream_write_image(out, &view);
+		lpgm_image_destroy(&result);
+	}
+
+	lpgm_image_destroy(&window);
+
+	return status;
+}
+
+/* Parameters handed to the strip adapters below */
+typedef struct
+{
+	float value;
+	const float* kernel;
+	int ksize;
+} strip_params_t;
+
+static lpgm_image_t
+strip_brightness(const lpgm_image_t* window, void* user_data)
+{
+	return lpgm_brightness(window, ((strip_params_t*)user_data)->value);
+}
+
+static lpgm_image_t
+strip_contrast(const lpgm_image_t* window, void* user_data)
+{
+	return lpgm_contrast(window, ((strip_params_t*)user_data)->value);
+}
+
+static lpgm_image_t
+strip_invert(const lpgm_image_t* window, void* user_data)
+{
+	(void)user_data;
+	return lpgm_invert(window);
+}
+
+static lpgm_image_t
+strip_threshold(const lpgm_image_t* window, void* user_data)
+{
+	return lpgm_threshold(window, ((strip_params_t*)user_data)->value);
+}
+
+static lpgm_image_t
+strip_gamma(const lpgm_image_t* window, void* user_data)
+{
+	return lpgm_gamma(window, ((strip_params_t*)user_data)->value);
+}
+
+static lpgm_image_t
+strip_sobel(const lpgm_image_t* window, void* user_data)
+{
+	(void)user_data;
+	return lpgm_sobel(window);
+}
+
+static lpgm_image_t
+strip_convolve(const lpgm_image_t* window, void* user_data)
+{
+	strip_params_t* params = (strip_params_t*)user_data;
+	return lpgm_convolve(window, params->kernel, params->ksize);
+}
+
+static lpgm_image_t
+strip_median_filter(const lpgm_image_t* window, void* user_data)
+{
+	return lpgm_median_filter(window, ((strip_params_t*)user_data)->ksize);
+}
+
+static lpgm_image_t
+strip_erode(const lpgm_image_t* window, void* user_data)
+{
+	return lpgm_erode(window, ((strip_params_t*)user_data)->ksize);
+}
+
+static lpgm_image_t
+strip_dilate(const lpgm_image_t* window, void* user_data)
+{
+	return lpgm_dilate(window, ((strip_params_t*)user_data)->ksize);
+}
+
+static lpgm_image_t
+strip_opening(const lpgm_image_t* window, void* user_data)
+{
+	return lpgm_opening(window, ((strip_params_t*)user_data)->ksize);
+}
+
+static lpgm_image_t
+strip_closing(const lpgm_image_t* window, void* user_data)
+{
+	return lpgm_closing(window, ((strip_params_t*)user_data)->ksize);
+}
+
+/* Point operations need no neighbors: halo 0 */
+
+lpgm_status_t
+lpgm_stream_brightness(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, float delta)
+{
+	strip_params_t params = { delta, NULL, 0 };
+	return lpgm_stream_filter(in, out, 0, strip_rows, strip_brightness, &params);
+}
+
+lpgm_status_t
+lpgm_stream_contrast(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, float factor)
+{
+	strip_params_t params = { factor, NULL, 0 };
+	return lpgm_stream_filter(in, out, 0, strip_rows, strip_contrast, &params);
+}
+
+lpgm_status_t
+lpgm_stream_invert(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows)
+{
+	return lpgm_stream_filter(in, out, 0, strip_rows, strip_invert, NULL);
+}
+
+lpgm_status_t
+lpgm_stream_threshold(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, float threshold)
+{
+	strip_params_t params = { threshold, NULL, 0 };
+	return lpgm_stream_filter(in, out, 0, strip_rows, strip_threshold, &params);
+}
+
+lpgm_status_t
+lpgm_stream_gamma(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, float gamma)
+{
+	strip_params_t params = { gamma, NULL, 0 };
+	return lpgm_stream_filter(in, out, 0, strip_rows, strip_gamma, &params);
+}
+
+/* Neighborhood operations: halo = ksize / 2, twice that for opening/closing */
+
+lpgm_status_t
+lpgm_stream_sobel(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows)
+{
+	return lpgm_stream_filter(in, out, 1, strip_rows, strip_sobel, NULL);
+}
+
+lpgm_status_t
+lpgm_stream_convolve(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, const float* kernel, int ksize)
+{
+	strip_params_t params = { 0.0f, kernel, ksize };
+	return lpgm_stream_filter(in, out, ksize / 2, strip_rows, strip_convolve, &params);
+}
+
+lpgm_status_t
+lpgm_stream_median_filter(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize)
+{
+	strip_params_t params = { 0.0f, NULL, ksize };
+	return lpgm_stream_filter(in, out, ksize / 2, strip_rows, strip_median_filter, &params);
+}
+
+lpgm_status_t
+lpgm_stream_erode(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize)
+{
+	strip_params_t params = { 0.0f, NULL, ksize };
+	return lpgm_stream_filter(in, out, ksize / 2, strip_rows, strip_erode, &params);
+}
+
+lpgm_status_t
+lpgm_stream_dilate(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize)
+{
+	strip_params_t params = { 0.0f, NULL, ksize };
+	return lpgm_stream_filter(in, out, ksize / 2, strip_rows, strip_dilate, &params);
+}
+
+lpgm_status_t
+lpgm_stream_opening(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize)
+{
+	strip_params_t params = { 0.0f, NULL, ksize };
+	return lpgm_stream_filter(in, out, 2 * (ksize / 2), strip_rows, strip_opening, &params);
+}
+
+lpgm_status_t
+lpgm_stream_closing(lpgm_stream_t* in, lpgm_stream_t* out, int strip_rows, int ksize)
+{
+	strip_params_t params = { 0.0f, NULL, ksize };
+	return lpgm_stream_filter(in, out, 2 * (ksize / 2), strip_rows, strip_closing, &params);
+}
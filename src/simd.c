@@ -0,0 +1,307 @@
+/*
+ * Runtime CPU dispatch
+ *
+ * kernels.h is compiled here once per instruction set:
+ *
+ *   scalar     no vectorization at all, the reference path
+ *   baseline   what the compiler targets by default (SSE2 on x86-64)
+ *   sse4.1, avx2, avx512   x86 only
+ *
+ * When the library is loaded, the best set the CPU (and OS) supports is
+ * chosen through CPUID. LPGM_SIMD=<name> in the environment caps the choice,
+ * e.g. LPGM_SIMD=scalar to debug against the reference loops.
+ *
+ * The 256-entry byte table lookup of lpgm_apply_lut_u8() does not vectorize
+ * as plain C, so avx2 brings its own, written with intrinsics: 16-entry
+ * vpshufb lookups (avx512 reuses it), and vpermi2b on CPUs with AVX-512
+ * VBMI. With 128-bit pshufb a lookup costs about what the plain C row
+ * does, so the sse4.1 table keeps that row.
+ */
+
+#include "internal.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LPGM_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#pragma GCC push_options
+#pragma GCC optimize("no-tree-vectorize")
+#define KERNEL(name) scalar_##name
+#define KERNEL_LEVEL LPGM_SIMD_SCALAR
+#include "kernels.h"
+#undef KERNEL
+#undef KERNEL_LEVEL
+#pragma GCC pop_options
+
+#define KERNEL(name) baseline_##name
+#define KERNEL_LEVEL LPGM_SIMD_BASELINE
+#include "kernels.h"
+#undef KERNEL
+#undef KERNEL_LEVEL
+
+#ifdef LPGM_SIMD_X86
+
+/* Bytes of a row left after the last full vector */
+static void
+lut_apply_tail(const unsigned char* src, unsigned char* dst, int n, const unsigned char* lut)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+	{
+		dst[i] = lut[src[i]];
+	}
+}
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#define KERNEL(name) sse41_##name
+#define KERNEL_LEVEL LPGM_SIMD_SSE41
+#include "kernels.h"
+#undef KERNEL
+#undef KERNEL_LEVEL
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+/*
+ * vpshufb looks up 16 entries at a time (the same ones in both 128-bit lanes)
+ * and gives 0 where bit 7 of the index is set. Step k looks up slice k of a
+ * recoded table with the samples minus 16 * k (wrapping), which only gives
+ * an entry for the 8 steps where that is below 128; for a sample in slice h
+ * those are steps 0 .. h (h < 8) or h - 7 .. h. The recoded slices are XORed
+ * so that what those steps give XORs to slice h: with P[h] = T[h] (h < 8) or
+ * T[h] ^ T[h - 8], slice k is P[k] ^ P[k - 1]. Built once per call in
+ * registers; two vectors per step so the two chains of XORs overlap.
+ */
+static void
+avx2_lut_apply(const unsigned char* src, unsigned char* dst, int n, const unsigned char* lut)
+{
+	__m128i p[16];
+	__m256i slices[16];
+	__m256i a, b, ra, rb, sixteen;
+	int i, k;
+
+	for (k = 0; k < 16; ++k)
+	{
+		p[k] = _mm_loadu_si128((const __m128i*)(lut + 16 * k));
+	}
+	for (k = 15; k >= 8; --k)
+	{
+		p[k] = _mm_xor_si128(p[k], p[k - 8]);
+	}
+	slices[0] = _mm256_broadcastsi128_si256(p[0]);
+	for (k = 1; k < 16; ++k)
+	{
+		slices[k] = _mm256_broadcastsi128_si256(_mm_xor_si128(p[k], p[k - 1]));
+	}
+	sixteen = _mm256_set1_epi8(16);
+
+	for (i = 0; i + 64 <= n; i += 64)
+	{
+		a = _mm256_loadu_si256((const __m256i*)(src + i));
+		b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+		ra = _mm256_shuffle_epi8(slices[0], a);
+		rb = _mm256_shuffle_epi8(slices[0], b);
+		for (k = 1; k < 16; ++k)
+		{
+			a = _mm256_sub_epi8(a, sixteen);
+			b = _mm256_sub_epi8(b, sixteen);
+			ra = _mm256_xor_si256(ra, _mm256_shuffle_epi8(slices[k], a));
+			rb = _mm256_xor_si256(rb, _mm256_shuffle_epi8(slices[k], b));
+		}
+		_mm256_storeu_si256((__m256i*)(dst + i), ra);
+		_mm256_storeu_si256((__m256i*)(dst + i + 32), rb);
+	}
+
+	lut_apply_tail(src + i, dst + i, n - i, lut);
+}
+
+#define KERNEL(name) avx2_##name
+#define KERNEL_LEVEL LPGM_SIMD_AVX2
+#define KERNEL_LUT_APPLY avx2_lut_apply
+#include "kernels.h"
+#undef KERNEL
+#undef KERNEL_LEVEL
+#undef KERNEL_LUT_APPLY
+#pragma GCC pop_options
+
+/*
+ * AVX-512F implies FMA, and GCC turns the complex multiply of the FFT
+ * butterflies into vfmsubadd even with -ffp-contract=off, which rounds
+ * differently. The AVX-512 table reuses the AVX2 butterflies.
+ */
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#define KERNEL(name) avx512_##name
+#define KERNEL_LEVEL LPGM_SIMD_AVX512
+#define KERNEL_FFT_STAGE avx2_fft_stage
+#define KERNEL_LUT_APPLY avx2_lut_apply
+#include "kernels.h"
+#undef KERNEL
+#undef KERNEL_LEVEL
+#undef KERNEL_FFT_STAGE
+#undef KERNEL_LUT_APPLY
+#pragma GCC pop_options
+
+/*
+ * With AVX-512 VBMI, vpermi2b looks up 128 entries of two registers at once:
+ * one lookup per table half, then bit 7 of the sample picks the half. The
+ * last partial vector goes through masked loads and stores.
+ */
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vbmi")
+static void
+avx512vbmi_lut_apply(const unsigned char* src, unsigned char* dst, int n, const unsigned char* lut)
+{
+	__m512i t0, t1, t2, t3, v, low_half, high_half;
+	__mmask64 rest;
+	int i;
+
+	t0 = _mm512_loadu_si512(lut);
+	t1 = _mm512_loadu_si512(lut + 64);
+	t2 = _mm512_loadu_si512(lut + 128);
+	t3 = _mm512_loadu_si512(lut + 192);
+
+	for (i = 0; i < n; i += 64)
+	{
+		rest = (n - i >= 64) ? ~(__mmask64)0 : (((__mmask64)1 << (n - i)) - 1);
+		v = _mm512_maskz_loadu_epi8(rest, src + i);
+		low_half = _mm512_permutex2var_epi8(t0, v, t1);
+		high_half = _mm512_permutex2var_epi8(t2, v, t3);
+		_mm512_mask_storeu_epi8(dst + i, rest, _mm512_mask_blend_epi8(_mm512_movepi8_mask(v), low_half, high_half));
+	}
+}
+#pragma GCC pop_options
+
+/* The avx512 table with the VBMI lookup, filled by select_kernels() on CPUs that have it */
+static lpgm_kernels_t g_avx512_vbmi_kernels;
+
+#endif
+
+static const char* g_level_names[] = { "scalar", "baseline", "sse4.1", "avx2", "avx512" };
+
+/* Until select_kernels() runs (e.g. from another constructor) */
+static const lpgm_kernels_t* g_kernels = &baseline_kernels;
+
+/* Highest level this CPU can run */
+static lpgm_simd_level_t
+cpu_level(void)
+{
+#ifdef LPGM_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		return LPGM_SIMD_AVX512;
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return LPGM_SIMD_AVX2;
+	}
+	if (__builtin_cpu_supports("sse4.1"))
+	{
+		return LPGM_SIMD_SSE41;
+	}
+#endif
+
+	return LPGM_SIMD_BASELINE;
+}
+
+static const lpgm_kernels_t*
+kernels_of(lpgm_simd_level_t level)
+{
+	switch (level)
+	{
+	case LPGM_SIMD_SCALAR:
+		return &scalar_kernels;
+#ifdef LPGM_SIMD_X86
+	case LPGM_SIMD_SSE41:
+		return &sse41_kernels;
+	case LPGM_SIMD_AVX2:
+		return &avx2_kernels;
+	case LPGM_SIMD_AVX512:
+		return &avx512_kernels;
+#endif
+	default:
+		return &baseline_kernels;
+	}
+}
+
+__attribute__((constructor)) static void
+select_kernels(void)
+{
+	lpgm_simd_level_t level, requested;
+	const char* env;
+	int i;
+
+	level = cpu_level();
+
+	env = getenv("LPGM_SIMD");
+	if (env != NULL && env[0] != '\0')
+	{
+		for (i = 0; i <= (int)LPGM_SIMD_AVX512; ++i)
+		{
+			if (strcmp(env, g_level_names[i]) == 0)
+			{
+				break;
+			}
+		}
+
+		if (i > (int)LPGM_SIMD_AVX512)
+		{
+			lpgm_log(LPGM_LOG_WARN, __func__, "Unknown LPGM_SIMD value: [%s], using [%s].", env, g_level_names[level]);
+		}
+		else
+		{
+			requested = (lpgm_simd_level_t)i;
+			if (requested > level)
+			{
+				lpgm_log(LPGM_LOG_WARN, __func__, "CPU does not support [%s], using [%s].", env, g_level_names[level]);
+			}
+			else
+			{
+				level = requested;
+			}
+		}
+	}
+
+	g_kernels = kernels_of(level);
+
+#ifdef LPGM_SIMD_X86
+	if (level == LPGM_SIMD_AVX512 && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi"))
+	{
+		g_avx512_vbmi_kernels = avx512_kernels;
+		g_avx512_vbmi_kernels.lut_apply = avx512vbmi_lut_apply;
+		g_kernels = &g_avx512_vbmi_kernels;
+	}
+#endif
+}
+
+const lpgm_kernels_t*
+lpgm_get_kernels(void)
+{
+	return g_kernels;
+}
+
+lpgm_simd_level_t
+lpgm_get_simd_level(void)
+{
+	return g_kernels->level;
+}
+
+const char*
+lpgm_simd_level_name(lpgm_simd_level_t level)
+{
+	if ((int)level < 0 || level > LPGM_SIMD_AVX512)
+	{
+		return "unknown";
+	}
+
+	return g_level_names[level];
+}
@@ -1,6 +1,18 @@
-#include "../include/pigiem.h"
+#include "internal.h"
 
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* Worker threads used by operations that can run in parallel */
+static int g_num_threads = 1;
+
+/* Messages above this level are dropped; the library is silent on success by default */
+static lpgm_log_level_t g_log_level = LPGM_LOG_ERROR;
+static lpgm_log_fn g_log_callback = NULL;
+static void* g_log_user_data = NULL;
 
 float
 lpgm_get_2Darray_value(const float* data, int cols, int x, int y)
@@ -16,8 +28,9 @@ lpgm_get_2Darray_value(const float* data, int cols, int x, int y)
 lpgm_status_t
 lpgm_normalize_array(float* data, int len, float new_max)
 {
-	int i;
-	float temp;
+	const lpgm_kernels_t* kernels = lpgm_get_kernels();
+	lpgm_point_op_t op = { LPGM_OP_NORMALIZE, new_max, 0.0f };
+	float range[2];
 	float min = 9999999;
 	float max = -999999;
 
@@ -27,29 +40,473 @@ lpgm_normalize_array(float* data, int len, float new_max)
 	}
 
 	// find max and min value
-	for (i = 0; i < len; ++i)
+	kernels->min_max(data, len, &min, &max);
+
+	if ((max - min) < .000000001)
+	{
+		min = 0.0;
+		max = 1.0;
+	}
+
+	/* (data[i] - min) / (max - min) * new_max */
+	range[0] = min;
+	range[1] = max;
+	kernels->point_ops(data, len, &op, 1, range);
+
+	return LPGM_OK;
+}
+
+void
+lpgm_set_num_threads(int num_threads)
+{
+	g_num_threads = (num_threads < 1) ? 1 : num_threads;
+}
+
+int
+lpgm_get_num_threads(void)
+{
+	return g_num_threads;
+}
+
+void
+lpgm_set_log_level(lpgm_log_level_t level)
+{
+	g_log_level = level;
+}
+
+lpgm_log_level_t
+lpgm_get_log_level(void)
+{
+	return g_log_level;
+}
+
+void
+lpgm_set_log_callback(lpgm_log_fn callback, void* user_data)
+{
+	g_log_callback = callback;
+	g_log_user_data = user_data;
+}
+
+void
+lpgm_log(lpgm_log_level_t level, const char* func, const char* format, ...)
+{
+	char message[512];
+	int n;
+	va_list args;
+
+	if (level > g_log_level || level == LPGM_LOG_NONE)
+	{
+		return;
+	}
+
+	n = snprintf(message, sizeof(message), "%s(): ", func);
+	if (n < 0 || (size_t)n >= sizeof(message))
+	{
+		n = 0;
+	}
+	va_start(args, format);
+	vsnprintf(message + n, sizeof(message) - n, format, args);
+	va_end(args);
+
+	if (g_log_callback != NULL)
+	{
+		g_log_callback(level, message, g_log_user_data);
+		return;
+	}
+
+	fprintf((level <= LPGM_LOG_WARN) ? stderr : stdout, "%s\n", message);
+}
+
+/*
+ * System allocations go through the hooks set with lpgm_set_allocator().
+ * Each block starts with a header of LPGM_ROW_ALIGN bytes, which keeps the
+ * caller's pointer aligned and remembers the size and the free hook the
+ * block came from:
+ *
+ *   base                      base + LPGM_ROW_ALIGN
+ *   | size, free, user_data |  caller's bytes ...
+ *
+ * so live bytes can be tracked and a block is released by the allocator it
+ * came from even if the hooks changed in between.
+ */
+typedef struct
+{
+	size_t size;  /* Header included */
+	void (*free)(void* ptr, void* user_data);
+	void* user_data;
+} block_header_t;
+
+static void*
+default_alloc(size_t size, void* user_data)
+{
+	(void)user_data;
+	return malloc(size);
+}
+
+static void*
+default_aligned_alloc(size_t alignment, size_t size, void* user_data)
+{
+	void* ptr;
+
+	(void)user_data;
+	if (posix_memalign(&ptr, alignment, size) != 0)
+	{
+		return NULL;
+	}
+
+	return ptr;
+}
+
+static void
+default_free(void* ptr, void* user_data)
+{
+	(void)user_data;
+	free(ptr);
+}
+
+static lpgm_allocator_t g_allocator = { default_alloc, default_aligned_alloc, default_free, NULL };
+
+/*
+ * Counters, updated atomically: threads may allocate concurrently.
+ * g_alloc_count: one increment per block obtained from the allocator, blocks
+ * served from a context's free lists are not counted.
+ */
+static unsigned long g_alloc_count = 0;
+static size_t g_live_bytes = 0;
+static size_t g_peak_bytes = 0;
+
+lpgm_status_t
+lpgm_set_allocator(const lpgm_allocator_t* allocator)
+{
+	if (allocator == NULL)
+	{
+		g_allocator.alloc = default_alloc;
+		g_allocator.aligned_alloc = default_aligned_alloc;
+		g_allocator.free = default_free;
+		g_allocator.user_data = NULL;
+		return LPGM_OK;
+	}
+
+	if (allocator->alloc == NULL || allocator->aligned_alloc == NULL || allocator->free == NULL)
+	{
+		lpgm_log(LPGM_LOG_ERROR, __func__, "Allocator hooks must not be NULL.");
+		return LPGM_FAIL;
+	}
+	g_allocator = *allocator;
+
+	return LPGM_OK;
+}
+
+static void
+add_live_bytes(size_t size)
+{
+	size_t live, peak;
+
+	live = __atomic_add_fetch(&g_live_bytes, size, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&g_peak_bytes, __ATOMIC_RELAXED);
+	while (live > peak && !__atomic_compare_exchange_n(&g_peak_bytes, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+	}
+}
+
+void*
+lpgm_sys_alloc(size_t size, int aligned)
+{
+	block_header_t* header;
+	char* base;
+
+	if (size > (size_t)-1 - LPGM_ROW_ALIGN)
+	{
+		return NULL;
+	}
+	size += LPGM_ROW_ALIGN;
+
+	if (aligned)
 	{
-		temp = data[i];
-		if (temp < min)
+		base = (char*)g_allocator.aligned_alloc(LPGM_ROW_ALIGN, size, g_allocator.user_data);
+	}
+	else
+	{
+		base = (char*)g_allocator.alloc(size, g_allocator.user_data);
+	}
+	if (base == NULL)
+	{
+		return NULL;
+	}
+
+	header = (block_header_t*)base;
+	header->size = size;
+	header->free = g_allocator.free;
+	header->user_data = g_allocator.user_data;
+
+	__atomic_add_fetch(&g_alloc_count, 1, __ATOMIC_RELAXED);
+	add_live_bytes(size);
+
+	return base + LPGM_ROW_ALIGN;
+}
+
+void
+lpgm_sys_free(void* ptr)
+{
+	block_header_t* header;
+
+	if (ptr == NULL)
+	{
+		return;
+	}
+
+	header = (block_header_t*)((char*)ptr - LPGM_ROW_ALIGN);
+	__atomic_sub_fetch(&g_live_bytes, header->size, __ATOMIC_RELAXED);
+	header->free(header, header->user_data);
+}
+
+/* Usable bytes of a block from lpgm_sys_alloc() */
+static size_t
+sys_block_size(const void* ptr)
+{
+	return ((const block_header_t*)((const char*)ptr - LPGM_ROW_ALIGN))->size - LPGM_ROW_ALIGN;
+}
+
+void*
+lpgm_malloc(size_t size)
+{
+	void* ptr;
+
+	if (lpgm_context_alloc(size, &ptr))
+	{
+		return ptr;
+	}
+
+	return lpgm_sys_alloc(size, 0);
+}
+
+void*
+lpgm_calloc(size_t n, size_t size)
+{
+	void* ptr;
+
+	if (size != 0 && n > (size_t)-1 / size)
+	{
+		return NULL;
+	}
+
+	ptr = lpgm_malloc(n * size);
+	if (ptr != NULL)
+	{
+		memset(ptr, 0, n * size);
+	}
+
+	return ptr;
+}
+
+/* The hooks have no realloc: a block that must grow moves to a new one */
+void*
+lpgm_realloc(void* ptr, size_t size)
+{
+	size_t old_size;
+	void* new_ptr;
+
+	if (ptr == NULL)
+	{
+		return lpgm_malloc(size);
+	}
+
+	old_size = lpgm_context_block_size(ptr);
+	if (old_size == 0)
+	{
+		old_size = sys_block_size(ptr);
+	}
+	if (size <= old_size)
+	{
+		return ptr;
+	}
+
+	new_ptr = lpgm_malloc(size);
+	if (new_ptr == NULL)
+	{
+		return NULL;
+	}
+	memcpy(new_ptr, ptr, old_size);
+	lpgm_free(ptr);
+
+	return new_ptr;
+}
+
+/* Context blocks are LPGM_ROW_ALIGN-aligned, so every entry point can use them */
+void*
+lpgm_aligned_alloc(size_t size)
+{
+	void* ptr;
+
+	if (lpgm_context_alloc(size, &ptr))
+	{
+		return ptr;
+	}
+
+	return lpgm_sys_alloc(size, 1);
+}
+
+void
+lpgm_free(void* ptr)
+{
+	if (ptr == NULL || lpgm_context_free(ptr))
+	{
+		return;
+	}
+	lpgm_sys_free(ptr);
+}
+
+unsigned long
+lpgm_get_alloc_count(void)
+{
+	return __atomic_load_n(&g_alloc_count, __ATOMIC_RELAXED);
+}
+
+void
+lpgm_reset_alloc_count(void)
+{
+	__atomic_store_n(&g_alloc_count, 0, __ATOMIC_RELAXED);
+}
+
+size_t
+lpgm_get_live_bytes(void)
+{
+	return __atomic_load_n(&g_live_bytes, __ATOMIC_RELAXED);
+}
+
+size_t
+lpgm_get_peak_bytes(void)
+{
+	return __atomic_load_n(&g_peak_bytes, __ATOMIC_RELAXED);
+}
+
+void
+lpgm_reset_peak_bytes(void)
+{
+	__atomic_store_n(&g_peak_bytes, __atomic_load_n(&g_live_bytes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+/*
+ * Worker pool of lpgm_parallel_run(): threads are started on first use and
+ * then wait for the next run, so a per-frame operation neither allocates nor
+ * creates threads. One run uses the pool at a time; a run that finds it busy
+ * (another thread's, or a task starting its own) runs on the calling thread.
+ */
+#define POOL_MAX_WORKERS 63
+
+static pthread_mutex_t g_pool_owner = PTHREAD_MUTEX_INITIALIZER;  /* Held for a whole run */
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;   /* Guards the fields below */
+static pthread_cond_t g_pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_pool_done = PTHREAD_COND_INITIALIZER;
+static pthread_t g_pool_threads[POOL_MAX_WORKERS];
+static int g_pool_size = 0;                /* Workers started */
+static int g_pool_stop = 0;                /* Set when the library is unloaded */
+static unsigned long g_pool_generation = 0; /* Bumped for every run */
+static void (*g_pool_task)(void* ctx, int index);
+static void* g_pool_ctx;
+static int g_pool_n_tasks;
+static int g_pool_next;                    /* Next task index to take */
+static int g_pool_busy;                    /* Workers not done with the current run */
+
+/* Take task indices of the current run until none are left; called with g_pool_lock held */
+static void
+pool_run_tasks(void)
+{
+	int i;
+
+	while (g_pool_next < g_pool_n_tasks)
+	{
+		i = g_pool_next++;
+		pthread_mutex_unlock(&g_pool_lock);
+		g_pool_task(g_pool_ctx, i);
+		pthread_mutex_lock(&g_pool_lock);
+	}
+}
+
+static void*
+pool_worker(void* arg)
+{
+	unsigned long seen = 0;
+
+	(void)arg;
+	pthread_mutex_lock(&g_pool_lock);
+	for (;;)
+	{
+		while (g_pool_generation == seen && !g_pool_stop)
 		{
-			min = temp;
+			pthread_cond_wait(&g_pool_wake, &g_pool_lock);
 		}
-		if (temp > max)
+		if (g_pool_stop)
 		{
-			max = temp;
+			break;
+		}
+		seen = g_pool_generation;
+
+		pool_run_tasks();
+		if (--g_pool_busy == 0)
+		{
+			pthread_cond_signal(&g_pool_done);
 		}
 	}
+	pthread_mutex_unlock(&g_pool_lock);
 
-	if ((max - min) < .000000001)
+	return NULL;
+}
+
+__attribute__((destructor)) static void
+pool_shutdown(void)
+{
+	int i;
+
+	pthread_mutex_lock(&g_pool_lock);
+	g_pool_stop = 1;
+	pthread_cond_broadcast(&g_pool_wake);
+	pthread_mutex_unlock(&g_pool_lock);
+
+	for (i = 0; i < g_pool_size; ++i)
 	{
-		min = 0.0;
-		max = 1.0;
+		pthread_join(g_pool_threads[i], NULL);
+	}
+	g_pool_size = 0;
+}
+
+void
+lpgm_parallel_run(int n_tasks, void (*task)(void* ctx, int index), void* ctx)
+{
+	int i, want;
+
+	if (n_tasks <= 1 || pthread_mutex_trylock(&g_pool_owner) != 0)
+	{
+		for (i = 0; i < n_tasks; ++i)
+		{
+			task(ctx, i);
+		}
+		return;
 	}
 
-	for (i = 0; i < len; ++i)
+	pthread_mutex_lock(&g_pool_lock);
+
+	/* The calling thread takes tasks too; if a thread cannot start, fewer do the work */
+	want = (n_tasks - 1 < POOL_MAX_WORKERS) ? n_tasks - 1 : POOL_MAX_WORKERS;
+	while (g_pool_size < want && pthread_create(&g_pool_threads[g_pool_size], NULL, pool_worker, NULL) == 0)
 	{
-		data[i] = (data[i] - min) / (max - min) * new_max;
+		++g_pool_size;
 	}
 
-	return LPGM_OK;
+	g_pool_task = task;
+	g_pool_ctx = ctx;
+	g_pool_n_tasks = n_tasks;
+	g_pool_next = 0;
+	g_pool_busy = g_pool_size;
+	++g_pool_generation;
+	pthread_cond_broadcast(&g_pool_wake);
+
+	pool_run_tasks();
+	while (g_pool_busy > 0)
+	{
+		pthread_cond_wait(&g_pool_done, &g_pool_lock);
+	}
+
+	pthread_mutex_unlock(&g_pool_lock);
+	pthread_mutex_unlock(&g_pool_owner);
 }
@@ -0,0 +1,35 @@
+#ifndef PGM_TEST_H
+#define PGM_TEST_H
+
+/*
+ * Minimal checks for the tests: each test_*.c is a program that returns 0
+ * when every CHECK() holds and stops at the first one that does not.
+ */
+
+#include <stdio.h>
+
+#include <pigiem.h>
+
+#define CHECK(cond)                                                                          \
+	do                                                                                       \
+	{                                                                                        \
+		if (!(cond))                                                                         \
+		{                                                                                    \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);         \
+			return 1;                                                                        \
+		}                                                                                    \
+	} while (0)
+
+/* Run a test function, reporting its name */
+#define RUN(test)                                                                            \
+	do                                                                                       \
+	{                                                                                        \
+		if ((test)() != 0)                                                                   \
+		{                                                                                    \
+			fprintf(stderr, "FAIL %s\n", #test);                                             \
+			return 1;                                                                        \
+		}                                                                                    \
+		fprintf(stdout, "ok   %s\n", #test);                                                 \
+	} while (0)
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Incremental histogram updates against a full recount of the new frame
+ */
+
+#include "test.h"
+
+#include <string.h>
+
+#define W 64
+#define H 48
+#define TILE 16
+
+static int
+same_counts(const lpgm_histogram_t* a, const lpgm_histogram_t* b)
+{
+	return a->n_bins == b->n_bins && a->total == b->total &&
+	       memcmp(a->counts, b->counts, (size_t)a->n_bins * sizeof(int)) == 0;
+}
+
+/* Frame with new content in the tiles of rects only */
+static void
+fill_frames(lpgm_image_u8_t* prev, lpgm_image_u8_t* cur, lpgm_image_t* prev_f, lpgm_image_t* cur_f,
+            const lpgm_rect_t* rects, int n_rects)
+{
+	int r, x, y;
+
+	for (y = 0; y < H; ++y)
+	{
+		for (x = 0; x < W; ++x)
+		{
+			prev->data[(size_t)y * prev->stride + x] = (unsigned char)((x * 7 + y * 3) % 256);
+		}
+	}
+	for (y = 0; y < H; ++y)
+	{
+		memcpy(cur->data + (size_t)y * cur->stride, prev->data + (size_t)y * prev->stride, W);
+	}
+	for (r = 0; r < n_rects; ++r)
+	{
+		for (y = rects[r].row; y < rects[r].row + rects[r].h; ++y)
+		{
+			for (x = rects[r].col; x < rects[r].col + rects[r].w; ++x)
+			{
+				cur->data[(size_t)y * cur->stride + x] = (unsigned char)((x * 13 + y * 29 + 100) % 256);
+			}
+		}
+	}
+	for (y = 0; y < H; ++y)
+	{
+		for (x = 0; x < W; ++x)
+		{
+			lpgm_image_row(prev_f, y)[x] = (float)prev->data[(size_t)y * prev->stride + x];
+			lpgm_image_row(cur_f, y)[x] = (float)cur->data[(size_t)y * cur->stride + x];
+		}
+	}
+}
+
+static int
+test_update_matches_recount(void)
+{
+	const lpgm_rect_t dirty[3] = { { 0, 0, TILE, TILE }, { TILE, 2 * TILE, TILE, TILE }, { 2 * TILE, 0, W, TILE } };
+	const lpgm_rect_t overlapping[2] = { { 0, 0, 2 * TILE, TILE }, { 0, TILE, TILE, TILE } };
+	const lpgm_rect_t touching[3] = { { 0, 0, TILE, TILE }, { 0, TILE, TILE, TILE }, { 5, 5, 0, TILE } };
+	lpgm_image_u8_t prev, cur, mask;
+	lpgm_image_t prev_f, cur_f;
+	lpgm_histogram_t hist, hist_f, full;
+	int r, x, y;
+
+	prev = lpgm_make_empty_image_u8(W, H);
+	cur = lpgm_make_empty_image_u8(W, H);
+	mask = lpgm_make_empty_image_u8(W, H);
+	prev_f = lpgm_make_empty_image(W, H);
+	cur_f = lpgm_make_empty_image(W, H);
+	hist = lpgm_histogram_create(256);
+	hist_f = lpgm_histogram_create(256);
+	full = lpgm_histogram_create(256);
+	CHECK(prev.data != NULL && cur.data != NULL && mask.data != NULL && prev_f.data != NULL && cur_f.data != NULL);
+	CHECK(hist.counts != NULL && hist_f.counts != NULL && full.counts != NULL);
+
+	/* Non-overlapping dirty tiles */
+	fill_frames(&prev, &cur, &prev_f, &cur_f, dirty, 3);
+	CHECK(lpgm_histogram_u8_into(&cur, &full) == LPGM_OK);
+	CHECK(lpgm_histogram_u8_into(&prev, &hist) == LPGM_OK);
+	CHECK(!same_counts(&hist, &full));
+	CHECK(lpgm_histogram_update_u8(&hist, &prev, &cur, dirty, 3) == LPGM_OK);
+	CHECK(same_counts(&hist, &full));
+	CHECK(lpgm_histogram_into(&prev_f, &hist_f) == LPGM_OK);
+	CHECK(lpgm_histogram_update(&hist_f, &prev_f, &cur_f, dirty, 3) == LPGM_OK);
+	CHECK(same_counts(&hist_f, &full));
+
+	/* Overlapping tiles would count their common pixels twice and leave hist as it was */
+	fill_frames(&prev, &cur, &prev_f, &cur_f, overlapping, 2);
+	CHECK(lpgm_histogram_u8_into(&prev, &hist) == LPGM_OK);
+	CHECK(lpgm_histogram_u8_into(&prev, &full) == LPGM_OK);
+	CHECK(lpgm_histogram_update_u8(&hist, &prev, &cur, overlapping, 2) == LPGM_FAIL);
+	CHECK(same_counts(&hist, &full));
+	CHECK(lpgm_histogram_into(&prev_f, &hist_f) == LPGM_OK);
+	CHECK(lpgm_histogram_update(&hist_f, &prev_f, &cur_f, overlapping, 2) == LPGM_FAIL);
+	CHECK(same_counts(&hist_f, &full));
+
+	/* Tiles sharing an edge, or an empty one inside another, do not overlap */
+	CHECK(lpgm_histogram_update_u8(&hist, &prev, &cur, touching, 3) == LPGM_OK);
+	CHECK(lpgm_histogram_u8_into(&cur, &full) == LPGM_OK);
+	CHECK(same_counts(&hist, &full));
+
+	/* A mask covering the changed pixels of overlapping tiles counts each once */
+	memset(mask.data, 0, (size_t)mask.stride * H);
+	for (r = 0; r < 2; ++r)
+	{
+		for (y = overlapping[r].row; y < overlapping[r].row + overlapping[r].h; ++y)
+		{
+			for (x = overlapping[r].col; x < overlapping[r].col + overlapping[r].w; ++x)
+			{
+				mask.data[(size_t)y * mask.stride + x] = 1;
+			}
+		}
+	}
+	CHECK(lpgm_histogram_u8_into(&prev, &hist) == LPGM_OK);
+	CHECK(lpgm_histogram_update_mask_u8(&hist, &prev, &cur, &mask) == LPGM_OK);
+	CHECK(same_counts(&hist, &full));
+	CHECK(lpgm_histogram_into(&prev_f, &hist_f) == LPGM_OK);
+	CHECK(lpgm_histogram_update_mask(&hist_f, &prev_f, &cur_f, &mask) == LPGM_OK);
+	CHECK(same_counts(&hist_f, &full));
+
+	lpgm_histogram_destroy(&full);
+	lpgm_histogram_destroy(&hist_f);
+	lpgm_histogram_destroy(&hist);
+	lpgm_image_destroy(&cur_f);
+	lpgm_image_destroy(&prev_f);
+	lpgm_image_u8_destroy(&mask);
+	lpgm_image_u8_destroy(&cur);
+	lpgm_image_u8_destroy(&prev);
+
+	return 0;
+}
+
+int
+main(void)
+{
+	lpgm_set_log_level(LPGM_LOG_NONE);
+
+	RUN(test_update_matches_recount);
+
+	return 0;
+}
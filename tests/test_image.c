@@ -0,0 +1,90 @@
+/*
+ * Fused point operations against the same operations run one call at a time
+ */
+
+#include "test.h"
+
+#include <math.h>
+
+#define W 37
+#define H 5
+
+static int
+same_image(const lpgm_image_t* a, const lpgm_image_t* b)
+{
+	int x, y;
+
+	for (y = 0; y < a->h; ++y)
+	{
+		for (x = 0; x < a->w; ++x)
+		{
+			if (fabsf(lpgm_image_row(a, y)[x] - lpgm_image_row(b, y)[x]) > 0.001f)
+			{
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+static int
+test_point_ops_match_separate_calls(void)
+{
+	const lpgm_point_op_t shifted[2] = { { LPGM_OP_BRIGHTNESS, 100.0f, 0 }, { LPGM_OP_NORMALIZE, 255.0f, 0 } };
+	const lpgm_point_op_t chain[5] = { { LPGM_OP_GAMMA, 0.5f, 0 },
+		                               { LPGM_OP_CONTRAST, 1.5f, 0 },
+		                               { LPGM_OP_INVERT, 0, 0 },
+		                               { LPGM_OP_NORMALIZE, 200.0f, 0 },
+		                               { LPGM_OP_THRESHOLD, 100.0f, 0 } };
+	lpgm_image_t im, fused, step;
+	int x, y;
+
+	im = lpgm_make_empty_image(W, H);
+	fused = lpgm_make_empty_image(W, H);
+	step = lpgm_make_empty_image(W, H);
+	CHECK(im.data != NULL && fused.data != NULL && step.data != NULL);
+
+	/* Pixels 0 .. 30: brightness moves all of them above the input range */
+	for (y = 0; y < H; ++y)
+	{
+		for (x = 0; x < W; ++x)
+		{
+			lpgm_image_row(&im, y)[x] = (float)((x + y * 3) % 31);
+		}
+	}
+
+	CHECK(lpgm_point_ops_into(&im, shifted, 2, &fused) == LPGM_OK);
+	CHECK(lpgm_brightness_into(&im, 100.0f, &step) == LPGM_OK);
+	lpgm_normalize_image_data(&step, 255.0f);
+	CHECK(same_image(&fused, &step));
+	CHECK(lpgm_image_row(&fused, 0)[0] == 0.0f && lpgm_image_row(&fused, 0)[30] == 255.0f);
+
+	CHECK(lpgm_point_ops_into(&im, chain, 5, &fused) == LPGM_OK);
+	CHECK(lpgm_gamma_into(&im, 0.5f, &step) == LPGM_OK);
+	CHECK(lpgm_contrast_into(&step, 1.5f, &step) == LPGM_OK);
+	CHECK(lpgm_invert_into(&step, &step) == LPGM_OK);
+	lpgm_normalize_image_data(&step, 200.0f);
+	CHECK(lpgm_threshold_into(&step, 100.0f, &step) == LPGM_OK);
+	CHECK(same_image(&fused, &step));
+
+	/* In place as well */
+	CHECK(lpgm_point_ops_into(&im, shifted, 2, &im) == LPGM_OK);
+	CHECK(lpgm_image_row(&im, 0)[0] == 0.0f && lpgm_image_row(&im, 0)[30] == 255.0f);
+
+	lpgm_image_destroy(&step);
+	lpgm_image_destroy(&fused);
+	lpgm_image_destroy(&im);
+
+	return 0;
+}
+
+int
+main(void)
+{
+	lpgm_set_log_level(LPGM_LOG_NONE);
+
+	RUN(test_point_ops_match_separate_calls);
+
+	return 0;
+}
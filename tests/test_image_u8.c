@@ -0,0 +1,253 @@
+/*
+ * 8-bit neighborhood operations: border and interior paths against a
+ * plain zero-padded reference
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+/* Pixel at (x = row, y = column) or 0 outside */
+static int
+at(const lpgm_image_u8_t* im, int x, int y)
+{
+	if (x < 0 || x >= im->h || y < 0 || y >= im->w)
+	{
+		return 0;
+	}
+
+	return im->data[(size_t)x * im->stride + y];
+}
+
+static int
+compare_u8(const void* a, const void* b)
+{
+	return *(const unsigned char*)a - *(const unsigned char*)b;
+}
+
+/* Median (rank 1), min (0) or max (2) of the ksize window at (x, y) */
+static int
+reference_rank(const lpgm_image_u8_t* im, int x, int y, int ksize, int rank)
+{
+	unsigned char window[49];
+	int i, j, k, half;
+
+	half = ksize / 2;
+	k = 0;
+	for (i = -half; i <= half; ++i)
+	{
+		for (j = -half; j <= half; ++j)
+		{
+			window[k++] = (unsigned char)at(im, x + i, y + j);
+		}
+	}
+	qsort(window, (size_t)k, 1, compare_u8);
+
+	return (rank == 0) ? window[0] : (rank == 2) ? window[k - 1] : window[k / 2];
+}
+
+/* A view with odd size and stride, so rows do not start on the aligned boundary */
+static int
+test_filters_match_reference(void)
+{
+	lpgm_image_u8_t big, im, dst, tmp;
+	int x, y, ksize, rank;
+
+	big = lpgm_make_empty_image_u8(40, 23);
+	CHECK(big.data != NULL);
+	for (x = 0; x < big.h; ++x)
+	{
+		for (y = 0; y < big.w; ++y)
+		{
+			big.data[(size_t)x * big.stride + y] = (unsigned char)((x * 71 + y * 29 + x * y) % 256);
+		}
+	}
+	im = lpgm_image_u8_roi(&big, 1, 3, 33, 19);
+	dst = lpgm_make_empty_image_u8(im.w, im.h);
+	tmp = lpgm_make_empty_image_u8(im.w, im.h);
+	CHECK(im.data != NULL && dst.data != NULL && tmp.data != NULL);
+
+	for (ksize = 1; ksize <= 7; ksize += 2)
+	{
+		for (rank = 0; rank < 3; ++rank)
+		{
+			if (rank == 0)
+			{
+				CHECK(lpgm_erode_u8_into(&im, ksize, &dst) == LPGM_OK);
+			}
+			else if (rank == 1)
+			{
+				CHECK(lpgm_median_filter_u8_into(&im, ksize, &dst) == LPGM_OK);
+			}
+			else
+			{
+				CHECK(lpgm_dilate_u8_into(&im, ksize, &dst) == LPGM_OK);
+			}
+
+			for (x = 0; x < im.h; ++x)
+			{
+				for (y = 0; y < im.w; ++y)
+				{
+					CHECK(at(&dst, x, y) == reference_rank(&im, x, y, ksize, rank));
+				}
+			}
+		}
+	}
+
+	/* Sobel: |G| of the zero-padded gradients, clamped to 255 */
+	CHECK(lpgm_sobel_u8_into(&im, &dst) == LPGM_OK);
+	for (x = 0; x < im.h; ++x)
+	{
+		for (y = 0; y < im.w; ++y)
+		{
+			int gx = (at(&im, x - 1, y + 1) + 2 * at(&im, x, y + 1) + at(&im, x + 1, y + 1))
+			         - (at(&im, x - 1, y - 1) + 2 * at(&im, x, y - 1) + at(&im, x + 1, y - 1));
+			int gy = (at(&im, x + 1, y - 1) + 2 * at(&im, x + 1, y) + at(&im, x + 1, y + 1))
+			         - (at(&im, x - 1, y - 1) + 2 * at(&im, x - 1, y) + at(&im, x - 1, y + 1));
+			int g2 = gx * gx + gy * gy;
+			int level = at(&dst, x, y);
+
+			CHECK(level == 255 ? g2 >= 255 * 255 : (level * level <= g2 && g2 < (level + 1) * (level + 1)));
+		}
+	}
+
+	/* Opening with a caller scratch image equals erode then dilate */
+	CHECK(lpgm_opening_u8_into(&im, 3, &dst, &tmp) == LPGM_OK);
+	CHECK(lpgm_erode_u8_into(&im, 3, &tmp) == LPGM_OK);
+	for (x = 0; x < im.h; ++x)
+	{
+		for (y = 0; y < im.w; ++y)
+		{
+			CHECK(at(&dst, x, y) == reference_rank(&tmp, x, y, 3, 2));
+		}
+	}
+
+	/* Neighborhood operations cannot run in place */
+	CHECK(lpgm_sobel_u8_into(&im, &im) == LPGM_FAIL);
+	CHECK(lpgm_erode_u8_into(&dst, 3, &dst) == LPGM_FAIL);
+
+	lpgm_image_u8_destroy(&tmp);
+	lpgm_image_u8_destroy(&dst);
+	lpgm_image_u8_destroy(&big);
+
+	return 0;
+}
+
+/* Fixed-point weights keep the sum of the kernel: a box filter leaves a flat area at its level */
+static int
+test_convolve_keeps_flat_level(void)
+{
+	float box3[9], box5[25];
+	lpgm_image_u8_t im, out;
+	int k, x, y;
+
+	for (k = 0; k < 9; ++k)
+	{
+		box3[k] = 1.0f / 9.0f;
+	}
+	for (k = 0; k < 25; ++k)
+	{
+		box5[k] = 1.0f / 25.0f;
+	}
+
+	im = lpgm_make_empty_image_u8(11, 9);
+	CHECK(im.data != NULL);
+	memset(im.data, 255, (size_t)im.stride * im.h);
+
+	out = lpgm_convolve_u8(&im, box3, 3);
+	CHECK(out.data != NULL);
+	for (x = 1; x < im.h - 1; ++x)
+	{
+		for (y = 1; y < im.w - 1; ++y)
+		{
+			CHECK(at(&out, x, y) == 255);
+		}
+	}
+	lpgm_image_u8_destroy(&out);
+
+	out = lpgm_convolve_u8(&im, box5, 5);
+	CHECK(out.data != NULL);
+	for (x = 2; x < im.h - 2; ++x)
+	{
+		for (y = 2; y < im.w - 2; ++y)
+		{
+			CHECK(at(&out, x, y) == 255);
+		}
+	}
+	lpgm_image_u8_destroy(&out);
+	lpgm_image_u8_destroy(&im);
+
+	return 0;
+}
+
+/* Table lookups match a plain per-byte mapping at every width and alignment, in place or not */
+static int
+test_apply_lut_matches_table(void)
+{
+	lpgm_image_u8_t big, im, dst;
+	lpgm_lut_u8_t lut;
+	unsigned char expected;
+	int v, w, col, x, y;
+
+	/* A table with no structure, so every slice and half is exercised */
+	for (v = 0; v < 256; ++v)
+	{
+		lut.v[v] = (unsigned char)((v * 167 + 91) ^ (v >> 3));
+	}
+
+	big = lpgm_make_empty_image_u8(200, 3);
+	dst = lpgm_make_empty_image_u8(200, 3);
+	CHECK(big.data != NULL && dst.data != NULL);
+	for (w = 1; w <= 150; ++w)
+	{
+		col = w % 7;
+		for (x = 0; x < big.h; ++x)
+		{
+			for (y = 0; y < big.w; ++y)
+			{
+				big.data[(size_t)x * big.stride + y] = (unsigned char)(x * 101 + y * 13 + w);
+			}
+		}
+		im = lpgm_image_u8_roi(&big, 0, col, w, 3);
+		dst.w = w;
+		CHECK(lpgm_apply_lut_u8_into(&im, &lut, &dst) == LPGM_OK);
+		for (x = 0; x < im.h; ++x)
+		{
+			for (y = 0; y < w; ++y)
+			{
+				CHECK(at(&dst, x, y) == lut.v[at(&im, x, y)]);
+			}
+			/* Nothing past the row is written */
+			CHECK(w == big.w || dst.data[(size_t)x * dst.stride + w] == 0);
+		}
+
+		CHECK(lpgm_apply_lut_u8_into(&im, &lut, &im) == LPGM_OK);
+		for (x = 0; x < im.h; ++x)
+		{
+			for (y = 0; y < w; ++y)
+			{
+				expected = lut.v[(unsigned char)(x * 101 + (y + col) * 13 + w)];
+				CHECK(at(&im, x, y) == expected);
+			}
+		}
+	}
+	dst.w = 200;
+
+	lpgm_image_u8_destroy(&dst);
+	lpgm_image_u8_destroy(&big);
+
+	return 0;
+}
+
+int
+main(void)
+{
+	lpgm_set_log_level(LPGM_LOG_NONE);
+
+	RUN(test_filters_match_reference);
+	RUN(test_convolve_keeps_flat_level);
+	RUN(test_apply_lut_matches_table);
+
+	return 0;
+}
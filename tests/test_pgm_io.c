@@ -0,0 +1,276 @@
+/*
+ * PGM reading and writing edge cases
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+
+/* Write size bytes of data to file_name; returns 0 on success */
+static int
+write_file(const char* file_name, const char* data, size_t size)
+{
+	FILE* file_ptr;
+	size_t written;
+
+	file_ptr = fopen(file_name, "wb");
+	if (file_ptr == NULL)
+	{
+		return -1;
+	}
+	written = fwrite(data, 1, size, file_ptr);
+	fclose(file_ptr);
+
+	return (written == size) ? 0 : -1;
+}
+
+/* A header whose w * h does not fit an int is rejected before any allocation */
+static int
+test_oversized_header(void)
+{
+	const char p5[] = "P5\n65536 65536\n255\n\x01\x02\x03\x04";
+	const char p2[] = "P2\n70000 40000\n255\n1 2 3 4\n";
+	lpgm_t pgm;
+
+	CHECK(write_file("oversized_p5.pgm", p5, sizeof(p5) - 1) == 0);
+	CHECK(write_file("oversized_p2.pgm", p2, sizeof(p2) - 1) == 0);
+	CHECK(lpgm_file_read("oversized_p5.pgm", &pgm) == LPGM_FAIL);
+	CHECK(lpgm_file_read("oversized_p2.pgm", &pgm) == LPGM_FAIL);
+
+	return 0;
+}
+
+/* Same for a frame of a multi-frame stream, after a valid first frame */
+static int
+test_oversized_frame(void)
+{
+	const char frames[] = "P5\n2 1\n255\n\x01\x02P5\n65536 65536\n255\n\x01\x02\x03\x04";
+	lpgm_frame_reader_t* reader;
+	lpgm_t* frame;
+	int fds[2];
+
+	CHECK(pipe(fds) == 0);
+	CHECK(write(fds[1], frames, sizeof(frames) - 1) == (ssize_t)(sizeof(frames) - 1));
+	close(fds[1]);
+
+	reader = lpgm_frame_reader_open_fd(fds[0], 0);
+	CHECK(reader != NULL);
+	CHECK(lpgm_frame_reader_next(reader, &frame) == LPGM_OK);
+	CHECK(frame->im.w == 2 && frame->im.data[1] == 2.0f);
+	CHECK(lpgm_frame_reader_next(reader, &frame) == LPGM_FAIL);
+	lpgm_frame_reader_close(reader);
+	close(fds[0]);
+
+	return 0;
+}
+
+/* P2 keeps the old writer's truncated, unclamped samples; P5 clamps to max_val */
+static int
+test_p2_unclamped(void)
+{
+	const char expected[] = "P2\n4 1\n255\n300 -5 0 254 \n";
+	lpgm_t pgm;
+	void* data;
+	size_t size;
+
+	memset(&pgm, 0, sizeof(pgm));
+	strcpy(pgm.magic_number, "P2");
+	pgm.max_val = 255;
+	pgm.im = lpgm_make_empty_image(4, 1);
+	CHECK(pgm.im.data != NULL);
+	pgm.im.data[0] = 300.0f;
+	pgm.im.data[1] = -5.7f;
+	pgm.im.data[2] = -0.5f;
+	pgm.im.data[3] = 254.9f;
+
+	CHECK(lpgm_mem_write_alloc(&pgm, &data, &size) == LPGM_OK);
+	CHECK(size == sizeof(expected) - 1);
+	CHECK(memcmp(data, expected, size) == 0);
+	free(data);
+
+	/* P5 still clamps to max_val */
+	strcpy(pgm.magic_number, "P5");
+	CHECK(lpgm_mem_write_alloc(&pgm, &data, &size) == LPGM_OK);
+	CHECK(size == 11 + 4);
+	CHECK(memcmp((const char*)data + 11, "\xff\x00\x00\xfe", 4) == 0);
+	free(data);
+
+	lpgm_image_destroy(&pgm.im);
+
+	return 0;
+}
+
+/* Fill a w x h image with a pattern of levels below max_val */
+static lpgm_t
+make_test_pgm(const char* magic_number, int w, int h, int max_val)
+{
+	lpgm_t pgm;
+	int x, y;
+
+	memset(&pgm, 0, sizeof(pgm));
+	strcpy(pgm.magic_number, magic_number);
+	pgm.max_val = max_val;
+	pgm.im = lpgm_make_empty_image(w, h);
+	for (y = 0; y < h && pgm.im.data != NULL; ++y)
+	{
+		for (x = 0; x < w; ++x)
+		{
+			lpgm_image_row(&pgm.im, y)[x] = (float)((x * 37 + y * 11) % (max_val + 1));
+		}
+	}
+
+	return pgm;
+}
+
+static int
+same_pixels(const lpgm_image_t* a, const lpgm_image_t* b)
+{
+	int y;
+
+	if (a->w != b->w || a->h != b->h)
+	{
+		return 0;
+	}
+	for (y = 0; y < a->h; ++y)
+	{
+		if (memcmp(lpgm_image_row(a, y), lpgm_image_row(b, y), (size_t)a->w * sizeof(float)) != 0)
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* lpgm_fd_read() stops at the end of each image, so images queued on one pipe are read one by one */
+static int
+test_fd_read_back_to_back(void)
+{
+	lpgm_t in[3], out;
+	int fds[2], i;
+	char tail;
+
+	in[0] = make_test_pgm("P5", 33, 7, 255);
+	in[1] = make_test_pgm("P2", 5, 3, 255);
+	in[2] = make_test_pgm("P5", 9, 4, 1000);
+	CHECK(pipe(fds) == 0);
+	for (i = 0; i < 3; ++i)
+	{
+		CHECK(in[i].im.data != NULL);
+		CHECK(lpgm_fd_write(&in[i], fds[1]) == LPGM_OK);
+	}
+	CHECK(write(fds[1], "!", 1) == 1);
+	close(fds[1]);
+
+	for (i = 0; i < 3; ++i)
+	{
+		CHECK(lpgm_fd_read(fds[0], &out) == LPGM_OK);
+		CHECK(strcmp(out.magic_number, in[i].magic_number) == 0);
+		CHECK(out.max_val == in[i].max_val);
+		CHECK(same_pixels(&out.im, &in[i].im));
+		lpgm_file_destroy(&out);
+	}
+
+	/* What follows the last image is still on the pipe; P2 only took the delimiter after its last sample */
+	CHECK(read(fds[0], &tail, 1) == 1);
+	CHECK(tail == '!');
+	close(fds[0]);
+
+	for (i = 0; i < 3; ++i)
+	{
+		lpgm_image_destroy(&in[i].im);
+	}
+
+	return 0;
+}
+
+/* A mapped view takes writes, e.g. an in-place operation, without changing the file */
+static int
+test_map_view_writable(void)
+{
+	lpgm_t pgm, reread;
+	lpgm_map_t map;
+	lpgm_image_u8_t view;
+	int x;
+
+	pgm = make_test_pgm("P5", 13, 3, 255);
+	CHECK(pgm.im.data != NULL);
+	CHECK(lpgm_file_write(&pgm, "map.pgm") == LPGM_OK);
+
+	CHECK(lpgm_file_map("map.pgm", &map) == LPGM_OK);
+	view = lpgm_map_to_image_u8(&map);
+	CHECK(view.data != NULL);
+	for (x = 0; x < view.w; ++x)
+	{
+		view.data[view.stride + x] = (unsigned char)(255 - view.data[view.stride + x]);
+	}
+	CHECK(map.data[map.stride + 1] == (unsigned char)(255 - (int)lpgm_image_row(&pgm.im, 1)[1]));
+	lpgm_file_unmap(&map);
+
+	CHECK(lpgm_file_read("map.pgm", &reread) == LPGM_OK);
+	CHECK(same_pixels(&reread.im, &pgm.im));
+	lpgm_file_destroy(&reread);
+	lpgm_image_destroy(&pgm.im);
+
+	return 0;
+}
+
+static lpgm_image_t
+strip_sobel(const lpgm_image_t* window, void* user_data)
+{
+	(void)user_data;
+
+	return lpgm_sobel(window);
+}
+
+/* Strips and halos beyond the image height need a window of the image, not of strip_rows + 2 * halo rows */
+static int
+test_stream_strip_beyond_image(void)
+{
+	lpgm_t pgm, got, expected;
+	lpgm_stream_t in, out;
+	lpgm_image_t sobel;
+
+	pgm = make_test_pgm("P5", 29, 11, 255);
+	CHECK(pgm.im.data != NULL);
+	CHECK(lpgm_file_write(&pgm, "stream_in.pgm") == LPGM_OK);
+
+	CHECK(lpgm_stream_open("stream_in.pgm", &in) == LPGM_OK);
+	CHECK(lpgm_stream_create("stream_out.pgm", &in.header, &out) == LPGM_OK);
+	CHECK(lpgm_stream_filter(&in, &out, INT_MAX, INT_MAX, strip_sobel, NULL) == LPGM_OK);
+	CHECK(lpgm_stream_close(&in) == LPGM_OK);
+	CHECK(lpgm_stream_close(&out) == LPGM_OK);
+
+	sobel = lpgm_sobel(&pgm.im);
+	CHECK(sobel.data != NULL);
+	lpgm_image_destroy(&pgm.im);
+	pgm.im = sobel;
+	CHECK(lpgm_file_write(&pgm, "stream_expected.pgm") == LPGM_OK);
+	CHECK(lpgm_file_read("stream_out.pgm", &got) == LPGM_OK);
+	CHECK(lpgm_file_read("stream_expected.pgm", &expected) == LPGM_OK);
+	CHECK(same_pixels(&got.im, &expected.im));
+
+	lpgm_file_destroy(&expected);
+	lpgm_file_destroy(&got);
+	lpgm_image_destroy(&pgm.im);
+
+	return 0;
+}
+
+int
+main(void)
+{
+	lpgm_set_log_level(LPGM_LOG_NONE);
+
+	RUN(test_oversized_header);
+	RUN(test_oversized_frame);
+	RUN(test_p2_unclamped);
+	RUN(test_fd_read_back_to_back);
+	RUN(test_map_view_writable);
+	RUN(test_stream_strip_beyond_image);
+
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * A frame loop built on the _into operations allocates nothing once its
+ * images exist (see lpgm_get_alloc_count())
+ */
+
+#include "test.h"
+
+#define BORDER 3
+
+/* Run every step of one frame; returns 0 when all of them succeed */
+static int
+process_frame(int frame, lpgm_image_t* im, lpgm_image_t* work, lpgm_image_t* tmp, lpgm_image_t* padded,
+              lpgm_image_u8_t* im_u8, lpgm_image_u8_t* work_u8, lpgm_image_u8_t* tmp_u8, lpgm_histogram_t* hist)
+{
+	const float kernel[9] = { 1 / 16.0f, 2 / 16.0f, 1 / 16.0f, 2 / 16.0f, 4 / 16.0f, 2 / 16.0f, 1 / 16.0f, 2 / 16.0f,
+		                      1 / 16.0f };
+	const lpgm_point_op_t ops[2] = { { LPGM_OP_GAMMA, 0.8f, 0 }, { LPGM_OP_CONTRAST, 1.2f, 0 } };
+	lpgm_lut_u8_t lut;
+	int x, y;
+
+	for (x = 0; x < im->h; ++x)
+	{
+		for (y = 0; y < im->w; ++y)
+		{
+			lpgm_image_row(im, x)[y] = (float)((x * 13 + y * 7 + frame * 5) % 256);
+			im_u8->data[(size_t)x * im_u8->stride + y] = (unsigned char)((x * 3 + y * 11 + frame) % 256);
+		}
+	}
+
+	/* Float operations */
+	CHECK(lpgm_border_image_into(im, BORDER, padded) == LPGM_OK);
+	CHECK(lpgm_point_ops_into(im, ops, 2, im) == LPGM_OK);
+	CHECK(lpgm_brightness_into(im, 10.0f, im) == LPGM_OK);
+	CHECK(lpgm_convolve_into(im, kernel, 3, work) == LPGM_OK);
+	CHECK(lpgm_sobel_into(work, im) == LPGM_OK);
+	CHECK(lpgm_median_filter_into(im, 3, work) == LPGM_OK);
+	CHECK(lpgm_opening_into(work, 3, im, tmp) == LPGM_OK);
+	CHECK(lpgm_closing_into(im, 3, work, tmp) == LPGM_OK);
+	CHECK(lpgm_histogram_into(work, hist) == LPGM_OK);
+	CHECK(lpgm_histogram_equalization_from_into(work, hist, im) == LPGM_OK);
+	CHECK(lpgm_threshold_into(im, 128.0f, im) == LPGM_OK);
+
+	/* uint8 operations */
+	CHECK(lpgm_lut_gamma(&lut, 0.7f) == LPGM_OK);
+	CHECK(lpgm_apply_lut_u8_into(im_u8, &lut, im_u8) == LPGM_OK);
+	CHECK(lpgm_convolve_u8_into(im_u8, kernel, 3, work_u8) == LPGM_OK);
+	CHECK(lpgm_sobel_u8_into(work_u8, im_u8) == LPGM_OK);
+	CHECK(lpgm_median_filter_u8_into(im_u8, 3, work_u8) == LPGM_OK);
+	CHECK(lpgm_erode_u8_into(work_u8, 3, im_u8) == LPGM_OK);
+	CHECK(lpgm_dilate_u8_into(im_u8, 3, work_u8) == LPGM_OK);
+	CHECK(lpgm_opening_u8_into(work_u8, 3, im_u8, tmp_u8) == LPGM_OK);
+	CHECK(lpgm_closing_u8_into(im_u8, 3, work_u8, tmp_u8) == LPGM_OK);
+	CHECK(lpgm_histogram_u8_into(work_u8, hist) == LPGM_OK);
+
+	return 0;
+}
+
+/* Frames of w x h pixels allocate nothing after the first one */
+static int
+frame_loop_allocates_nothing(int w, int h)
+{
+	lpgm_image_t im, work, tmp, padded;
+	lpgm_image_u8_t im_u8, work_u8, tmp_u8;
+	lpgm_histogram_t hist;
+	unsigned long allocs;
+	int frame;
+
+	im = lpgm_make_empty_image(w, h);
+	work = lpgm_make_empty_image(w, h);
+	tmp = lpgm_make_empty_image(w, h);
+	padded = lpgm_make_empty_image(w + 2 * BORDER, h + 2 * BORDER);
+	im_u8 = lpgm_make_empty_image_u8(w, h);
+	work_u8 = lpgm_make_empty_image_u8(w, h);
+	tmp_u8 = lpgm_make_empty_image_u8(w, h);
+	hist = lpgm_histogram_create(256);
+	CHECK(im.data != NULL && work.data != NULL && tmp.data != NULL && padded.data != NULL);
+	CHECK(im_u8.data != NULL && work_u8.data != NULL && tmp_u8.data != NULL && hist.counts != NULL);
+
+	/* The first frame may warm up internal state, the next ones must not allocate */
+	CHECK(process_frame(0, &im, &work, &tmp, &padded, &im_u8, &work_u8, &tmp_u8, &hist) == 0);
+	allocs = lpgm_get_alloc_count();
+	CHECK(allocs > 0);
+	for (frame = 1; frame < 4; ++frame)
+	{
+		CHECK(process_frame(frame, &im, &work, &tmp, &padded, &im_u8, &work_u8, &tmp_u8, &hist) == 0);
+	}
+	CHECK(lpgm_get_alloc_count() == allocs);
+
+	/* Destination size is checked like for the other _into operations */
+	CHECK(lpgm_border_image_into(&im, BORDER + 1, &padded) == LPGM_FAIL);
+	CHECK(lpgm_border_image_into(&im, -1, &padded) == LPGM_FAIL);
+	CHECK(lpgm_border_image_into(&im, 0, &im) == LPGM_FAIL);
+
+	lpgm_histogram_destroy(&hist);
+	lpgm_image_u8_destroy(&tmp_u8);
+	lpgm_image_u8_destroy(&work_u8);
+	lpgm_image_u8_destroy(&im_u8);
+	lpgm_image_destroy(&padded);
+	lpgm_image_destroy(&tmp);
+	lpgm_image_destroy(&work);
+	lpgm_image_destroy(&im);
+
+	return 0;
+}
+
+static int
+test_frame_loop_allocates_nothing(void)
+{
+	return frame_loop_allocates_nothing(61, 37);
+}
+
+/* Large enough for the threaded histogram path (HIST_PARALLEL_MIN pixels) */
+static int
+test_threaded_frame_loop_allocates_nothing(void)
+{
+	int result;
+
+	lpgm_set_num_threads(4);
+	result = frame_loop_allocates_nothing(1280, 832);
+	lpgm_set_num_threads(1);
+
+	return result;
+}
+
+int
+main(void)
+{
+	lpgm_set_log_level(LPGM_LOG_NONE);
+
+	RUN(test_frame_loop_allocates_nothing);
+	RUN(test_threaded_frame_loop_allocates_nothing);
+
+	return 0;
+}